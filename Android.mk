@@ -30,7 +30,7 @@ LOCAL_CFLAGS :=
 LOCAL_LDFLAGS := -Wl,--no-gc-sections
 
 TRACE_SRC_FILES = tracefile_idlestat.c tracefile_ftrace.c \
-		tracefile_tracecmd.c
+		tracefile_tracecmd.c tracefile_raw.c
 
 REPORT_SRC_FILES = default_report.c csv_report.c comparison_report.c
 
@@ -38,6 +38,18 @@ LOCAL_SRC_FILES += \
 	idlestat.c \
 	topology.c \
 	trace.c    \
+	trace_event.c   \
+	line_reader.c   \
+	arena.c   \
+	intern.c   \
+	analysis.c   \
+	ring.c   \
+	trace_raw.c   \
+	trace_perf.c   \
+	trace_bpf.c   \
+	live.c   \
+	counters.c   \
+	reorder.c   \
 	utils.c   \
 	energy_model.c   \
 	reports.c   \
@@ -0,0 +1,507 @@
+/*
+ *  analysis.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+#include "idlestat.h"
+#include "intern.h"
+#include "topology.h"
+#include "trace_event.h"
+#include "utils.h"
+
+#define STREAM_MIN_ENTRIES 1024
+
+/* An event queued for the analysis of one cpu */
+struct cpu_event {
+	uint64_t seq;		/* position in the trace */
+	uint64_t time;
+	int type;
+	int cpu;		/* cpu the event was logged on */
+	unsigned int value;
+	const char *name;	/* interned */
+};
+
+enum group_change_type {
+	GROUP_CSTATE,
+	GROUP_PSTATE,
+};
+
+/* A change a cpu made to its core and cluster, see update_group_*() */
+struct group_change {
+	uint64_t seq;		/* event that caused the change */
+	uint64_t time;
+	int type;
+	int cpu;
+	int record;
+	int old_cstate;
+	int new_cstate;
+	unsigned int core_freq;
+	unsigned int cluster_freq;
+};
+
+struct cpu_stream {
+	struct cpu_event *events;
+	size_t nr_events;
+	size_t max_events;
+	struct group_change *changes;
+	size_t nr_changes;
+	size_t max_changes;
+	uint64_t seq;		/* event being analyzed */
+	size_t failed;
+};
+
+struct event_streams {
+	struct cpu_stream *cpus;
+	int nrcpus;
+	uint64_t seq;
+};
+
+struct job_pool {
+	void (*work)(void *arg, int index);
+	void *arg;
+	int count;
+	int next;
+};
+
+struct cluster_jobs {
+	struct cpuidle_datas *datas;
+	struct cpu_physical **clusters;
+	size_t *failed;
+};
+
+static int analysis_jobs = 1;
+
+/**
+ * set_analysis_jobs - set the number of threads analyzing a trace
+ * @jobs: number of threads, 1 to analyze the events as they are read
+ */
+void set_analysis_jobs(int jobs)
+{
+	analysis_jobs = jobs > 0 ? jobs : 1;
+}
+
+/**
+ * get_analysis_jobs - get the number of threads analyzing a trace
+ */
+int get_analysis_jobs(void)
+{
+	return analysis_jobs;
+}
+
+static int grow_stream(void **array, size_t *max, size_t size)
+{
+	size_t nr = *max ? *max * 2 : STREAM_MIN_ENTRIES;
+	void *tmp;
+
+	tmp = realloc(*array, nr * size);
+	if (!tmp)
+		return error(__func__);
+
+	*array = tmp;
+	*max = nr;
+	return 0;
+}
+
+/**
+ * setup_event_streams - prepare @datas for parallel analysis if enabled
+ *
+ * Once set up, store_trace_event() queues the events instead of
+ * analyzing them. They are analyzed by analyze_event_streams().
+ *
+ * @return: 0 on success, -1 on error
+ */
+int setup_event_streams(struct cpuidle_datas *datas)
+{
+	struct event_streams *streams;
+
+	if (analysis_jobs < 2)
+		return 0;
+
+	streams = calloc(1, sizeof(*streams));
+	if (!streams)
+		return error(__func__);
+
+	streams->cpus = calloc(datas->nrcpus, sizeof(*streams->cpus));
+	if (!streams->cpus) {
+		free(streams);
+		return error(__func__);
+	}
+
+	streams->nrcpus = datas->nrcpus;
+	datas->streams = streams;
+	return 0;
+}
+
+static void release_event_streams(struct event_streams *streams)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < streams->nrcpus; cpu++) {
+		free(streams->cpus[cpu].events);
+		free(streams->cpus[cpu].changes);
+	}
+
+	free(streams->cpus);
+	free(streams);
+}
+
+/**
+ * queue_trace_event - queue an event for the analysis of @cpu
+ * @streams: the per-cpu queues
+ * @cpu: cpu the event is accounted to
+ * @ev: the event, whose name is interned
+ *
+ * @return: 0 on success, -1 on error
+ */
+int queue_trace_event(struct event_streams *streams, int cpu,
+		      struct trace_event *ev)
+{
+	struct cpu_stream *s = &streams->cpus[cpu];
+	struct cpu_event *e;
+	const char *name = NULL;
+
+	if (ev->type == TRACE_EVENT_IRQ_HANDLER_ENTRY ||
+	    ev->type == TRACE_EVENT_IPI_ENTRY) {
+		name = intern_string(ev->name, ev->namelen);
+		if (!name)
+			return -1;
+	}
+
+	if (s->nr_events == s->max_events &&
+	    grow_stream((void **)&s->events, &s->max_events, sizeof(*e)))
+		return -1;
+
+	e = &s->events[s->nr_events++];
+	e->seq = streams->seq++;
+	e->time = ev->time;
+	e->type = ev->type;
+	e->cpu = ev->cpu;
+	e->value = ev->value;
+	e->name = name;
+
+	return 0;
+}
+
+static struct group_change *new_group_change(struct event_streams *streams,
+					     int cpu, uint64_t time, int type)
+{
+	struct cpu_stream *s = &streams->cpus[cpu];
+	struct group_change *c;
+
+	if (s->nr_changes == s->max_changes &&
+	    grow_stream((void **)&s->changes, &s->max_changes, sizeof(*c)))
+		return NULL;
+
+	c = &s->changes[s->nr_changes++];
+	memset(c, 0, sizeof(*c));
+	c->seq = s->seq;
+	c->time = time;
+	c->type = type;
+	c->cpu = cpu;
+
+	return c;
+}
+
+/**
+ * defer_group_cstates - log a call to update_group_cstates()
+ *
+ * @return: 0 on success, -1 on error
+ */
+int defer_group_cstates(struct event_streams *streams, int cpu,
+			uint64_t time, int old_cstate, int new_cstate,
+			int record)
+{
+	struct group_change *c;
+
+	c = new_group_change(streams, cpu, time, GROUP_CSTATE);
+	if (!c)
+		return -1;
+
+	c->old_cstate = old_cstate;
+	c->new_cstate = new_cstate;
+	c->record = record;
+	return 0;
+}
+
+/**
+ * defer_group_pstates - log a call to update_group_pstates()
+ *
+ * @return: 0 on success, -1 on error
+ */
+int defer_group_pstates(struct event_streams *streams, int cpu,
+			uint64_t time, unsigned int core_freq,
+			unsigned int cluster_freq, int composite)
+{
+	struct group_change *c;
+
+	c = new_group_change(streams, cpu, time, GROUP_PSTATE);
+	if (!c)
+		return -1;
+
+	c->core_freq = core_freq;
+	c->cluster_freq = cluster_freq;
+	c->record = composite;
+	return 0;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct job_pool *pool = arg;
+	int index;
+
+	while ((index = __sync_fetch_and_add(&pool->next, 1)) < pool->count)
+		pool->work(pool->arg, index);
+
+	return NULL;
+}
+
+/**
+ * run_analysis_jobs - call @work for each index below @count
+ * @count: number of jobs
+ * @work: job function, called with @arg and the job index
+ * @arg: job argument
+ *
+ * The jobs are spread over up to get_analysis_jobs() threads. The
+ * calling thread takes part, so the work gets done even if no thread
+ * can be created. Returns once all the jobs are done.
+ */
+void run_analysis_jobs(int count, void (*work)(void *arg, int index),
+		       void *arg)
+{
+	struct job_pool pool = {
+		.work = work,
+		.arg = arg,
+		.count = count,
+	};
+	pthread_t *threads;
+	int nrthreads, i;
+
+	nrthreads = MIN(analysis_jobs, count) - 1;
+	threads = nrthreads > 0 ? calloc(nrthreads, sizeof(*threads)) : NULL;
+	if (!threads)
+		nrthreads = 0;
+
+	for (i = 0; i < nrthreads; i++)
+		if (pthread_create(&threads[i], NULL, pool_worker, &pool))
+			break;
+	nrthreads = i;
+
+	pool_worker(&pool);
+
+	for (i = 0; i < nrthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+}
+
+/* Phase 1: per-cpu statistics, in the order the events were read */
+static void analyze_cpu(void *arg, int cpu)
+{
+	struct cpuidle_datas *datas = arg;
+	struct cpu_stream *s = &datas->streams->cpus[cpu];
+	struct cpu_event *e;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < s->nr_events; i++) {
+		e = &s->events[i];
+		s->seq = e->seq;
+
+		ret = account_trace_gap(datas, e->cpu, cpu, e->type, e->time);
+		if (ret > 0)
+			continue;
+		if (ret < 0) {
+			s->failed++;
+			continue;
+		}
+
+		switch (e->type) {
+		case TRACE_EVENT_CPU_IDLE:
+			ret = store_data(e->time, e->value, cpu, datas);
+			break;
+		case TRACE_EVENT_CPU_FREQUENCY:
+			ret = cpu_change_pstate(datas, cpu, e->value, e->time);
+			break;
+		case TRACE_EVENT_IRQ_HANDLER_ENTRY:
+			store_wakeup_irq(cpu, e->value, e->name, datas);
+			ret = 0;
+			break;
+		case TRACE_EVENT_IPI_ENTRY:
+			store_wakeup_irq(cpu, -1, e->name, datas);
+			ret = 0;
+			break;
+		default:
+			ret = -1;
+		}
+
+		if (ret == -1)
+			s->failed++;
+	}
+
+	free(s->events);
+	s->events = NULL;
+	s->nr_events = s->max_events = 0;
+}
+
+struct change_cursor {
+	struct group_change *change;
+	struct group_change *end;
+};
+
+static void cursor_sift_down(struct change_cursor *heap, int nr, int i)
+{
+	struct change_cursor tmp;
+	int child;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= nr)
+			return;
+		if (child + 1 < nr &&
+		    heap[child + 1].change->seq < heap[child].change->seq)
+			child++;
+		if (heap[i].change->seq <= heap[child].change->seq)
+			return;
+
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+/*
+ * Phase 2: replay the changes the cpus of a cluster made to their cores
+ * and to the cluster, merged back in the order of the trace.
+ */
+static void analyze_cluster(void *arg, int index)
+{
+	struct cluster_jobs *jobs = arg;
+	struct cpuidle_datas *datas = jobs->datas;
+	struct event_streams *streams = datas->streams;
+	struct cpu_physical *clust = jobs->clusters[index];
+	struct change_cursor *heap;
+	struct group_change *c;
+	struct cpu_cpu *cpu;
+	int nr = 0, i, ret;
+
+	heap = calloc(streams->nrcpus, sizeof(*heap));
+	if (!heap) {
+		jobs->failed[index]++;
+		return;
+	}
+
+	cluster_for_each_cpu(cpu, clust) {
+		struct cpu_stream *s;
+
+		if (cpu->cpu_id >= streams->nrcpus)
+			continue;
+
+		s = &streams->cpus[cpu->cpu_id];
+		if (!s->nr_changes)
+			continue;
+
+		heap[nr].change = s->changes;
+		heap[nr].end = s->changes + s->nr_changes;
+		nr++;
+	}
+
+	for (i = nr / 2 - 1; i >= 0; i--)
+		cursor_sift_down(heap, nr, i);
+
+	while (nr) {
+		c = heap[0].change++;
+
+		if (c->type == GROUP_CSTATE)
+			ret = update_group_cstates(datas, c->cpu, c->time,
+						   c->old_cstate,
+						   c->new_cstate, c->record);
+		else
+			ret = update_group_pstates(datas, c->cpu, c->time,
+						   c->core_freq,
+						   c->cluster_freq, c->record);
+		if (ret == -1)
+			jobs->failed[index]++;
+
+		if (heap[0].change == heap[0].end)
+			heap[0] = heap[--nr];
+		cursor_sift_down(heap, nr, 0);
+	}
+
+	free(heap);
+}
+
+/**
+ * analyze_event_streams - analyze the events queued by store_trace_event()
+ * @datas: per-trace statistics
+ * @failed: set to the number of events which could not be accounted
+ *
+ * The result is the same as if the events had been analyzed one at a
+ * time as they were read. Does nothing if parallel analysis is off.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int analyze_event_streams(struct cpuidle_datas *datas, size_t *failed)
+{
+	struct cluster_jobs jobs;
+	struct cpu_physical *clust;
+	int cpu, i, nrclusters = 0, ret = 0;
+
+	*failed = 0;
+	if (!datas->streams)
+		return 0;
+
+	run_analysis_jobs(datas->nrcpus, analyze_cpu, datas);
+
+	for (cpu = 0; cpu < datas->nrcpus; cpu++)
+		*failed += datas->streams->cpus[cpu].failed;
+
+	topo_for_each_cluster(clust, datas->topo)
+		nrclusters++;
+
+	jobs.datas = datas;
+	jobs.clusters = calloc(nrclusters, sizeof(*jobs.clusters));
+	jobs.failed = calloc(nrclusters, sizeof(*jobs.failed));
+	if (nrclusters && (!jobs.clusters || !jobs.failed)) {
+		ret = error(__func__);
+		goto out;
+	}
+
+	i = 0;
+	topo_for_each_cluster(clust, datas->topo)
+		jobs.clusters[i++] = clust;
+
+	run_analysis_jobs(nrclusters, analyze_cluster, &jobs);
+
+	for (i = 0; i < nrclusters; i++)
+		*failed += jobs.failed[i];
+
+out:
+	free(jobs.clusters);
+	free(jobs.failed);
+	release_event_streams(datas->streams);
+	datas->streams = NULL;
+	return ret;
+}
@@ -0,0 +1,55 @@
+/*
+ *  analysis.h
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef __ANALYSIS_H
+#define __ANALYSIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct cpuidle_datas;
+struct trace_event;
+
+/*
+ * Parallel analysis (--jobs). The events are first queued per cpu as
+ * they are read. Each cpu is then analyzed on its own by a pool of
+ * threads, which log the changes the cpu makes to its core and cluster
+ * instead of applying them. Last, the logs of the cpus of each cluster
+ * are merged back in trace order and replayed, one thread per cluster.
+ */
+struct event_streams;
+
+extern void set_analysis_jobs(int jobs);
+extern int get_analysis_jobs(void);
+extern void run_analysis_jobs(int count, void (*work)(void *arg, int index),
+			      void *arg);
+extern int setup_event_streams(struct cpuidle_datas *datas);
+extern int queue_trace_event(struct event_streams *streams, int cpu,
+			     struct trace_event *ev);
+extern int defer_group_cstates(struct event_streams *streams, int cpu,
+			       uint64_t time, int old_cstate, int new_cstate,
+			       int record);
+extern int defer_group_pstates(struct event_streams *streams, int cpu,
+			       uint64_t time, unsigned int core_freq,
+			       unsigned int cluster_freq, int composite);
+extern int analyze_event_streams(struct cpuidle_datas *datas, size_t *failed);
+
+#endif
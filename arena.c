@@ -0,0 +1,106 @@
+/*
+ *  arena.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "utils.h"
+
+#define ARENA_MIN_CHUNK (4 << 10)
+#define ARENA_MAX_CHUNK (4 << 20)
+#define ARENA_ALIGN sizeof(uint64_t)
+
+struct arena_chunk {
+	struct arena_chunk *prev;
+	size_t size;
+	size_t used;
+	uint64_t mem[];
+};
+
+static struct arena_chunk *arena_new_chunk(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+	size_t chunk_size = arena->next_size;
+
+	if (chunk_size < ARENA_MIN_CHUNK)
+		chunk_size = ARENA_MIN_CHUNK;
+	while (chunk_size < size)
+		chunk_size *= 2;
+
+	chunk = malloc(sizeof(*chunk) + chunk_size);
+	if (!chunk)
+		return ptrerror(__func__);
+
+	chunk->prev = arena->chunk;
+	chunk->size = chunk_size;
+	chunk->used = 0;
+
+	arena->chunk = chunk;
+	arena->next_size = chunk_size < ARENA_MAX_CHUNK ?
+		chunk_size * 2 : ARENA_MAX_CHUNK;
+
+	return chunk;
+}
+
+/**
+ * arena_alloc - allocate @size bytes from @arena
+ *
+ * The memory is not initialized and stays valid until arena_release().
+ *
+ * @return: pointer to the memory (success) or ptrerror() (error)
+ */
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunk;
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk = arena_new_chunk(arena, size);
+		if (is_err(chunk))
+			return chunk;
+	}
+
+	ptr = (char *)chunk->mem + chunk->used;
+	chunk->used += size;
+
+	return ptr;
+}
+
+/**
+ * arena_release - free all memory allocated from @arena
+ *
+ * The arena is left empty and may be used again.
+ */
+void arena_release(struct arena *arena)
+{
+	struct arena_chunk *chunk, *prev;
+
+	for (chunk = arena->chunk; chunk; chunk = prev) {
+		prev = chunk->prev;
+		free(chunk);
+	}
+
+	arena->chunk = NULL;
+	arena->next_size = 0;
+}
@@ -0,0 +1,43 @@
+/*
+ *  arena.h
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+/*
+ * Bump allocator for records which are only ever freed all at once.
+ * Memory is carved out of chunks whose size doubles each time one runs
+ * out, so the number of allocations is logarithmic in the number of
+ * records and records allocated in a row are adjacent in memory.
+ */
+struct arena {
+	struct arena_chunk *chunk;	/* chunk being filled */
+	size_t next_size;		/* size of the next chunk */
+};
+
+extern void *arena_alloc(struct arena *arena, size_t size);
+extern void arena_release(struct arena *arena);
+
+#endif
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# bench_import.sh
+#
+# Copyright (C) 2026, Linaro Limited.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# Wall clock time of the import of a text trace by the serial loader and
+# by the reader/parser/analyzer pipeline (--jobs), the trace being fed
+# through a pipe. With a rate, the pipe is throttled to that many MB per
+# second to mimic slow storage. The mapped file is timed for reference.
+#
+# Usage: bench_import.sh <trace> [jobs] [MB/s]
+#
+
+IDLESTAT=${IDLESTAT:-./idlestat}
+TRACE=$1
+JOBS=${2:-4}
+RATE=$3
+
+if [ -z "$TRACE" ] || [ ! -f "$TRACE" ]; then
+	echo "usage: $0 <trace> [jobs] [MB/s]" >&2
+	exit 1
+fi
+
+now() {
+	date +%s.%N
+}
+
+# Feed the trace 1 MB at a time, at $RATE MB/s
+slow_cat() {
+	blocks=$(( ($(wc -c < "$1") + 1048575) / 1048576 ))
+	delay=$(awk "BEGIN { print 1 / $RATE }")
+	i=0
+	while [ $i -lt $blocks ]; do
+		dd if="$1" bs=1M skip=$i count=1 status=none
+		sleep "$delay"
+		i=$((i + 1))
+	done
+}
+
+# run <label> <jobs> <input: map|pipe|slow>
+run() {
+	start=$(now)
+	case $3 in
+	map)
+		$IDLESTAT --import -f "$TRACE" -j $2 -o /dev/null \
+			> /dev/null 2>&1
+		;;
+	pipe)
+		cat "$TRACE" | $IDLESTAT --import -f /dev/stdin -j $2 \
+			-o /dev/null > /dev/null 2>&1
+		;;
+	slow)
+		slow_cat "$TRACE" | $IDLESTAT --import -f /dev/stdin -j $2 \
+			-o /dev/null > /dev/null 2>&1
+		;;
+	esac
+	status=$?
+	end=$(now)
+
+	if [ $status -ne 0 ]; then
+		echo "$1: idlestat failed" >&2
+		exit 1
+	fi
+	awk "BEGIN { printf \"%-32s %8.3f s\\n\", \"$1\", $end - $start }"
+}
+
+run "mapped, serial" 1 map
+run "mapped, --jobs $JOBS" $JOBS map
+run "pipe, serial" 1 pipe
+run "pipe, pipeline --jobs $JOBS" $JOBS pipe
+if [ -n "$RATE" ]; then
+	run "pipe at $RATE MB/s, serial" 1 slow
+	run "pipe at $RATE MB/s, pipeline" $JOBS slow
+fi
@@ -23,7 +23,6 @@
  *     Tuukka Tikkanen <tuukka.tikkanen@linaro.org>
  *
  */
-#include <float.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -100,6 +99,7 @@ static void compare_cstate_single_state(struct cpuidle_cstate *c,
 {
 	struct cpuidle_cstate empty;
 	struct cpuidle_cstate diff;
+	double min_delta, max_delta, avg_delta, duration_delta;
 	struct cpuidle_cstate *b;
 	struct compare_report_data *rdata;
 
@@ -133,34 +133,34 @@ static void compare_cstate_single_state(struct cpuidle_cstate *c,
 		b = &empty;
 	}
 
-	diff.min_time = c->min_time - b->min_time;
-	diff.max_time = c->max_time - b->max_time;
-	diff.avg_time = c->avg_time - b->avg_time;
-	diff.duration = c->duration - b->duration;
+	min_delta = MIN_TIME_USEC(c->min_time) - MIN_TIME_USEC(b->min_time);
+	max_delta = NSEC_TO_USEC(c->max_time) - NSEC_TO_USEC(b->max_time);
+	avg_delta = AVG_TIME_USEC(c->duration, c->nrdata) -
+		AVG_TIME_USEC(b->duration, b->nrdata);
+	duration_delta = NSEC_TO_USEC(c->duration) - NSEC_TO_USEC(b->duration);
 	diff.nrdata = c->nrdata - b->nrdata;
 	diff.early_wakings = c->early_wakings - b->early_wakings;
 	diff.late_wakings = c->late_wakings - b->late_wakings;
 
 	printf("| %8s | ", c->name);
-	display_factored_time(c->min_time == DBL_MAX ? 0. :
-				      c->min_time, 8);
+	display_factored_time(MIN_TIME_USEC(c->min_time), 8);
 	printf(" | ");
-	display_factored_time(c->max_time, 8);
+	display_factored_time(NSEC_TO_USEC(c->max_time), 8);
 	printf(" | ");
-	display_factored_time(c->avg_time, 8);
+	display_factored_time(AVG_TIME_USEC(c->duration, c->nrdata), 8);
 	printf(" | ");
-	display_factored_time(c->duration, 8);
+	display_factored_time(NSEC_TO_USEC(c->duration), 8);
 	printf(" | ");
 	printf("%5d | %5d | %5d |\n", c->nrdata, c->early_wakings, c->late_wakings);
 	/* Delta */
 	printf("|          | ");
-	display_factored_time_delta(diff.min_time, 8);
+	display_factored_time_delta(min_delta, 8);
 	printf(" | ");
-	display_factored_time_delta(diff.max_time, 8);
+	display_factored_time_delta(max_delta, 8);
 	printf(" | ");
-	display_factored_time_delta(diff.avg_time, 8);
+	display_factored_time_delta(avg_delta, 8);
 	printf(" | ");
-	display_factored_time_delta(diff.duration, 8);
+	display_factored_time_delta(duration_delta, 8);
 	printf(" |");
 	display_int_delta(diff.nrdata, 5);
 	display_int_delta(diff.early_wakings, 5);
@@ -198,6 +198,7 @@ static void compare_pstate_single_freq(struct cpufreq_pstate *p,
 {
 	struct cpufreq_pstate empty;
 	struct cpufreq_pstate diff;
+	double min_delta, max_delta, avg_delta, duration_delta;
 	struct cpufreq_pstate *b;
 	struct compare_report_data *rdata;
 
@@ -231,32 +232,33 @@ static void compare_pstate_single_freq(struct cpufreq_pstate *p,
 		b = &empty;
 	}
 
-	diff.min_time = p->min_time - b->min_time;
-	diff.max_time = p->max_time - b->max_time;
-	diff.avg_time = p->avg_time - b->avg_time;
-	diff.duration = p->duration - b->duration;
+	min_delta = MIN_TIME_USEC(p->min_time) - MIN_TIME_USEC(b->min_time);
+	max_delta = NSEC_TO_USEC(p->max_time) - NSEC_TO_USEC(b->max_time);
+	avg_delta = AVG_TIME_USEC(p->duration, p->count) -
+		AVG_TIME_USEC(b->duration, b->count);
+	duration_delta = NSEC_TO_USEC(p->duration) - NSEC_TO_USEC(b->duration);
 	diff.count = p->count - b->count;
 
 	printf("| ");
 	display_factored_freq(p->freq, 8);
 	printf(" | ");
-	display_factored_time(p->min_time == DBL_MAX ? 0. : p->min_time, 8);
+	display_factored_time(MIN_TIME_USEC(p->min_time), 8);
 	printf(" | ");
-	display_factored_time(p->max_time, 8);
+	display_factored_time(NSEC_TO_USEC(p->max_time), 8);
 	printf(" | ");
-	display_factored_time(p->avg_time, 8);
+	display_factored_time(AVG_TIME_USEC(p->duration, p->count), 8);
 	printf(" | ");
-	display_factored_time(p->duration, 8);
+	display_factored_time(NSEC_TO_USEC(p->duration), 8);
 	printf(" | %5d |\n", p->count);
 
 	printf("|          | ");
-	display_factored_time_delta(diff.min_time, 8);
+	display_factored_time_delta(min_delta, 8);
 	printf(" | ");
-	display_factored_time_delta(diff.max_time, 8);
+	display_factored_time_delta(max_delta, 8);
 	printf(" | ");
-	display_factored_time_delta(diff.avg_time, 8);
+	display_factored_time_delta(avg_delta, 8);
 	printf(" | ");
-	display_factored_time_delta(diff.duration, 8);
+	display_factored_time_delta(duration_delta, 8);
 	printf(" |");
 	display_int_delta(diff.count, 5);
 	printf("\n");
@@ -0,0 +1,801 @@
+/*
+ *  counters.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * Counters-only mode: instead of tracing, the statistics the kernel
+ * keeps anyway are read before and after the run and the differences
+ * are reported: the cpuidle and cpufreq statistics of sysfs and the
+ * interrupt counts of /proc/interrupts. Only a few files are read, so
+ * the system is not disturbed, but the minimum and maximum times are
+ * unknown and every interrupt counts as a wakeup.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "counters.h"
+#include "idlestat.h"
+#include "intern.h"
+#include "topology.h"
+#include "trace_raw.h"
+#include "utils.h"
+
+#define CPUIDLE_STATE_PATH_FORMAT \
+	"/sys/devices/system/cpu/cpu%d/cpuidle/state%d"
+#define CPUFREQ_PATH_FORMAT \
+	"/sys/devices/system/cpu/cpu%d/cpufreq"
+#define PROC_INTERRUPTS "/proc/interrupts"
+
+struct counters_cstates {
+	uint64_t usage[MAXCSTATE];
+	uint64_t time[MAXCSTATE];	/* in us */
+	uint64_t above[MAXCSTATE];	/* too deep for the idle time */
+	uint64_t below[MAXCSTATE];	/* too shallow for the idle time */
+};
+
+struct counters_freq {
+	unsigned int freq;
+	uint64_t time;		/* in USER_HZ ticks */
+	uint64_t entries;	/* transitions to freq, from trans_table */
+};
+
+struct counters_freqs {
+	struct counters_freq *freqs;
+	int nrfreqs;
+	int has_entries;
+	uint64_t total_trans;
+};
+
+/* The cpufreq statistics are kept per policy, shared by its cpus */
+struct counters_policy {
+	char *dir;
+	struct counters_freqs before;
+	struct counters_freqs after;
+};
+
+struct counters_cpu {
+	struct counters_cstates before;
+	struct counters_cstates after;
+	int policy;		/* -1 without cpufreq */
+};
+
+/* A row of /proc/interrupts */
+struct counters_irq {
+	const char *label;	/* interned, "24" or "LOC" */
+	int id;			/* -1 for the architecture specific rows */
+	const char *name;	/* interned */
+	int sampled;
+	uint32_t *last;		/* per cpu, at the last sample */
+	uint64_t *total;	/* per cpu, since the first sample */
+};
+
+struct counters {
+	int nrcpus;
+	struct counters_cpu *cpus;
+	struct counters_policy *policies;
+	int nrpolicies;
+
+	struct counters_irq *irqs;
+	int nrirqs;
+	int *columns;		/* cpu of each column */
+	uint32_t *counts;	/* of each column, in the current row */
+	int maxcolumns;
+	char *buf;		/* content of /proc/interrupts */
+	size_t bufsize;
+	int nrsamples;
+
+	int interval;		/* ms between samples, -1 for none */
+	int stop[2];		/* closing stop[1] ends the sampling */
+	pthread_t thread;
+	int started;
+	int error;
+};
+
+static void read_cstate_counters(int cpu, struct counters_cstates *cc)
+{
+	char path[BUFSIZE];
+	int state;
+
+	for (state = 0; state < MAXCSTATE; state++) {
+		snprintf(path, sizeof(path), CPUIDLE_STATE_PATH_FORMAT, cpu,
+			 state);
+		if (file_read_value(path, "usage", "%" SCNu64,
+				    &cc->usage[state]))
+			break;
+		file_read_value(path, "time", "%" SCNu64, &cc->time[state]);
+
+		/* Not provided by older kernels */
+		file_read_value(path, "above", "%" SCNu64, &cc->above[state]);
+		file_read_value(path, "below", "%" SCNu64, &cc->below[state]);
+	}
+}
+
+static struct counters_freq *find_freq(struct counters_freqs *cf,
+				       unsigned int freq)
+{
+	int i;
+
+	for (i = 0; i < cf->nrfreqs; i++)
+		if (cf->freqs[i].freq == freq)
+			return &cf->freqs[i];
+
+	return NULL;
+}
+
+static int read_time_in_state(const char *dir, struct counters_freqs *cf)
+{
+	struct counters_freq *tmp;
+	unsigned int freq;
+	uint64_t time;
+	char *path;
+	FILE *f;
+
+	if (asprintf(&path, "%s/stats/time_in_state", dir) < 0)
+		return error(__func__);
+	f = fopen(path, "r");
+	free(path);
+	if (!f)
+		return 0;
+
+	while (fscanf(f, "%u %" SCNu64, &freq, &time) == 2) {
+		tmp = realloc(cf->freqs, (cf->nrfreqs + 1) * sizeof(*tmp));
+		if (!tmp) {
+			fclose(f);
+			return error(__func__);
+		}
+		cf->freqs = tmp;
+		tmp = &cf->freqs[cf->nrfreqs++];
+		tmp->freq = freq;
+		tmp->time = time;
+		tmp->entries = 0;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+/*
+ * trans_table is a from/to matrix of the transition counts:
+ *
+ *    From  :    To
+ *          :   1000000    800000
+ *   1000000:         0        12
+ *    800000:        11         0
+ *
+ * The number of times a frequency was entered is the sum of its column.
+ * The file is empty or truncated when the table does not fit in a page,
+ * the counts are then left unknown.
+ */
+static void read_trans_table(const char *dir, struct counters_freqs *cf)
+{
+	char line[BUFSIZE * 16], *p, *end;
+	unsigned int to[MAXPSTATE * 4];
+	struct counters_freq *freq;
+	uint64_t count;
+	int nrto = 0, i, rows = 0;
+	char *path;
+	FILE *f;
+
+	if (asprintf(&path, "%s/stats/trans_table", dir) < 0)
+		return;
+	f = fopen(path, "r");
+	free(path);
+	if (!f)
+		return;
+
+	/* Skip the "From : To" line, then read the destination column */
+	if (!fgets(line, sizeof(line), f) || !fgets(line, sizeof(line), f))
+		goto out;
+	p = strchr(line, ':');
+	if (!p)
+		goto out;
+	for (p++; nrto < (int)(sizeof(to) / sizeof(to[0])); p = end) {
+		to[nrto] = strtoul(p, &end, 10);
+		if (end == p)
+			break;
+		nrto++;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		p = strchr(line, ':');
+		if (!p)
+			goto out;
+		for (p++, i = 0; i < nrto; i++, p = end) {
+			count = strtoull(p, &end, 10);
+			if (end == p)
+				goto out;
+			freq = find_freq(cf, to[i]);
+			if (freq)
+				freq->entries += count;
+		}
+		rows++;
+	}
+
+	cf->has_entries = rows == nrto && nrto > 0;
+out:
+	fclose(f);
+}
+
+static int read_pstate_counters(const char *dir, struct counters_freqs *cf)
+{
+	char path[PATH_MAX];
+
+	if (read_time_in_state(dir, cf))
+		return -1;
+	read_trans_table(dir, cf);
+	snprintf(path, sizeof(path), "%s/stats", dir);
+	file_read_value(path, "total_trans", "%" SCNu64, &cf->total_trans);
+
+	return 0;
+}
+
+/*
+ * cpuN/cpufreq links to the directory of the policy of cpuN, policyM
+ * or, on older kernels, the cpufreq directory of the first cpu of the
+ * policy. Either way, the cpus of a policy resolve to the same path.
+ */
+static int find_policies(struct counters *c)
+{
+	struct counters_policy *tmp;
+	char path[BUFSIZE], *dir;
+	int cpu, i;
+
+	for (cpu = 0; cpu < c->nrcpus; cpu++) {
+		c->cpus[cpu].policy = -1;
+
+		snprintf(path, sizeof(path), CPUFREQ_PATH_FORMAT, cpu);
+		dir = realpath(path, NULL);
+		if (!dir)
+			continue;
+
+		for (i = 0; i < c->nrpolicies; i++)
+			if (!strcmp(c->policies[i].dir, dir))
+				break;
+
+		if (i < c->nrpolicies) {
+			free(dir);
+		} else {
+			tmp = realloc(c->policies, (i + 1) * sizeof(*tmp));
+			if (!tmp) {
+				free(dir);
+				return error(__func__);
+			}
+			c->policies = tmp;
+			memset(&tmp[i], 0, sizeof(tmp[i]));
+			tmp[i].dir = dir;
+			c->nrpolicies++;
+		}
+		c->cpus[cpu].policy = i;
+	}
+
+	return 0;
+}
+
+/* Read all of @path at once, the kernel generates it on each read */
+static ssize_t read_file(const char *path, char **buf, size_t *size)
+{
+	size_t len = 0;
+	ssize_t ret;
+	char *tmp;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open '%s': %m\n", path);
+		return -1;
+	}
+
+	for (;;) {
+		if (len + 1 >= *size) {
+			tmp = realloc(*buf, *size ? *size * 2 : 16 << 10);
+			if (!tmp) {
+				close(fd);
+				return error(__func__);
+			}
+			*buf = tmp;
+			*size = *size ? *size * 2 : 16 << 10;
+		}
+
+		ret = read(fd, *buf + len, *size - len - 1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+
+	close(fd);
+	if (ret < 0) {
+		fprintf(stderr, "failed to read '%s': %m\n", path);
+		return -1;
+	}
+
+	(*buf)[len] = '\0';
+	return len;
+}
+
+static inline const char *skip_blanks(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+static inline const char *skip_token(const char *p, const char *end)
+{
+	while (p < end && *p != ' ' && *p != '\t')
+		p++;
+	return p;
+}
+
+/* "CPU0 CPU1 CPU4 ...": offline cpus have no column */
+static int parse_interrupts_header(struct counters *c, const char *p,
+				   const char *end)
+{
+	int nrcolumns = 0, cpu;
+	uint32_t *counts;
+	int *columns;
+
+	for (p = skip_blanks(p, end); p < end; p = skip_blanks(p, end)) {
+		if (end - p < 4 || memcmp(p, "CPU", 3)) {
+			fprintf(stderr, "%s: unexpected format\n",
+				PROC_INTERRUPTS);
+			return -1;
+		}
+		for (p += 3, cpu = 0; p < end && *p >= '0' && *p <= '9'; p++)
+			cpu = cpu * 10 + (*p - '0');
+
+		if (nrcolumns == c->maxcolumns) {
+			columns = realloc(c->columns, (nrcolumns + 64) *
+					  sizeof(*columns));
+			if (columns)
+				c->columns = columns;
+			counts = realloc(c->counts, (nrcolumns + 64) *
+					 sizeof(*counts));
+			if (counts)
+				c->counts = counts;
+			if (!columns || !counts)
+				return error(__func__);
+			c->maxcolumns += 64;
+		}
+		c->columns[nrcolumns++] = cpu;
+	}
+
+	return nrcolumns;
+}
+
+static struct counters_irq *find_irq(struct counters *c, int hint,
+				     const char *label, size_t len)
+{
+	struct counters_irq *irq;
+	int i;
+
+	/* The rows come in the same order on every read */
+	if (hint < c->nrirqs && !strncmp(c->irqs[hint].label, label, len) &&
+	    !c->irqs[hint].label[len])
+		return &c->irqs[hint];
+
+	for (i = 0; i < c->nrirqs; i++) {
+		irq = &c->irqs[i];
+		if (!strncmp(irq->label, label, len) && !irq->label[len])
+			return irq;
+	}
+
+	return NULL;
+}
+
+/*
+ * The name of an irq is the last of its handlers. The architecture
+ * specific rows, reported as IPIs as in the traces, are named after
+ * their description, if any.
+ */
+static struct counters_irq *add_irq(struct counters *c, const char *label,
+				    size_t len, const char *rest,
+				    const char *end)
+{
+	struct counters_irq *tmp, *irq;
+	const char *name;
+
+	while (end > rest && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	if (label[0] >= '0' && label[0] <= '9') {
+		for (name = end; name > rest && name[-1] != ' ' &&
+			     name[-1] != '\t'; name--)
+			;
+	} else {
+		name = rest;
+	}
+	if (name == end) {
+		name = label;
+		end = label + len;
+	}
+
+	tmp = realloc(c->irqs, (c->nrirqs + 1) * sizeof(*tmp));
+	if (!tmp)
+		return ptrerror(__func__);
+	c->irqs = tmp;
+
+	irq = &c->irqs[c->nrirqs];
+	memset(irq, 0, sizeof(*irq));
+	irq->label = intern_string(label, len);
+	irq->name = intern_string(name, end - name);
+	irq->id = label[0] >= '0' && label[0] <= '9' ? atoi(label) : -1;
+	irq->last = calloc(c->nrcpus, sizeof(*irq->last));
+	irq->total = calloc(c->nrcpus, sizeof(*irq->total));
+	if (!irq->label || !irq->name || !irq->last || !irq->total) {
+		free(irq->last);
+		free(irq->total);
+		return ptrerror(__func__);
+	}
+	c->nrirqs++;
+
+	return irq;
+}
+
+/*
+ * The counts are 32 bits and may wrap during a long run: the difference
+ * between two samples is right as long as fewer than 2^32 interrupts
+ * occur in between.
+ */
+static int sample_interrupts(struct counters *c)
+{
+	uint32_t *counts;
+	const char *p, *end, *eol, *label;
+	struct counters_irq *irq;
+	int nrcolumns, col, row, cpu;
+	size_t labellen;
+	ssize_t len;
+	uint32_t v;
+
+	len = read_file(PROC_INTERRUPTS, &c->buf, &c->bufsize);
+	if (len < 0)
+		return -1;
+	p = c->buf;
+	end = p + len;
+
+	eol = memchr(p, '\n', end - p);
+	if (!eol)
+		return 0;
+	nrcolumns = parse_interrupts_header(c, p, eol);
+	if (nrcolumns < 0)
+		return -1;
+	counts = c->counts;
+
+	for (row = 0, p = eol + 1; p < end; p = eol + 1, row++) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+
+		p = skip_blanks(p, eol);
+		label = p;
+		while (p < eol && *p != ':')
+			p++;
+		if (p == eol || p == label)
+			continue;
+		labellen = p++ - label;
+
+		for (col = 0; col < nrcolumns; col++) {
+			p = skip_blanks(p, eol);
+			if (p == eol || *p < '0' || *p > '9')
+				break;
+			for (v = 0; p < eol && *p >= '0' && *p <= '9'; p++)
+				v = v * 10 + (*p - '0');
+			counts[col] = v;
+		}
+
+		/* Global counts such as ERR: and MIS: */
+		if (col < nrcolumns)
+			continue;
+
+		irq = find_irq(c, row, label, labellen);
+		if (!irq) {
+			irq = add_irq(c, label, labellen, skip_blanks(p, eol),
+				      eol);
+			if (is_err(irq))
+				return -1;
+		}
+
+		for (col = 0; col < nrcolumns; col++) {
+			cpu = c->columns[col];
+			if (cpu >= c->nrcpus)
+				continue;
+			/* Rows appearing during the run count from zero */
+			if (irq->sampled || c->nrsamples)
+				irq->total[cpu] += (uint32_t)(counts[col] -
+							      irq->last[cpu]);
+			irq->last[cpu] = counts[col];
+		}
+		irq->sampled = 1;
+	}
+
+	c->nrsamples++;
+	return 0;
+}
+
+static void *sample_thread(void *arg)
+{
+	struct counters *c = arg;
+	struct pollfd fd = { .fd = c->stop[0], .events = POLLIN };
+
+	for (;;) {
+		if (poll(&fd, 1, c->interval) < 0 && errno != EINTR)
+			break;
+		if (fd.revents)
+			break;
+		if (sample_interrupts(c)) {
+			c->error = -1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int start_sampling(struct counters *c)
+{
+	if (pipe2(c->stop, O_CLOEXEC))
+		return error("pipe2");
+
+	if (start_pinned_thread(&c->thread, sample_thread, c))
+		return error("pthread_create");
+
+	c->started = 1;
+	return 0;
+}
+
+static int stop_sampling(struct counters *c)
+{
+	if (c->started) {
+		close(c->stop[1]);
+		c->stop[1] = -1;
+		pthread_join(c->thread, NULL);
+		c->started = 0;
+	}
+
+	return c->error;
+}
+
+static void release_freqs(struct counters_freqs *cf)
+{
+	free(cf->freqs);
+}
+
+static void release_counters(struct counters *c)
+{
+	int i;
+
+	stop_sampling(c);
+	if (c->stop[0] >= 0)
+		close(c->stop[0]);
+	if (c->stop[1] >= 0)
+		close(c->stop[1]);
+
+	for (i = 0; i < c->nrpolicies; i++) {
+		free(c->policies[i].dir);
+		release_freqs(&c->policies[i].before);
+		release_freqs(&c->policies[i].after);
+	}
+	free(c->policies);
+
+	for (i = 0; i < c->nrirqs; i++) {
+		free(c->irqs[i].last);
+		free(c->irqs[i].total);
+	}
+	free(c->irqs);
+
+	free(c->columns);
+	free(c->counts);
+	free(c->buf);
+	free(c->cpus);
+	free(c);
+}
+
+/**
+ * counters_start - snapshot the idle, frequency and interrupt counters
+ * @interval: seconds between two samples of the interrupt counts, or 0
+ *
+ * The interrupt counts are 32 bits: on busy systems, sampling them
+ * during the run keeps them from wrapping unnoticed.
+ *
+ * @return: the snapshot (success) or ptrerror() (error)
+ */
+struct counters *counters_start(unsigned int interval)
+{
+	struct counters *c;
+	int cpu, i;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return ptrerror(__func__);
+
+	c->stop[0] = c->stop[1] = -1;
+	c->interval = interval ? (int)interval * 1000 : -1;
+
+	c->nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (c->nrcpus <= 0) {
+		free(c);
+		return ptrerror("Cannot read counters (nrcpus == 0)");
+	}
+
+	c->cpus = calloc(c->nrcpus, sizeof(*c->cpus));
+	if (!c->cpus) {
+		error(__func__);
+		goto out_release;
+	}
+
+	if (find_policies(c))
+		goto out_release;
+
+	for (cpu = 0; cpu < c->nrcpus; cpu++)
+		read_cstate_counters(cpu, &c->cpus[cpu].before);
+	for (i = 0; i < c->nrpolicies; i++)
+		if (read_pstate_counters(c->policies[i].dir,
+					 &c->policies[i].before))
+			goto out_release;
+	if (sample_interrupts(c))
+		goto out_release;
+
+	if (interval && start_sampling(c))
+		goto out_release;
+
+	return c;
+
+out_release:
+	release_counters(c);
+	return ptrerror(NULL);
+}
+
+static void set_cstates(struct cpuidle_cstates *cstates,
+			struct counters_cstates *before,
+			struct counters_cstates *after)
+{
+	struct cpuidle_cstate *c;
+	int state;
+
+	for (state = 0; state < MAXCSTATE; state++) {
+		c = &cstates->cstate[state];
+		if (!c->name)
+			continue;
+
+		c->nrdata = after->usage[state] - before->usage[state];
+		c->duration = (after->time[state] - before->time[state]) *
+			NSEC_PER_USEC;
+		c->early_wakings = after->above[state] - before->above[state];
+		c->late_wakings = after->below[state] - before->below[state];
+		cstates->cstate_max = state;
+	}
+}
+
+static void set_pstates(struct cpufreq_pstates *pstates,
+			struct counters_freqs *before,
+			struct counters_freqs *after)
+{
+	struct counters_freq *freq, *prev;
+	struct cpufreq_pstate *p;
+	long ticks = sysconf(_SC_CLK_TCK);
+	uint64_t time;
+	int i;
+
+	for (i = 0; i < after->nrfreqs; i++) {
+		freq = &after->freqs[i];
+		prev = find_freq(before, freq->freq);
+		time = freq->time - (prev ? prev->time : 0);
+		if (!time)
+			continue;
+
+		p = &pstates->pstate[alloc_pstate(pstates, freq->freq)];
+		p->duration = time * NSEC_PER_SEC / ticks;
+
+		/* Without trans_table, only that the cpu ran at it */
+		if (before->has_entries && after->has_entries)
+			p->count = freq->entries - (prev ? prev->entries : 0);
+		if (!p->count)
+			p->count = 1;
+	}
+}
+
+static int set_wakeups(struct counters *c, struct cpuidle_datas *datas)
+{
+	struct counters_irq *irq;
+	int i, cpu;
+
+	for (i = 0; i < c->nrirqs; i++) {
+		irq = &c->irqs[i];
+		for (cpu = 0; cpu < c->nrcpus && cpu < datas->nrcpus; cpu++) {
+			if (!irq->total[cpu])
+				continue;
+			if (add_wakeup_irq(cpu, irq->id, irq->name,
+					   irq->total[cpu] > INT_MAX ?
+					   INT_MAX : (int)irq->total[cpu],
+					   0, 0, datas))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * counters_stop - snapshot the counters again and report the changes
+ * @c: snapshot from counters_start(), freed
+ *
+ * @return: per-cpu statistics (success) or ptrerror() (error)
+ */
+struct cpuidle_datas *counters_stop(struct counters *c)
+{
+	struct cpuidle_datas *datas;
+	struct counters_policy *policy;
+	int cpu, i;
+
+	if (stop_sampling(c) || sample_interrupts(c))
+		goto out_release;
+
+	for (cpu = 0; cpu < c->nrcpus; cpu++)
+		read_cstate_counters(cpu, &c->cpus[cpu].after);
+	for (i = 0; i < c->nrpolicies; i++)
+		if (read_pstate_counters(c->policies[i].dir,
+					 &c->policies[i].after))
+			goto out_release;
+
+	datas = raw_capture_datas();
+	if (is_err(datas))
+		goto out_release;
+
+	for (cpu = 0; cpu < datas->nrcpus && cpu < c->nrcpus; cpu++) {
+		if (!cpu_is_online(datas->topo, cpu))
+			continue;
+
+		set_cstates(&datas->cstates[cpu], &c->cpus[cpu].before,
+			    &c->cpus[cpu].after);
+		if (c->cpus[cpu].policy < 0)
+			continue;
+		policy = &c->policies[c->cpus[cpu].policy];
+		set_pstates(&datas->pstates[cpu], &policy->before,
+			    &policy->after);
+	}
+
+	for (i = 0; i < c->nrpolicies; i++)
+		verbose_printf(1, "%s: %" PRIu64 " frequency transitions\n",
+			       c->policies[i].dir,
+			       c->policies[i].after.total_trans -
+			       c->policies[i].before.total_trans);
+
+	if (set_wakeups(c, datas) || setup_topo_states(datas)) {
+		raw_release_datas(datas);
+		goto out_release;
+	}
+	copy_single_cpu_groups(datas->topo);
+
+	release_counters(c);
+	return datas;
+
+out_release:
+	release_counters(c);
+	return ptrerror(NULL);
+}
@@ -24,7 +24,6 @@
  *     Tuukka Tikkanen <tuukka.tikkanen@linaro.org>
  *
  */
-#include <float.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -74,8 +73,10 @@ static void csv_cstate_single_state(struct cpuidle_cstate *c,
 				    UNUSED void *report_data)
 {
 	printf(",,,%s,", c->name);
-	printf("%f,", c->min_time == DBL_MAX ? 0. : c->min_time);
-	printf("%f,%f,%f,", c->max_time, c->avg_time, c->duration);
+	printf("%f,", MIN_TIME_USEC(c->min_time));
+	printf("%f,%f,%f,", NSEC_TO_USEC(c->max_time),
+	       AVG_TIME_USEC(c->duration, c->nrdata),
+	       NSEC_TO_USEC(c->duration));
 	printf("%d,%d,%d", c->nrdata, c->early_wakings, c->late_wakings);
 
 	printf("\n");
@@ -100,8 +101,10 @@ static void csv_pstate_single_freq(struct cpufreq_pstate *p,
 				   UNUSED void *report_data)
 {
 	printf(",,,%u,", p->freq);
-	printf("%f,", p->min_time == DBL_MAX ? 0. : p->min_time);
-	printf("%f,%f,%f,", p->max_time, p->avg_time, p->duration);
+	printf("%f,", MIN_TIME_USEC(p->min_time));
+	printf("%f,%f,%f,", NSEC_TO_USEC(p->max_time),
+	       AVG_TIME_USEC(p->duration, p->count),
+	       NSEC_TO_USEC(p->duration));
 	printf("%d", p->count);
 
 	printf("\n");
@@ -23,7 +23,6 @@
  *     Tuukka Tikkanen <tuukka.tikkanen@linaro.org>
  *
  */
-#include <float.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -126,14 +125,13 @@ static void boxless_cstate_single_state(struct cpuidle_cstate *c,
 					UNUSED void *report_data)
 {
 	printf("  %8s   ", c->name);
-	display_factored_time(c->min_time == DBL_MAX ? 0. :
-				      c->min_time, 8);
+	display_factored_time(MIN_TIME_USEC(c->min_time), 8);
 	printf("   ");
-	display_factored_time(c->max_time, 8);
+	display_factored_time(NSEC_TO_USEC(c->max_time), 8);
 	printf("   ");
-	display_factored_time(c->avg_time, 8);
+	display_factored_time(AVG_TIME_USEC(c->duration, c->nrdata), 8);
 	printf("   ");
-	display_factored_time(c->duration, 8);
+	display_factored_time(NSEC_TO_USEC(c->duration), 8);
 	printf("   ");
 	printf("%5d   %5d   %5d\n", c->nrdata, c->early_wakings,
 	       c->late_wakings);
@@ -143,14 +141,13 @@ static void default_cstate_single_state(struct cpuidle_cstate *c,
 					UNUSED void *report_data)
 {
 	printf("| %8s | ", c->name);
-	display_factored_time(c->min_time == DBL_MAX ? 0. :
-				      c->min_time, 8);
+	display_factored_time(MIN_TIME_USEC(c->min_time), 8);
 	printf(" | ");
-	display_factored_time(c->max_time, 8);
+	display_factored_time(NSEC_TO_USEC(c->max_time), 8);
 	printf(" | ");
-	display_factored_time(c->avg_time, 8);
+	display_factored_time(AVG_TIME_USEC(c->duration, c->nrdata), 8);
 	printf(" | ");
-	display_factored_time(c->duration, 8);
+	display_factored_time(NSEC_TO_USEC(c->duration), 8);
 	printf(" | ");
 	printf("%5d | %5d | %5d |\n", c->nrdata, c->early_wakings,
 	       c->late_wakings);
@@ -197,13 +194,13 @@ static void boxless_pstate_single_freq(struct cpufreq_pstate *p,
 	printf("  ");
 	display_factored_freq(p->freq, 8);
 	printf("   ");
-	display_factored_time(p->min_time == DBL_MAX ? 0. : p->min_time, 8);
+	display_factored_time(MIN_TIME_USEC(p->min_time), 8);
 	printf("   ");
-	display_factored_time(p->max_time, 8);
+	display_factored_time(NSEC_TO_USEC(p->max_time), 8);
 	printf("   ");
-	display_factored_time(p->avg_time, 8);
+	display_factored_time(AVG_TIME_USEC(p->duration, p->count), 8);
 	printf("   ");
-	display_factored_time(p->duration, 8);
+	display_factored_time(NSEC_TO_USEC(p->duration), 8);
 	printf("   %5d\n", p->count);
 }
 
@@ -213,13 +210,13 @@ static void default_pstate_single_freq(struct cpufreq_pstate *p,
 	printf("| ");
 	display_factored_freq(p->freq, 8);
 	printf(" | ");
-	display_factored_time(p->min_time == DBL_MAX ? 0. : p->min_time, 8);
+	display_factored_time(MIN_TIME_USEC(p->min_time), 8);
 	printf(" | ");
-	display_factored_time(p->max_time, 8);
+	display_factored_time(NSEC_TO_USEC(p->max_time), 8);
 	printf(" | ");
-	display_factored_time(p->avg_time, 8);
+	display_factored_time(AVG_TIME_USEC(p->duration, p->count), 8);
 	printf(" | ");
-	display_factored_time(p->duration, 8);
+	display_factored_time(NSEC_TO_USEC(p->duration), 8);
 	printf(" | %5d |\n", p->count);
 }
 
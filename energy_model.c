@@ -388,15 +388,15 @@ void calculate_energy_consumption(struct cpu_topology *cpu_topo)
 			cp = find_cstate_energy_info(current_cluster, c->name);
 			if (!cp) {
 				verbose_fprintf(stderr, 2, "      C%-2d no energy model for [%s] (%d hits, %f duration)\n",
-				 		j, c->name, c->nrdata, c->duration);
+				 		j, c->name, c->nrdata, NSEC_TO_USEC(c->duration));
 				continue;
 			}
 
-			cluster_idl += c->duration * cp->cluster_idle_power;
+			cluster_idl += NSEC_TO_USEC(c->duration) * cp->cluster_idle_power;
 
 			verbose_fprintf(stderr, 1, "      C%-2d +%7d hits for [%15s] | %13.0f | %7d | %7s | %12s | %12.0f | %12s |\n",
 					j, c->nrdata, c->name,
-					c->duration,
+					NSEC_TO_USEC(c->duration),
 					cp->cluster_idle_power,
 					"", "",
 					cluster_idl,
@@ -417,15 +417,15 @@ void calculate_energy_consumption(struct cpu_topology *cpu_topo)
 			if (!pp) {
 				verbose_fprintf(stderr, 2, "Cluster %c  frequency %u MHz no energy model for [%d] (%d hits, %f duration)\n",
 					s_phy->physical_id + 'A', p->freq/1000,
-					p->count, p->duration);
+					p->count, NSEC_TO_USEC(p->duration));
 				continue;
 			}
 
-			cluster_cap += p->duration * pp->cluster_power;
+			cluster_cap += NSEC_TO_USEC(p->duration) * pp->cluster_power;
 			verbose_fprintf(stderr, 1, "          +%7d hits for [%11d MHz] | %13.0f | %7d | %7s | %12.0f | %12s | %12s |\n",
 					p->count,
 					pp->speed,
-					p->duration,
+					NSEC_TO_USEC(p->duration),
 					pp->cluster_power,
 					"",
 					cluster_cap,
@@ -452,14 +452,14 @@ void calculate_energy_consumption(struct cpu_topology *cpu_topo)
 					if (!cp) {
 						verbose_fprintf(stderr, 2, "Cpu%d  C%-2d no energy model for [%s] (%d hits, %f duration)\n",
 							s_cpu->cpu_id, i, c->name,
-							c->nrdata, c->duration);
+							c->nrdata, NSEC_TO_USEC(c->duration));
 						continue;
 					}
-					cluster_idl += c->duration * cp->core_idle_power;
+					cluster_idl += NSEC_TO_USEC(c->duration) * cp->core_idle_power;
 
 					verbose_fprintf(stderr, 1, "Cpu%d  C%-2d +%7d hits for [%15s] | %13.0f | %7d | %7s | %12s | %12.0f | %12s |\n",
 							s_cpu->cpu_id, i, c->nrdata, c->name,
-							c->duration,
+							NSEC_TO_USEC(c->duration),
 							cp->core_idle_power,
 							"", "",
 							cluster_idl,
@@ -484,15 +484,15 @@ void calculate_energy_consumption(struct cpu_topology *cpu_topo)
 					if (!pp) {
 						verbose_fprintf(stderr, 2, "Cpu%d  P%-2d no energy model for [%d] (%d hits, %f duration)\n",
 							s_cpu->cpu_id, i, p->freq/1000,
-							p->count, p->duration);
+							p->count, NSEC_TO_USEC(p->duration));
 						continue;
 					}
 
-					cluster_cap += p->duration * pp->core_power;
+					cluster_cap += NSEC_TO_USEC(p->duration) * pp->core_power;
 
 					verbose_fprintf(stderr, 1, "Cpu%d      +%7d hits for [%11d MHz] | %13.0f | %7d | %7s | %12.0f | %12s | %12s |\n",
 							s_cpu->cpu_id, p->count, p->freq/1000,
-							p->duration, pp->core_power,
+							NSEC_TO_USEC(p->duration), pp->core_power,
 							"",
 							cluster_cap,
 							"", "");
@@ -32,12 +32,13 @@
 #include <unistd.h>
 #include <sched.h>
 #include <string.h>
-#include <float.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
 #ifdef ANDROID
 #include <libgen.h>
 #endif
@@ -47,13 +48,22 @@
 #include "trace.h"
 #include "list.h"
 #include "topology.h"
+#include "intern.h"
+#include "analysis.h"
+#include "trace_raw.h"
+#include "counters.h"
+#include "trace_bpf.h"
+#include "trace_perf.h"
+#include "live.h"
+#include "reorder.h"
 #include "energy_model.h"
 #include "report_ops.h"
 #include "trace_ops.h"
+#include "trace_event.h"
+#include "line_reader.h"
 #include "compiler.h"
 
 #define IDLESTAT_VERSION "0.8"
-#define USEC_PER_SEC 1000000
 
 static char buffer[BUFSIZE];
 
@@ -85,11 +95,10 @@ static inline int bad_filename(const char *filename)
 	return 0;
 }
 
-#define TRACE_TS_FORMAT "%*[^:]:%lf"
-
-static int get_trace_ts(double *ts)
+static int read_trace_ts(uint64_t *ts)
 {
 	FILE *f;
+	char *p;
 
 	f = fopen(TRACE_STAT_FILE, "r");
 	if (!f)
@@ -101,20 +110,46 @@ static int get_trace_ts(double *ts)
 
 		fclose(f);
 
-		if (sscanf(buffer, TRACE_TS_FORMAT, ts) == 1)
+		/* "now ts: <sec>.<usec>" */
+		p = strchr(buffer, ':');
+		if (p && !parse_timestamp_ns(p + 1, buffer + strlen(buffer),
+					     ts))
 			return 0;
 
-		fprintf(stderr, "get_trace_ts: Failed to parse timestamp\n");
+		fprintf(stderr, "read_trace_ts: Failed to parse timestamp\n");
 		return -1;
 	}
 
 	fclose(f);
 
-	fprintf(stderr, "get_trace_ts: Failed to find timestamp in %s\n",
+	fprintf(stderr, "read_trace_ts: Failed to find timestamp in %s\n",
 		TRACE_STAT_FILE);
 	return -1;
 }
 
+/*
+ * The trace clock is read on cpu 0 when allowed to run there, the cpu
+ * the clock skew of the others is corrected relative to on import.
+ */
+static int get_trace_ts(uint64_t *ts)
+{
+	cpu_set_t cpumask, original_cpumask;
+	int pinned, ret;
+
+	sched_getaffinity(0, sizeof(original_cpumask), &original_cpumask);
+	CPU_ZERO(&cpumask);
+	CPU_SET(0, &cpumask);
+	pinned = CPU_ISSET(0, &original_cpumask) &&
+		!sched_setaffinity(0, sizeof(cpumask), &cpumask);
+
+	ret = read_trace_ts(ts);
+
+	if (pinned)
+		sched_setaffinity(0, sizeof(original_cpumask),
+				  &original_cpumask);
+	return ret;
+}
+
 static int display_cstates(struct report_ops *ops, void *arg, void *baseline, char *cpu, void *report_data)
 {
 	int i;
@@ -254,17 +289,17 @@ void release_cstate_info(struct cpuidle_cstates *cstates, int nrcpus)
 		/* already cleaned up */
 		return;
 
-	/* free C-state names */
+	/* free C-state names, idle records and wakeup irqs */
 	for (cpu = 0; cpu < nrcpus; cpu++) {
 		for (i = 0; i < MAXCSTATE; i++) {
 			struct cpuidle_cstate *c = &(cstates[cpu].cstate[i]);
 			free(c->name);
-			free(c->data);
 		}
+		arena_release(&cstates[cpu].arena);
+		free(cstates[cpu].wakeinfo.irqinfo);
+		free(cstates[cpu].wakeinfo.index);
 	}
 
-	free(cstates->wakeinfo.irqinfo);
-
 	/* free the cstates array */
 	free(cstates);
 }
@@ -333,10 +368,9 @@ struct cpuidle_cstates *build_cstate_info(int nrcpus)
 			c->nrdata = 0;
 			c->early_wakings = 0;
 			c->late_wakings = 0;
-			c->avg_time = 0.;
-			c->max_time = 0.;
-			c->min_time = DBL_MAX;
-			c->duration = 0.;
+			c->max_time = 0;
+			c->min_time = TIME_MAX;
+			c->duration = 0;
 			c->target_residency =
 				cpuidle_get_target_residency(cpu, i);
 		}
@@ -396,59 +430,131 @@ static struct init_pstates *build_init_pstates(struct cpu_topology *topo)
 
 static void output_pstates(FILE *f, struct init_pstates *initp,
 				int nrcpus, struct cpu_topology *topo,
-				double ts)
+				uint64_t ts)
 {
 	int cpu;
 	unsigned int freq;
 	unsigned long ts_sec, ts_usec;
 
-	ts_sec = (unsigned long)ts;
-	ts_usec = (ts - ts_sec) * USEC_PER_SEC;
+	ts_sec = ts / NSEC_PER_SEC;
+	ts_usec = (ts % NSEC_PER_SEC) / NSEC_PER_USEC;
 
+	/* Logged on cpu 0, the cpu get_trace_ts() read the time on */
 	for (cpu = 0; cpu < nrcpus; cpu++) {
 		if (!cpu_is_online(topo, cpu))
 			continue;
 
 		freq = initp ? initp->freqs[cpu] : 0;
-		fprintf(f, "%16s-%-5d [%03d] .... %5lu.%06lu: cpu_frequency: "
-			"state=%u cpu_id=%d\n", "idlestat", getpid(), cpu,
+		fprintf(f, "%16s-%-5d [000] .... %5lu.%06lu: cpu_frequency: "
+			"state=%u cpu_id=%d\n", "idlestat", getpid(),
 			ts_sec, ts_usec, freq, cpu);
 	}
 }
 
+/* Fibonacci hashing of a frequency into the pstate index table */
+static inline unsigned int pstate_hash(struct cpufreq_pstates *pstates,
+				       unsigned int freq)
+{
+	/* The high bits of the product are the well mixed ones */
+	return (freq * 2654435761U) >> (32 - pstates->index_bits);
+}
+
+static void index_pstate(struct cpufreq_pstates *pstates, int i)
+{
+	unsigned int h;
+
+	h = pstate_hash(pstates, pstates->pstate[i].freq);
+	while (pstates->index[h] != -1)
+		h = (h + 1) & pstates->index_mask;
+	pstates->index[h] = i;
+}
+
+/*
+ * Rebuild the frequency hash of @pstates in a table large enough to be
+ * at most half full.
+ */
+static void rehash_pstates(struct cpufreq_pstates *pstates)
+{
+	unsigned int size, bits;
+	int i;
+
+	for (bits = 1; (1U << bits) < 2 * MAXPSTATE ||
+		     (1U << bits) < 2U * pstates->max; bits++)
+		;
+	size = 1U << bits;
+
+	free(pstates->index);
+	pstates->index = malloc(sizeof(*pstates->index) * size);
+	if (!pstates->index) {
+		perror(__func__);
+		exit(1);
+	}
+	pstates->index_mask = size - 1;
+	pstates->index_bits = bits;
+
+	memset(pstates->index, -1, sizeof(*pstates->index) * size);
+	for (i = 0; i < pstates->max; i++)
+		index_pstate(pstates, i);
+}
+
+static int find_pstate(struct cpufreq_pstates *pstates, unsigned int freq)
+{
+	unsigned int h;
+	int i;
+
+	if (!pstates->index)
+		return -1;
+
+	h = pstate_hash(pstates, freq);
+	while ((i = pstates->index[h]) != -1) {
+		if (pstates->pstate[i].freq == freq)
+			return i;
+		h = (h + 1) & pstates->index_mask;
+	}
+
+	return -1;
+}
+
 /**
  * alloc_pstate - allocate and initialize a cpufreq_pstate struct if needed
  * @pstates: per-CPU P-state statistics struct
  * @freq: frequency for which the new pstate should be allocated
  *
- * This function checks the array of struct cpufreq_pstate in @pstates
- * for an entry for @freq. If one if found, the index for this entry
+ * This function looks up the entry for @freq in the array of struct
+ * cpufreq_pstate in @pstates. If one if found, the index for this entry
  * is returned. If not, a new entry is inserted into the array so that
  * the frequencies are in increasing order and the index for the new
  * entry is returned.
  * @return: the index of the existing or newly allocated pstate struct
  */
-static int alloc_pstate(struct cpufreq_pstates *pstates, unsigned int freq)
+int alloc_pstate(struct cpufreq_pstates *pstates, unsigned int freq)
 {
 	struct cpufreq_pstate *pstate, *tmp;
-	int nrfreq, i, next = 0;
+	int nrfreq, i, next;
+	unsigned int h;
+
+	next = find_pstate(pstates, freq);
+	if (next >= 0)
+		return next;
 
 	pstate = pstates->pstate;
 	nrfreq = pstates->max;
 
-	for (i = 0; i < nrfreq && freq >= pstate[i].freq; i++) {
-		if (pstate[i].freq == freq)
-			return i;
-	}
-	next = i;
+	for (next = 0; next < nrfreq && freq > pstate[next].freq; next++)
+		;
 
-	tmp = realloc(pstate, sizeof(*pstate) * (nrfreq + 1));
-	if (!tmp) {
-		perror(__func__);
-		exit(1);
+	if (nrfreq == pstates->size) {
+		int size = pstates->size ? pstates->size * 2 : MAXPSTATE;
+
+		tmp = realloc(pstate, sizeof(*pstate) * size);
+		if (!tmp) {
+			perror(__func__);
+			exit(1);
+		}
+		pstate = tmp;
+		pstates->pstate = tmp;
+		pstates->size = size;
 	}
-	pstate = tmp;
-	pstates->pstate = tmp;
 	pstates->max = nrfreq + 1;
 
 	memmove(pstate + next + 1, pstate + next, sizeof(*pstate) * (nrfreq - next));
@@ -461,14 +567,82 @@ static int alloc_pstate(struct cpufreq_pstates *pstates, unsigned int freq)
 	pstate[next].id = next;
 	pstate[next].freq = freq;
 	pstate[next].count = 0;
-	pstate[next].min_time = DBL_MAX;
+	pstate[next].min_time = TIME_MAX;
 	pstate[next].max_time = 0;
-	pstate[next].avg_time = 0;
 	pstate[next].duration = 0;
 
+	/* Rehash past half full, else renumber the entries moved up */
+	if (!pstates->index || 2U * pstates->max > pstates->index_mask + 1) {
+		rehash_pstates(pstates);
+	} else {
+		for (h = 0; h <= pstates->index_mask; h++)
+			if (pstates->index[h] >= next)
+				pstates->index[h]++;
+		index_pstate(pstates, next);
+	}
+
 	return next;
 }
 
+/**
+ * release_pstate_tables - free the P-state array and index of @pstates
+ */
+void release_pstate_tables(struct cpufreq_pstates *pstates)
+{
+	free(pstates->pstate);
+	free(pstates->index);
+	pstates->pstate = NULL;
+	pstates->index = NULL;
+	pstates->max = pstates->size = 0;
+}
+
+/*
+ * Add a zero hit P-state for each frequency listed in @path, so that
+ * the frequencies seen in the trace are already known.
+ */
+static void seed_pstates(struct cpufreq_pstates *pstates, const char *path)
+{
+	unsigned int freq;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return;
+
+	while (fscanf(f, "%u", &freq) == 1)
+		alloc_pstate(pstates, freq);
+
+	fclose(f);
+}
+
+/**
+ * seed_pstates_from_sysfs - pre-allocate P-states of the host cpus
+ * @datas: trace data whose cpus are those of the host
+ *
+ * Reads the scaling_available_frequencies of each online cpu. Hosts
+ * without that file (e.g. intel_pstate) are left alone and get their
+ * P-states allocated as the frequencies show up in the trace.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int seed_pstates_from_sysfs(struct cpuidle_datas *datas)
+{
+	char *fpath;
+	int cpu;
+
+	for (cpu = 0; cpu < datas->nrcpus; cpu++) {
+		if (!cpu_is_online(datas->topo, cpu))
+			continue;
+
+		if (asprintf(&fpath, CPUFREQ_AVFREQ_PATH_FORMAT, cpu) < 0)
+			return -1;
+		seed_pstates(&datas->pstates[cpu], fpath);
+		free(fpath);
+	}
+
+	return 0;
+}
+
 /**
  * release_pstate_info - free all P-state related structs
  * @pstates: per-cpu array of P-state statistics structs
@@ -484,8 +658,7 @@ static void release_pstate_info(struct cpufreq_pstates *pstates, int nrcpus)
 
 	/* first check and clean per-cpu structs */
 	for (cpu = 0; cpu < nrcpus; cpu++)
-		if (pstates[cpu].pstate)
-			free(pstates[cpu].pstate);
+		release_pstate_tables(&pstates[cpu]);
 
 	/* now free the master cpufreq structs */
 	free(pstates);
@@ -515,8 +688,8 @@ struct cpufreq_pstates *build_pstate_info(int nrcpus)
 		pstates[cpu].max = 0;
 		pstates[cpu].current = -1;	/* unknown */
 		pstates[cpu].idle = -1;		/* unknown */
-		pstates[cpu].time_enter = 0.;
-		pstates[cpu].time_exit = 0.;
+		pstates[cpu].time_enter = 0;
+		pstates[cpu].time_exit = 0;
 	}
 
 	return pstates;
@@ -540,35 +713,34 @@ static int get_current_pstate(struct cpuidle_datas *datas, int cpu,
 	return ps->idle;
 }
 
-static void open_current_pstate(struct cpufreq_pstates *ps, double time)
+static void open_current_pstate(struct cpufreq_pstates *ps, uint64_t time)
 {
 	ps->time_enter = time;
 }
 
-static void open_next_pstate(struct cpufreq_pstates *ps, int s, double time)
+static void open_next_pstate(struct cpufreq_pstates *ps, int s, uint64_t time)
 {
 	ps->current = s;
 	open_current_pstate(ps, time);
 }
 
-static void close_current_pstate(struct cpufreq_pstates *ps, double time)
+static void close_current_pstate(struct cpufreq_pstates *ps, uint64_t time)
 {
 	int c = ps->current;
 	struct cpufreq_pstate *p = &(ps->pstate[c]);
-	double elapsed;
+	uint64_t elapsed;
 
-	elapsed = (time - ps->time_enter) * USEC_PER_SEC;
-	if (elapsed <= 0)
+	if (time <= ps->time_enter)
 		return;
+	elapsed = time - ps->time_enter;
 
 	p->min_time = MIN(p->min_time, elapsed);
 	p->max_time = MAX(p->max_time, elapsed);
-	p->avg_time = AVG(p->avg_time, elapsed, p->count + 1);
 	p->duration += elapsed;
 	p->count++;
 }
 
-int record_group_freq(struct cpufreq_pstates *ps, double time,
+int record_group_freq(struct cpufreq_pstates *ps, uint64_t time,
 			      unsigned int freq)
 {
 	int cur, next;
@@ -604,12 +776,32 @@ int record_group_freq(struct cpufreq_pstates *ps, double time,
 	return 0;
 }
 
-int check_pstate_composite(struct cpuidle_datas *datas, int cpu, double time)
+/**
+ * update_group_pstates - account a frequency change of a cpu in its groups
+ * @datas: per-trace statistics
+ * @cpu: the cpu
+ * @time: time of the change
+ * @core_freq: frequency @cpu counts for in its core, 0 if none
+ * @cluster_freq: frequency @cpu counts for in its cluster, 0 if none
+ * @composite: non zero to also record the resulting core and cluster
+ * P-state changes
+ *
+ * @return: 0 on success, -1 on error
+ */
+int update_group_pstates(struct cpuidle_datas *datas, int cpu, uint64_t time,
+			 unsigned int core_freq, unsigned int cluster_freq,
+			 int composite)
 {
 	struct cpu_core *aff_core;
 	struct cpu_physical *aff_cluster;
 	unsigned int freq;
 
+	if (cpu_freq_changed(datas->topo, cpu, core_freq, cluster_freq))
+		return -1;
+
+	if (!composite)
+		return 0;
+
 	aff_core = cpu_to_core(cpu, datas->topo);
 	aff_cluster = cpu_to_cluster(cpu, datas->topo);
 
@@ -618,20 +810,48 @@ int check_pstate_composite(struct cpuidle_datas *datas, int cpu, double time)
 		verbose_fprintf(stderr, 5, "Core %c%d:   freq %9u, time %f\n",
 				aff_cluster->physical_id + 'A',
 				aff_core->core_id,
-				freq, time);
+				freq, NSEC_TO_SEC(time));
 	}
 	if (record_group_freq(aff_core->pstates, time, freq) == -1)
 		return -1;
 
 	freq = cluster_get_highest_freq(aff_cluster);
 	verbose_fprintf(stderr, 5, "Cluster %c: freq %9u, time %f\n",
-		aff_cluster->physical_id + 'A', freq, time);
+		aff_cluster->physical_id + 'A', freq, NSEC_TO_SEC(time));
 	return record_group_freq(aff_cluster->pstates, time, freq);
 }
 
+/*
+ * Report the frequency of @cpu to its core and cluster. Cores count
+ * the frequency of idle cpus, clusters only that of running ones.
+ * With @composite, also see if the core or cluster frequency changed.
+ */
+static int group_freq_changed(struct cpuidle_datas *datas, int cpu,
+			      uint64_t time, int composite)
+{
+	struct cpufreq_pstates *ps = &(datas->pstates[cpu]);
+	unsigned int freq = 0, cluster_freq;
+
+	if (ps->current >= 0)
+		freq = ps->pstate[ps->current].freq;
+	cluster_freq = ps->idle > 0 ? 0 : freq;
+
+	if (datas->streams)
+		return defer_group_pstates(datas->streams, cpu, time, freq,
+					   cluster_freq, composite);
+
+	return update_group_pstates(datas, cpu, time, freq, cluster_freq,
+				    composite);
+}
+
+int check_pstate_composite(struct cpuidle_datas *datas, int cpu, uint64_t time)
+{
+	return group_freq_changed(datas, cpu, time, 1);
+}
+
 
 int cpu_change_pstate(struct cpuidle_datas *datas, int cpu,
-			      unsigned int freq, double time)
+			      unsigned int freq, uint64_t time)
 {
 	struct cpufreq_pstates *ps = NULL;
 	struct cpufreq_pstate *p = NULL;
@@ -647,7 +867,7 @@ int cpu_change_pstate(struct cpuidle_datas *datas, int cpu,
 		 * stats unchanged
 		 */
 		ps->current = next;
-		return 0;
+		return group_freq_changed(datas, cpu, time, 0);
 
 	case -1:
 		/* current pstate is -1, i.e. this is the first update */
@@ -705,7 +925,7 @@ static void merge_pstates(struct cpuidle_datas *datas,
 	}
 }
 
-static void cpu_pstate_idle(struct cpuidle_datas *datas, int cpu, double time)
+static void cpu_pstate_idle(struct cpuidle_datas *datas, int cpu, uint64_t time)
 {
 	struct cpufreq_pstates *ps = &(datas->pstates[cpu]);
 	if (ps->current != -1)
@@ -717,7 +937,7 @@ static void cpu_pstate_idle(struct cpuidle_datas *datas, int cpu, double time)
 }
 
 static void cpu_pstate_running(struct cpuidle_datas *datas, int cpu,
-			       double time)
+			       uint64_t time)
 {
 	struct cpufreq_pstates *ps = &(datas->pstates[cpu]);
 	ps->idle = 0;
@@ -728,18 +948,44 @@ static void cpu_pstate_running(struct cpuidle_datas *datas, int cpu,
 	assert(check_pstate_composite(datas, cpu, time) != -1);
 }
 
-static int cstate_begin(double time, int state, struct cpuidle_cstates *cstates)
+/*
+ * The statistics only need the interval in progress, so by default a
+ * trace of any length is analyzed in constant memory.
+ */
+static int retain_idle_records;
+
+/**
+ * set_idle_record_retention - keep every idle interval for a consumer
+ * @retain: non zero to keep each interval in the arena of its
+ * cpuidle_cstates, chained from cpuidle_cstate.data backwards through
+ * cpuidle_data.prev; zero, the default, to keep only the interval in
+ * progress
+ *
+ * To be called before the trace is analyzed.
+ */
+void set_idle_record_retention(int retain)
+{
+	retain_idle_records = retain;
+}
+
+static int cstate_begin(uint64_t time, int state, struct cpuidle_cstates *cstates)
 {
 	struct cpuidle_cstate *cstate = &cstates->cstate[state];
-	struct cpuidle_data *data = cstate->data;
-	int nrdata = cstate->nrdata;
+	struct cpuidle_data *data;
 
-	data = realloc(data, sizeof(*data) * (nrdata + 1));
-	if (!data)
-		return error(__func__);
-	memset(data + nrdata, 0, sizeof(*data));
+	if (retain_idle_records) {
+		data = arena_alloc(&cstates->arena, sizeof(*data));
+		if (is_err(data))
+			return -1;
+		memset(data, 0, sizeof(*data));
+		data->prev = cstate->data;
+	} else {
+		/* Only one state is open at a time */
+		data = &cstates->open_data;
+		memset(data, 0, sizeof(*data));
+	}
 
-	data[nrdata].begin = time;
+	data->begin = time;
 
 	cstate->data = data;
 	cstates->cstate_max = MAX(cstates->cstate_max, state);
@@ -748,32 +994,32 @@ static int cstate_begin(double time, int state, struct cpuidle_cstates *cstates)
 	return 0;
 }
 
-static void cstate_end(double time, struct cpuidle_cstates *cstates)
+static void cstate_end(uint64_t time, struct cpuidle_cstates *cstates)
 {
 	int last_cstate = cstates->current_cstate;
 	struct cpuidle_cstate *cstate = &cstates->cstate[last_cstate];
-	struct cpuidle_data *data = &cstate->data[cstate->nrdata];
+	struct cpuidle_data *data = cstate->data;
+	int64_t tr_ns;
 
 	data->end = time;
-	data->duration = data->end - data->begin;
 
 	/*
-	 * Duration can be < 0 when precision digit in the file exceed
-	 * 7 (eg. xxx.1000000). Ignoring the result because I don't
-	 * find a way to fix with the sscanf used in the caller.
-	 *
-	 * For synthetic test material, the duration may be 0.
+	 * For synthetic test material, the duration may be 0. Out of
+	 * order input may even produce a negative duration.
 	 *
 	 * In both cases, do not record the entry, but do end the state
 	 * regardless.
 	 */
-	if (data->duration <= 0)
+	if (data->end <= data->begin) {
+		if (retain_idle_records)
+			cstate->data = data->prev;
 		goto skip_entry;
+	}
 
-	/* convert to us */
-	data->duration *= USEC_PER_SEC;
+	data->duration = data->end - data->begin;
 	cstates->actual_residency = as_expected;
-	if (data->duration < cstate->target_residency) {
+	tr_ns = (int64_t)cstate->target_residency * NSEC_PER_USEC;
+	if ((int64_t)data->duration < tr_ns) {
 		/* over estimated */
 		cstate->early_wakings++;
 		cstates->actual_residency = too_short;
@@ -782,7 +1028,8 @@ static void cstate_end(double time, struct cpuidle_cstates *cstates)
 		int next_cstate = last_cstate + 1;
 		if (next_cstate <= cstates->cstate_max) {
 			int tr = cstates->cstate[next_cstate].target_residency;
-			if (tr > 0 && data->duration >= tr) {
+			if (tr > 0 &&
+			    data->duration >= (uint64_t)tr * NSEC_PER_USEC) {
 				cstate->late_wakings++;
 				cstates->actual_residency = too_long;
 			}
@@ -791,8 +1038,6 @@ static void cstate_end(double time, struct cpuidle_cstates *cstates)
 
 	cstate->min_time = MIN(cstate->min_time, data->duration);
 	cstate->max_time = MAX(cstate->max_time, data->duration);
-	cstate->avg_time = AVG(cstate->avg_time, data->duration,
-			       cstate->nrdata + 1);
 	cstate->duration += data->duration;
 	cstate->nrdata++;
 
@@ -802,7 +1047,7 @@ skip_entry:
 }
 
 int record_cstate_event(struct cpuidle_cstates *cstates,
-		       double time, int state)
+		       uint64_t time, int state)
 {
 	int ret = 0;
 
@@ -818,23 +1063,74 @@ int record_cstate_event(struct cpuidle_cstates *cstates,
 	return ret;
 }
 
-int store_data(double time, int state, int cpu,
-		struct cpuidle_datas *datas)
+/**
+ * update_group_cstates - account a C-state change of a cpu in its groups
+ * @datas: per-trace statistics
+ * @cpu: the cpu
+ * @time: time of the change
+ * @old_cstate: previous C-state of @cpu, -1 if it was running
+ * @new_cstate: new C-state of @cpu, -1 if it is running
+ * @record: non zero to also record the resulting core and cluster
+ * C-state changes
+ *
+ * @return: 0 on success, -1 on error
+ */
+int update_group_cstates(struct cpuidle_datas *datas, int cpu, uint64_t time,
+			 int old_cstate, int new_cstate, int record)
 {
-	struct cpuidle_cstates *cstates = &datas->cstates[cpu];
-	struct cpufreq_pstate *pstate = datas->pstates[cpu].pstate;
 	struct cpu_core *aff_core;
 	struct cpu_physical *aff_cluster;
+	int state;
+
+	cpu_cstate_changed(datas->topo, cpu, old_cstate, new_cstate);
+	if (!record)
+		return 0;
+
+	aff_core = cpu_to_core(cpu, datas->topo);
+	state = core_get_least_cstate(aff_core);
+	if (record_cstate_event(aff_core->cstates, time, state) == -1)
+		return -1;
+
+	aff_cluster = cpu_to_cluster(cpu, datas->topo);
+	state = cluster_get_least_cstate(aff_cluster);
+	return record_cstate_event(aff_cluster->cstates, time, state);
+}
+
+static int group_cstate_changed(struct cpuidle_datas *datas, int cpu,
+				uint64_t time, int old_cstate,
+				int new_cstate, int record)
+{
+	if (datas->streams)
+		return defer_group_cstates(datas->streams, cpu, time,
+					   old_cstate, new_cstate, record);
+
+	return update_group_cstates(datas, cpu, time, old_cstate, new_cstate,
+				    record);
+}
+
+int store_data(uint64_t time, int state, int cpu,
+		struct cpuidle_datas *datas)
+{
+	struct cpuidle_cstates *cstates = &datas->cstates[cpu];
+	struct cpufreq_pstates *ps = &datas->pstates[cpu];
+	int prev_state;
 
 	/* ignore when we got a "closing" state first */
 	if (state == -1 && cstates->cstate_max == -1)
 		return 0;
 
-	if (record_cstate_event(cstates, time, state) == -1)
+	prev_state = cstates->current_cstate;
+	if (record_cstate_event(cstates, time, state) == -1) {
+		group_cstate_changed(datas, cpu, time, prev_state,
+				     cstates->current_cstate, 0);
 		return -1;
+	}
 
-	/* Update P-state stats if supported */
-	if (pstate) {
+	/*
+	 * Update P-state stats if supported, i.e. once the frequency of
+	 * the cpu is known. The P-state table may be preloaded before.
+	 */
+	if (ps->current != -1) {
 		if (state == -1)
 			cpu_pstate_running(datas, cpu, time);
 		else
@@ -842,20 +1138,139 @@ int store_data(double time, int state, int cpu,
 	}
 
 	/* Update core and cluster */
-	aff_core = cpu_to_core(cpu, datas->topo);
-	state = core_get_least_cstate(aff_core);
-	if (record_cstate_event(aff_core->cstates, time, state) == -1)
-		return -1;
+	return group_cstate_changed(datas, cpu, time, prev_state,
+				    cstates->current_cstate, 1);
+}
 
-	aff_cluster = cpu_to_cluster(cpu, datas->topo);
-	state = cluster_get_least_cstate(aff_cluster);
-	if (record_cstate_event(aff_cluster->cstates, time,state) == -1)
-		return -1;
+/*
+ * Events of @cpu were lost between @gap_begin and @time, what the cpu did
+ * meanwhile is unknown. Drop the intervals left open before the gap rather
+ * than stretch them over it, and carry on as if the cpu was running at
+ * @time. Its next cpu_idle event says otherwise if it was not.
+ */
+static int resync_cpu(struct cpuidle_datas *datas, int cpu,
+		      uint64_t gap_begin, uint64_t time)
+{
+	struct cpuidle_cstates *cstates = &datas->cstates[cpu];
+	struct cpufreq_pstates *ps = &datas->pstates[cpu];
+	int prev_state;
+
+	prev_state = cstates->current_cstate;
+	cstates->current_cstate = -1;
 
+	if (ps->current != -1)
+		cpu_pstate_running(datas, cpu, time);
+
+	if (prev_state == -1)
+		return 0;
+
+	/* The core and cluster were idle until the gap at most */
+	return group_cstate_changed(datas, cpu, gap_begin, prev_state, -1, 1);
+}
+
+/**
+ * account_trace_gap - keep track of the events lost on a cpu
+ * @datas: per-trace statistics
+ * @ring: the cpu the event was logged on
+ * @cpu: the cpu the event is accounted to
+ * @type: type of the event
+ * @time: time of the event
+ *
+ * Events are lost per ring buffer, so a TRACE_EVENT_LOST event opens a
+ * gap in the events of the cpu logging them, which only the next event
+ * logged by that cpu about itself closes. The gap is then left out of
+ * the statistics of the cpu and accounted as time the trace does not
+ * cover. Events a cpu logs about another one, e.g. cpu_frequency, are
+ * accounted to the other cpu but leave the gaps alone.
+ *
+ * @return: 1 if the event is a TRACE_EVENT_LOST one, 0 if it is to be
+ * accounted, -1 on error
+ */
+int account_trace_gap(struct cpuidle_datas *datas, int ring, int cpu,
+		      int type, uint64_t time)
+{
+	struct cpuidle_cstates *cstates = &datas->cstates[cpu];
+	uint64_t gap_begin;
+
+	if (ring != cpu)
+		return 0;
+
+	if (type == TRACE_EVENT_LOST) {
+		if (!cstates->lost)
+			cstates->nrgaps++;
+		cstates->lost = 1;
+		return 1;
+	}
+
+	if (cstates->lost) {
+		cstates->lost = 0;
+		if (cstates->last_event) {
+			gap_begin = cstates->last_event;
+			if (time > gap_begin)
+				cstates->gap_time += time - gap_begin;
+		} else {
+			/* Lost since the start, see report_trace_coverage() */
+			gap_begin = time;
+			cstates->resync_time = time;
+		}
+
+		if (resync_cpu(datas, cpu, gap_begin, time))
+			return -1;
+	}
+
+	if (!cstates->first_event)
+		cstates->first_event = time;
+	cstates->last_event = MAX(cstates->last_event, time);
 	return 0;
 }
 
-static void release_datas(struct cpuidle_datas *datas)
+/**
+ * report_trace_coverage - print how much of the trace each cpu has events for
+ * @datas: per-trace statistics
+ *
+ * The trace spans from its first to its last event, of any type and cpu.
+ * Nothing is printed unless events were lost.
+ */
+void report_trace_coverage(struct cpuidle_datas *datas)
+{
+	struct cpuidle_cstates *cstates;
+	uint64_t begin = TIME_MAX, end = 0, span, gap;
+	int cpu, lost = 0;
+
+	for (cpu = 0; cpu < datas->nrcpus; cpu++) {
+		cstates = &datas->cstates[cpu];
+		lost |= cstates->nrgaps;
+		if (cstates->first_event)
+			begin = MIN(begin, cstates->first_event);
+		end = MAX(end, cstates->last_event);
+	}
+	if (!lost || end <= begin)
+		return;
+	span = end - begin;
+
+	for (cpu = 0; cpu < datas->nrcpus; cpu++) {
+		if (!cpu_is_online(datas->topo, cpu))
+			continue;
+
+		cstates = &datas->cstates[cpu];
+		gap = cstates->gap_time;
+		if (cstates->resync_time)
+			gap += cstates->resync_time - begin;
+		if (cstates->lost)
+			gap += end - MAX(cstates->last_event, begin);
+		gap = MIN(gap, span);
+
+		fprintf(stderr, "cpu%d: events lost %d times, %.2f%% of the "
+			"trace covered\n", cpu, cstates->nrgaps,
+			100. * (span - gap) / span);
+	}
+}
+
+/**
+ * release_datas - free per-trace statistics and their baseline
+ * @datas: statistics of a trace, or NULL
+ */
+void release_datas(struct cpuidle_datas *datas)
 {
 	if (datas == NULL)
 		return;
@@ -869,50 +1284,127 @@ static void release_datas(struct cpuidle_datas *datas)
 }
 
 
+static inline unsigned int irqinfo_hash(struct wakeup_info *wakeinfo,
+					int irqid, const char *irqname)
+{
+	uintptr_t key = (uintptr_t)irqname ^ ((uintptr_t)irqid << 4);
+
+	return (unsigned int)((key * 2654435761U) >> 4) & wakeinfo->index_mask;
+}
+
+/* Size the hash for the allocated irqinfo entries and fill it */
+static int rehash_irqinfo(struct wakeup_info *wakeinfo)
+{
+	unsigned int size = 2 * wakeinfo->nralloc, h;
+	int *index, i;
+
+	index = malloc(sizeof(*index) * size);
+	if (!index)
+		return error(__func__);
+	memset(index, -1, sizeof(*index) * size);
+
+	free(wakeinfo->index);
+	wakeinfo->index = index;
+	wakeinfo->index_mask = size - 1;
+
+	for (i = 0; i < wakeinfo->nrdata; i++) {
+		struct wakeup_irq *irqinfo = &wakeinfo->irqinfo[i];
+
+		h = irqinfo_hash(wakeinfo, irqinfo->id, irqinfo->name);
+		while (index[h] != -1)
+			h = (h + 1) & wakeinfo->index_mask;
+		index[h] = i;
+	}
+
+	return 0;
+}
+
+/*
+ * Look up the entry for (@irqid, @irqname), @irqname being interned.
+ * If there is none, @slot is set to the free hash slot for it.
+ */
 static struct wakeup_irq *find_irqinfo(struct wakeup_info *wakeinfo, int irqid,
-				       const char *irqname)
+				       const char *irqname, unsigned int *slot)
 {
 	struct wakeup_irq *irqinfo;
+	unsigned int h;
 	int i;
 
-	for (i = 0; i < wakeinfo->nrdata; i++) {
+	if (!wakeinfo->index)
+		return NULL;
+
+	h = irqinfo_hash(wakeinfo, irqid, irqname);
+	while ((i = wakeinfo->index[h]) != -1) {
 		irqinfo = &wakeinfo->irqinfo[i];
-		if (irqinfo->id == irqid && !strcmp(irqinfo->name, irqname))
+		if (irqinfo->id == irqid && irqinfo->name == irqname)
 			return irqinfo;
+		h = (h + 1) & wakeinfo->index_mask;
 	}
 
+	*slot = h;
 	return NULL;
 }
 
-static int store_irq(int cpu, int irqid, char *irqname,
-		     struct cpuidle_datas *datas)
+/* Find the wakeup record of an irq, adding it if needed */
+static struct wakeup_irq *get_wakeup_irq(struct wakeup_info *wakeinfo,
+					 int irqid, const char *irqname)
 {
-	struct cpuidle_cstates *cstates = &datas->cstates[cpu];
 	struct wakeup_irq *irqinfo;
-	struct wakeup_info *wakeinfo = &cstates->wakeinfo;
+	unsigned int slot;
 
-	if (cstates->wakeirq != NULL)
-		return 0;
+	irqinfo = find_irqinfo(wakeinfo, irqid, irqname, &slot);
+	if (irqinfo)
+		return irqinfo;
+
+	if (wakeinfo->nrdata == wakeinfo->nralloc) {
+		int nralloc = wakeinfo->nralloc ? wakeinfo->nralloc * 2 : 16;
 
-	irqinfo = find_irqinfo(wakeinfo, irqid, irqname);
-	if (NULL == irqinfo) {
 		irqinfo = realloc(wakeinfo->irqinfo,
-				sizeof(*irqinfo) * (wakeinfo->nrdata + 1));
+				  sizeof(*irqinfo) * nralloc);
 		if (!irqinfo)
-			return error("realloc irqinfo");
-		memset(irqinfo + wakeinfo->nrdata, 0, sizeof(*irqinfo));
+			return ptrerror("realloc irqinfo");
 
 		wakeinfo->irqinfo = irqinfo;
-
-		irqinfo += wakeinfo->nrdata++;
-		irqinfo->id = irqid;
-		strncpy(irqinfo->name, irqname, sizeof(irqinfo->name));
-		irqinfo->name[sizeof(irqinfo->name) - 1] = '\0';
-		irqinfo->count = 0;
-		irqinfo->early_triggers = 0;
-		irqinfo->late_triggers = 0;
+		wakeinfo->nralloc = nralloc;
+		if (rehash_irqinfo(wakeinfo))
+			return ptrerror(NULL);
+		find_irqinfo(wakeinfo, irqid, irqname, &slot);
 	}
 
+	wakeinfo->index[slot] = wakeinfo->nrdata;
+
+	irqinfo = wakeinfo->irqinfo + wakeinfo->nrdata++;
+	memset(irqinfo, 0, sizeof(*irqinfo));
+	irqinfo->id = irqid;
+	irqinfo->name = irqname;
+
+	return irqinfo;
+}
+
+/**
+ * store_wakeup_irq - account an irq as the wakeup source of a cpu
+ * @cpu: the cpu
+ * @irqid: irq number, -1 for an IPI
+ * @irqname: interned name of the irq
+ * @datas: per-trace statistics
+ *
+ * Only the first irq after the cpu left an idle state is accounted.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int store_wakeup_irq(int cpu, int irqid, const char *irqname,
+		     struct cpuidle_datas *datas)
+{
+	struct cpuidle_cstates *cstates = &datas->cstates[cpu];
+	struct wakeup_irq *irqinfo;
+
+	if (cstates->wakeirq != NULL)
+		return 0;
+
+	irqinfo = get_wakeup_irq(&cstates->wakeinfo, irqid, irqname);
+	if (is_err(irqinfo))
+		return -1;
+
 	irqinfo->count++;
 	if (cstates->actual_residency == too_short)
 		irqinfo->early_triggers++;
@@ -923,6 +1415,50 @@ static int store_irq(int cpu, int irqid, char *irqname,
 	return 0;
 }
 
+/**
+ * add_wakeup_irq - account wakeups of a cpu counted outside of a trace
+ * @cpu: the cpu
+ * @irqid: irq number, -1 for an IPI
+ * @irqname: interned name of the irq
+ * @count: number of wakeups
+ * @early: wakeups ending an idle state shorter than its target residency
+ * @late: wakeups ending an idle state long enough for a deeper one
+ * @datas: per-trace statistics
+ *
+ * @return: 0 on success, -1 on error
+ */
+int add_wakeup_irq(int cpu, int irqid, const char *irqname, int count,
+		   int early, int late, struct cpuidle_datas *datas)
+{
+	struct wakeup_irq *irqinfo;
+
+	irqinfo = get_wakeup_irq(&datas->cstates[cpu].wakeinfo, irqid,
+				 irqname);
+	if (is_err(irqinfo))
+		return -1;
+
+	irqinfo->count += count;
+	irqinfo->early_triggers += early;
+	irqinfo->late_triggers += late;
+	return 0;
+}
+
+static int store_irq(int cpu, int irqid, const char *name, size_t namelen,
+		     struct cpuidle_datas *datas)
+{
+	const char *irqname;
+
+	/* Do not bother interning the name if it will not be used */
+	if (datas->cstates[cpu].wakeirq != NULL)
+		return 0;
+
+	irqname = intern_string(name, namelen);
+	if (!irqname)
+		return -1;
+
+	return store_wakeup_irq(cpu, irqid, irqname, datas);
+}
+
 static void write_cstate_info(FILE *f, char *name, int target)
 {
 	fprintf(f, "\t%s\n", name);
@@ -951,37 +1487,43 @@ void output_cstate_info(FILE *f, struct cpu_topology * topo, int nrcpus)
         free(cstates);
 }
 
-#define TRACE_IRQ_FORMAT "%*[^[][%d] %*[^=]=%d%*[^=]=%16s"
-#define TRACE_IPIIRQ_FORMAT "%*[^[][%d] %*[^(](%16s"
-#define TRACECMD_REPORT_FORMAT "%*[^]]] %lf:%*[^=]=%u%*[^=]=%d"
-#define TRACE_FORMAT "%*[^]]] %*s %lf:%*[^=]=%u%*[^=]=%d"
-
-int get_wakeup_irq(struct cpuidle_datas *datas, char *buffer)
+/**
+ * store_trace_event - account a decoded trace event
+ * @datas: per-trace statistics
+ * @ev: event decoded by parse_trace_event() or one of the binary readers
+ *
+ * @return: 0 on success, -1 if the event could not be accounted
+ */
+int store_trace_event(struct cpuidle_datas *datas, struct trace_event *ev)
 {
-	int cpu, irqid;
-	char irqname[NAMELEN+1];
+	int cpu, ret;
 
-	if (strstr(buffer, "irq_handler_entry")) {
-		if (sscanf(buffer, TRACE_IRQ_FORMAT, &cpu, &irqid,
-			      irqname) != 3) {
-			fprintf(stderr, "warning: Unrecognized "
-					"irq_handler_entry record skipped.\n");
-			return -1;
-		}
-
-		store_irq(cpu, irqid, irqname, datas);
-		return 0;
+	cpu = (ev->type == TRACE_EVENT_CPU_IDLE ||
+	       ev->type == TRACE_EVENT_CPU_FREQUENCY) ? ev->cpu_id : ev->cpu;
+	if (cpu < 0 || cpu >= datas->nrcpus) {
+		fprintf(stderr, "warning: event for unknown cpu %d skipped\n",
+			cpu);
+		return -1;
 	}
 
-	if (strstr(buffer, "ipi_entry")) {
-		if (sscanf(buffer, TRACE_IPIIRQ_FORMAT, &cpu, irqname) != 2) {
-			fprintf(stderr, "warning: Unrecognized ipi_entry "
-					"record skipped\n");
-			return -1;
-		}
+	if (datas->streams)
+		return queue_trace_event(datas->streams, cpu, ev);
 
-		irqname[strlen(irqname) - 1] = '\0';
-		store_irq(cpu, -1, irqname, datas);
+	ret = account_trace_gap(datas, ev->cpu, cpu, ev->type, ev->time);
+	if (ret)
+		return ret > 0 ? 0 : -1;
+
+	switch (ev->type) {
+	case TRACE_EVENT_CPU_IDLE:
+		return store_data(ev->time, ev->value, cpu, datas);
+
+	case TRACE_EVENT_CPU_FREQUENCY:
+		return cpu_change_pstate(datas, cpu, ev->value, ev->time);
+
+	case TRACE_EVENT_IRQ_HANDLER_ENTRY:
+	case TRACE_EVENT_IPI_ENTRY:
+		store_irq(cpu, ev->type == TRACE_EVENT_IPI_ENTRY ?
+			  -1 : (int)ev->value, ev->name, ev->namelen, datas);
 		return 0;
 	}
 
@@ -991,7 +1533,23 @@ int get_wakeup_irq(struct cpuidle_datas *datas, char *buffer)
 struct cpuidle_datas *idlestat_load(const char *filename)
 {
 	const struct trace_ops **ops_it;
-	int ret;
+	struct cpuidle_datas *datas;
+	struct line_reader *reader = NULL;
+	struct stat st;
+	int ret = 0;
+
+	if (stat(filename, &st)) {
+		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
+			filename);
+		return ptrerror(NULL);
+	}
+
+	/* Text traces, which may come from a pipe, are read only once */
+	if (!S_ISDIR(st.st_mode)) {
+		reader = line_reader_open(filename);
+		if (is_err(reader))
+			return ptrerror(NULL);
+	}
 
 	/*
 	 * The linker places pointers to all entries declared with
@@ -1005,18 +1563,22 @@ struct cpuidle_datas *idlestat_load(const char *filename)
 		assert((*ops_it)->name);
 		assert((*ops_it)->check_magic);
 		assert((*ops_it)->load);
-		ret = (*ops_it)->check_magic(filename);
+		ret = (*ops_it)->check_magic(filename, reader);
 
 		if (ret == -1)
-			return ptrerror(NULL);
+			break;
 
 		/* File format supported by these ops? */
 		if (ret > 0) {
-			return (*ops_it)->load(filename);
+			datas = (*ops_it)->load(filename, reader);
+			line_reader_close(reader);
+			return datas;
 		}
 	}
 
-	fprintf(stderr, "Trace file format not recognized\n");
+	if (ret != -1)
+		fprintf(stderr, "Trace file format not recognized\n");
+	line_reader_close(reader);
 	return ptrerror(NULL);
 }
 
@@ -1028,13 +1590,16 @@ static void help(const char *cmd)
 		" -o|--output-file <filename> -t|--duration <seconds>"
 		" -r|--report-format <format>"
 		" -C|--csv-report -B|--boxless-report"
-		" -c|--idle -p|--frequency -w|--wakeup", basename(cmd));
+		" -c|--idle -p|--frequency -w|--wakeup"
+		" --backend text|raw|perf|bpf --live --counters"
+		" --calibrate --trace-clock <clock>", basename(cmd));
 	fprintf(stderr,
 		"\nReporting mode:\n\t%s --import -f|--trace-file <filename>"
 		" -b|--baseline-trace <filename>"
 		" -r|--report-format <format>"
 		" -C|--csv-report -B|--boxless-report"
-		" -o|--output-file <filename>", basename(cmd));
+		" -o|--output-file <filename>"
+		" -j|--jobs <threads> --reorder-window <usec>", basename(cmd));
 	fprintf(stderr,
 		"\n\nExamples:\n1. Run a trace, post-process the results"
 		" (default is to show only C-state statistics):\n\tsudo "
@@ -1060,6 +1625,12 @@ static void help(const char *cmd)
 		"\tsudo ./%s --trace -f /tmp/changedstate -t 10\n"
 		"\t./%s --import -f /tmp/changedstate -b /tmp/baseline -r comparison\n",
 		basename(cmd), basename(cmd), basename(cmd));
+	fprintf(stderr,
+		"\n7. Aggregate the statistics in the kernel, without tracing:"
+		" only the cpus and the cores or clusters of a single cpu are"
+		" reported, and no residency histogram is kept\n"
+		"\tsudo ./%s --trace --backend bpf -t 10 -p -c -w\n",
+		basename(cmd));
 	fprintf(stderr, "\nReport formats supported:");
 	list_report_formats_to_stderr();
 }
@@ -1069,6 +1640,13 @@ static void version(const char *cmd)
 	printf("%s version %s\n", basename(cmd), IDLESTAT_VERSION);
 }
 
+/* Long options without a short equivalent */
+enum {
+	OPT_BACKEND = 256,
+	OPT_REORDER_WINDOW,
+	OPT_TRACE_CLOCK,
+};
+
 int getoptions(int argc, char *argv[], struct program_options *options)
 {
 	/* Keep options sorted alphabetically and make sure the short options
@@ -1077,11 +1655,18 @@ int getoptions(int argc, char *argv[], struct program_options *options)
 	struct option long_options[] = {
 		{ "trace",       no_argument,       &options->mode, TRACE },
 		{ "import",      no_argument,       &options->mode, IMPORT },
+		{ "live",        no_argument,       &options->live, 1 },
+		{ "counters",    no_argument,       &options->counters, 1 },
+		{ "calibrate",   no_argument,       &options->calibrate, 1 },
+		{ "backend",     required_argument, NULL, OPT_BACKEND },
+		{ "reorder-window", required_argument, NULL, OPT_REORDER_WINDOW },
+		{ "trace-clock", required_argument, NULL, OPT_TRACE_CLOCK },
 		{ "baseline-trace", required_argument, NULL, 'b' },
 		{ "idle",        no_argument,       NULL, 'c' },
 		{ "energy-model-file",  required_argument, NULL, 'e' },
 		{ "trace-file",  required_argument, NULL, 'f' },
 		{ "help",        no_argument,       NULL, 'h' },
+		{ "jobs",        required_argument, NULL, 'j' },
 		{ "output-file", required_argument, NULL, 'o' },
 		{ "frequency",   no_argument,       NULL, 'p' },
 		{ "report-format", required_argument, NULL, 'r' },
@@ -1101,12 +1686,13 @@ int getoptions(int argc, char *argv[], struct program_options *options)
 	options->filename = NULL;
 	options->outfilename = NULL;
 	options->mode = -1;
+	options->reorder_window = REORDER_WINDOW_USEC;
 
 	while (1) {
 
 		int optindex = 0;
 
-		c = getopt_long(argc, argv, ":b:ce:f:ho:pr:t:vwBCI:S:V",
+		c = getopt_long(argc, argv, ":b:ce:f:hj:o:pr:t:vwBCI:S:V",
 				long_options, &optindex);
 		if (c == -1)
 			break;
@@ -1171,6 +1757,35 @@ int getoptions(int argc, char *argv[], struct program_options *options)
 			fprintf(stderr, "-B: report type already set to %s\n",
 				options->report_type_name);
 			return -1;
+		case 'j':
+			options->jobs = atoi(optarg);
+			break;
+		case OPT_BACKEND:
+			if (!strcmp(optarg, "text")) {
+				options->backend = TEXT_BACKEND;
+			} else if (!strcmp(optarg, "raw")) {
+				options->backend = RAW_BACKEND;
+			} else if (!strcmp(optarg, "perf")) {
+				options->backend = PERF_BACKEND;
+			} else if (!strcmp(optarg, "bpf")) {
+				options->backend = BPF_BACKEND;
+			} else {
+				fprintf(stderr, "--backend: unknown backend "
+					"'%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_REORDER_WINDOW:
+			options->reorder_window = atoi(optarg);
+			if (options->reorder_window < 0) {
+				fprintf(stderr, "--reorder-window: invalid "
+					"window '%s'\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_TRACE_CLOCK:
+			options->trace_clock = optarg;
+			break;
 		case 'I':
 			options->tbs.poll_interval = atoi(optarg);
 			break;
@@ -1200,12 +1815,84 @@ int getoptions(int argc, char *argv[], struct program_options *options)
 		return -1;
 	}
 
-	if (NULL == options->filename) {
+	if (options->live) {
+		if (options->mode != TRACE) {
+			fprintf(stderr, "--live: only valid with --trace\n");
+			return -1;
+		}
+		if (options->backend != TEXT_BACKEND) {
+			fprintf(stderr, "--live: only valid with --backend "
+				"text\n");
+			return -1;
+		}
+		if (options->filename) {
+			fprintf(stderr, "--live: no trace file is written, "
+				"-f is not expected\n");
+			return -1;
+		}
+	}
+
+	if (options->counters) {
+		if (options->mode != TRACE) {
+			fprintf(stderr, "--counters: only valid with "
+				"--trace\n");
+			return -1;
+		}
+		if (options->live || options->backend != TEXT_BACKEND) {
+			fprintf(stderr, "--counters: nothing is traced, "
+				"--live and --backend do not apply\n");
+			return -1;
+		}
+		if (options->filename) {
+			fprintf(stderr, "--counters: no trace file is "
+				"written, -f is not expected\n");
+			return -1;
+		}
+	}
+
+	if (options->calibrate) {
+		if (options->mode != TRACE || options->counters ||
+		    options->backend == PERF_BACKEND ||
+		    options->backend == BPF_BACKEND) {
+			fprintf(stderr, "--calibrate: only valid with --trace "
+				"and the text or raw backend\n");
+			return -1;
+		}
+		if (options->tbs.percpu_buffer_size) {
+			fprintf(stderr, "--calibrate: the buffer size is "
+				"calibrated, -S is not expected\n");
+			return -1;
+		}
+	}
+
+	if (options->trace_clock &&
+	    (options->mode != TRACE || options->counters ||
+	     options->backend == PERF_BACKEND ||
+	     options->backend == BPF_BACKEND)) {
+		fprintf(stderr, "--trace-clock: only valid with --trace "
+			"and the text or raw backend\n");
+		return -1;
+	}
+
+	if (options->mode == TRACE && options->filename &&
+	    (options->backend == PERF_BACKEND ||
+	     options->backend == BPF_BACKEND)) {
+		fprintf(stderr, "--backend %s: no trace file is written, "
+			"-f is not expected\n",
+			options->backend == PERF_BACKEND ? "perf" : "bpf");
+		return -1;
+	}
+
+	/* The raw, perf and bpf backends, --live and --counters can
+	 * analyze the capture without saving it */
+	if (NULL == options->filename && !options->live &&
+	    !options->counters &&
+	    !(options->mode == TRACE && options->backend != TEXT_BACKEND)) {
 		fprintf(stderr, "expected -f <trace filename>\n");
 		return -1;
 	}
 
-	if (bad_filename(options->filename))
+	if (options->filename && bad_filename(options->filename))
 		return -1;
 
 	if (options->baseline_filename != NULL &&
@@ -1228,44 +1915,19 @@ int getoptions(int argc, char *argv[], struct program_options *options)
 	return optind;
 }
 
-static int idlestat_file_for_each_line(const char *path, void *data,
-					int (*handler)(const char *, void *))
-{
-	FILE *f;
-	int ret = 0;
-
-	if (!handler)
-		return -1;
-
-	f = fopen(path, "r");
-
-	if (!f) {
-		fprintf(stderr, "%s: failed to open '%s': %m\n",
-			__func__, path);
-		return -1;
-	}
-
-	while (fgets(buffer, BUFSIZE, f)) {
-		ret = handler(buffer, data);
-		if (ret)
-			break;
-	}
-
-	fclose(f);
-
-	return ret;
-}
-
-static int idlestat_store(const char *path, double start_ts, double end_ts,
-				struct init_pstates *initp,
-				struct cpu_topology *cpu_topo)
+/*
+ * Create an idlestat trace file and write the part preceding the events.
+ */
+static FILE *idlestat_store_begin(const char *path, uint64_t start_ts,
+				  struct init_pstates *initp,
+				  struct cpu_topology *cpu_topo)
 {
 	FILE *f;
 	int ret;
 
 	ret = sysconf(_SC_NPROCESSORS_CONF);
 	if (ret < 0)
-		return -1;
+		return NULL;
 
 	if (initp)
 		assert(ret == initp->nrcpus);
@@ -1275,7 +1937,7 @@ static int idlestat_store(const char *path, double start_ts, double end_ts,
 	if (!f) {
 		fprintf(stderr, "%s: failed to open '%s': %m\n",
 			__func__, path);
-		return -1;
+		return NULL;
 	}
 
 	fprintf(f, "idlestat version = %s\n", IDLESTAT_VERSION);
@@ -1291,20 +1953,63 @@ static int idlestat_store(const char *path, double start_ts, double end_ts,
 	if (initp)
 		output_pstates(f, initp, initp->nrcpus, cpu_topo, start_ts);
 
-	ret = idlestat_file_for_each_line(TRACE_FILE, f, store_line);
+	return f;
+}
 
+/*
+ * Write the part of an idlestat trace file following the events and
+ * close it.
+ */
+static int idlestat_store_end(FILE *f, uint64_t end_ts,
+			      struct init_pstates *initp,
+			      struct cpu_topology *cpu_topo)
+{
 	/* emit final pstate changes */
 	if (initp)
 		output_pstates(f, NULL, initp->nrcpus, cpu_topo, end_ts);
 
-	fclose(f);
+	return fclose(f) ? -1 : 0;
+}
 
-	return ret;
+static int store_events(const char *data, size_t len, void *arg)
+{
+	FILE *f = arg;
+
+	if (fwrite(data, 1, len, f) != len) {
+		fprintf(stderr, "%s: failed to write trace: %m\n", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Write an idlestat trace file without events, as the header of a raw
+ * capture directory.
+ */
+static int idlestat_store(const char *path, uint64_t start_ts,
+			  uint64_t end_ts, struct init_pstates *initp,
+			  struct cpu_topology *cpu_topo)
+{
+	FILE *f;
+
+	f = idlestat_store_begin(path, start_ts, initp, cpu_topo);
+	if (!f)
+		return -1;
+
+	return idlestat_store_end(f, end_ts, initp, cpu_topo);
 }
 
-static int idlestat_wake_all(void)
+/*
+ * With @sync, a clock synchronization mark is written to the trace on each
+ * cpu visited, the import corrects the skew of their trace clocks with.
+ * Only the start of a capture is synchronized, the skew is taken as
+ * constant over the capture. If the cpus share the trace clock, a single
+ * mark tells the import there is nothing to correct.
+ */
+static int idlestat_wake_all(int sync)
 {
-	int rcpu, i, ret;
+	int rcpu, i, ret, fd = -1;
 	cpu_set_t cpumask;
 	cpu_set_t original_cpumask;
 
@@ -1316,6 +2021,20 @@ static int idlestat_wake_all(void)
 	if (rcpu < 0)
 		return -1;
 
+	if (sync) {
+		fd = idlestat_open_trace_marker();
+		if (fd < 0)
+			goto err;
+		if (idlestat_trace_clock_synced()) {
+			if (idlestat_clock_synced_mark(fd))
+				goto err;
+			close(fd);
+			fd = -1;
+		} else if (idlestat_clock_sync_mark(fd)) {
+			goto err;
+		}
+	}
+
 	/* Keep track of the CPUs we will run on */
 	sched_getaffinity(0, sizeof(original_cpumask), &original_cpumask);
 
@@ -1333,12 +2052,25 @@ static int idlestat_wake_all(void)
 		CPU_SET(i, &cpumask);
 
 		sched_setaffinity(0, sizeof(cpumask), &cpumask);
+
+		if (fd >= 0 && idlestat_clock_sync_mark(fd)) {
+			sched_setaffinity(0, sizeof(original_cpumask),
+					  &original_cpumask);
+			goto err;
+		}
 	}
 
 	/* Enable all the CPUs of the original mask */
 	sched_setaffinity(0, sizeof(original_cpumask), &original_cpumask);
 
+	if (fd >= 0)
+		close(fd);
 	return 0;
+
+err:
+	if (fd >= 0)
+		close(fd);
+	return -1;
 }
 
 static volatile sig_atomic_t sigalrm = 0;
@@ -1404,17 +2136,113 @@ static int execute(int argc, char *argv[], char *const envp[],
 	return -1;
 }
 
-int main(int argc, char *argv[], char *const envp[])
+/*
+ * Capture with perf events, whose samples are either read by idlestat
+ * or, with the bpf backend, aggregated in the kernel. The ftrace state
+ * is left alone, so unlike the other backends there is nothing to save
+ * and restore around it.
+ */
+static struct cpuidle_datas *idlestat_perf_trace(int argc, char *argv[],
+						 char *const envp[],
+						 struct program_options *options)
 {
 	struct cpuidle_datas *datas;
+	struct cpu_topology *cpu_topo;
+	struct init_pstates *initp;
+	struct perf_capture *pc = NULL;
+	struct bpf_capture *bc = NULL;
+	int ret;
+
+	cpu_topo = read_sysfs_cpu_topo();
+	if (is_err(cpu_topo)) {
+		fprintf(stderr, "Failed to read CPU topology info from"
+			" sysfs.\n");
+		return ptrerror(NULL);
+	}
+
+	if (calculate_buffer_parameters(options->duration, &options->tbs)) {
+		release_cpu_topo_info(cpu_topo);
+		return ptrerror(NULL);
+	}
+
+	initp = build_init_pstates(cpu_topo);
+	release_cpu_topo_info(cpu_topo);
+
+	if (options->backend == BPF_BACKEND)
+		bc = bpf_capture_start(TRACE_PATH, initp);
+	else
+		pc = perf_capture_start(TRACE_PATH,
+					options->tbs.percpu_buffer_size,
+					options->tbs.poll_interval <
+					options->duration ?
+					options->tbs.poll_interval : 0);
+	if (is_err(pc) || is_err(bc)) {
+		release_init_pstates(initp);
+		return ptrerror(NULL);
+	}
+
+	/* As for ftrace, do not begin or end with cpus idle */
+	ret = idlestat_wake_all(0);
+	if (!ret)
+		ret = execute(argc, argv, envp, options);
+	if (!ret)
+		ret = idlestat_wake_all(0);
+
+	datas = bc ? bpf_capture_stop(bc) : perf_capture_stop(pc, initp);
+	release_init_pstates(initp);
+
+	if (ret && !is_err(datas)) {
+		raw_release_datas(datas);
+		datas = ptrerror(NULL);
+	}
+
+	return datas;
+}
+
+/*
+ * Report the cpuidle and cpufreq statistics of sysfs over the run.
+ * Nothing is traced and the cpus are not woken up around the run.
+ */
+static struct cpuidle_datas *idlestat_counters(int argc, char *argv[],
+					       char *const envp[],
+					       struct program_options *options)
+{
+	struct cpuidle_datas *datas;
+	struct counters *counters;
+	int ret;
+
+	counters = counters_start(options->tbs.poll_interval);
+	if (is_err(counters))
+		return ptrerror(NULL);
+
+	ret = execute(argc, argv, envp, options);
+
+	datas = counters_stop(counters);
+	if (ret && !is_err(datas)) {
+		raw_release_datas(datas);
+		datas = ptrerror(NULL);
+	}
+
+	return datas;
+}
+
+int main(int argc, char *argv[], char *const envp[])
+{
+	struct cpuidle_datas *datas = NULL;
 	struct cpuidle_datas *baseline;
 	struct program_options options;
-	int args;
-	double start_ts = 0, end_ts = 0;
+	int args, ret;
+	uint64_t start_ts = 0, end_ts = 0;
 	struct init_pstates *initp = NULL;
 	struct report_ops *output_handler = NULL;
 	struct cpu_topology *cpu_topo = NULL;
 	struct trace_options *saved_trace_options = NULL;
+	struct raw_capture *capture = NULL;
+	char capture_header[PATH_MAX];
+	struct trace_drain *drain = NULL;
+	struct live_trace *live = NULL;
+	unsigned int interval;
+	FILE *trace_file = NULL;
 	void *report_data = NULL;
 
 	args = getoptions(argc, argv, &options);
@@ -1423,7 +2251,7 @@ int main(int argc, char *argv[], char *const envp[])
 
 	/* Tracing requires manipulation of some files only accessible
 	 * to root */
-	if ((options.mode == TRACE) && getuid()) {
+	if ((options.mode == TRACE) && !options.counters && getuid()) {
 		fprintf(stderr, "must be root to run traces\n");
 		return 1;
 	}
@@ -1451,8 +2279,23 @@ int main(int argc, char *argv[], char *const envp[])
 		return 1;
 	}
 
+	set_analysis_jobs(options.jobs);
+	set_reorder_window(options.reorder_window);
+
 	/* Acquisition time specified means we will get the traces */
-	if ((options.mode == TRACE) || args < argc) {
+	if (options.mode == TRACE && options.counters) {
+		datas = idlestat_counters(argc - args, &argv[args], envp,
+					  &options);
+		if (is_err(datas))
+			return 1;
+	} else if (options.mode == TRACE &&
+		   (options.backend == PERF_BACKEND ||
+		    options.backend == BPF_BACKEND)) {
+		datas = idlestat_perf_trace(argc - args, &argv[args], envp,
+					    &options);
+		if (is_err(datas))
+			return 1;
+	} else if ((options.mode == TRACE) || args < argc) {
 		/* Read cpu topology info from sysfs */
 		cpu_topo = read_sysfs_cpu_topo();
 		if (is_err(cpu_topo)) {
@@ -1474,14 +2317,30 @@ int main(int argc, char *argv[], char *const envp[])
 
 		/*
 		 * Calculate/verify buffer size and polling trace data
-		 * interval. The interval or may may not be used to
-		 * transfer data from kernel trace buffer to some
-		 * storage media. It is needed for long eventful traces,
-		 * but is not preferred. If the user does not specify
-		 * the values, we will calculate reasonable defaults.
+		 * interval. The trace is moved from the kernel trace
+		 * buffer to the trace file every interval, so the buffer
+		 * only has to hold the events of one interval. Draining
+		 * wakes a cpu up, so it is not preferred for short traces.
+		 * If the user does not specify the values, we will
+		 * calculate reasonable defaults.
 		 */
+		if (options.live && !options.tbs.poll_interval)
+			options.tbs.poll_interval = LIVE_POLL_INTERVAL;
+
+		/* Without a capture directory, the raw ring buffers are only
+		 * read once tracing stopped, so they must hold it all */
+		if (options.backend == RAW_BACKEND && !options.filename) {
+			if (options.tbs.poll_interval &&
+			    options.tbs.poll_interval < options.duration)
+				fprintf(stderr, "--backend raw: the buffers are "
+					"read once the capture ends without "
+					"-f, -I is ignored\n");
+			options.tbs.poll_interval = options.duration;
+		}
 		if (calculate_buffer_parameters(options.duration, &options.tbs))
 			return 1;
+		interval = options.tbs.poll_interval < options.duration ?
+			options.tbs.poll_interval : 0;
 
 		/* Initialize the traces for cpu_idle and increase the
 		 * buffer size to let 'idlestat' to possibly sleep instead
@@ -1490,6 +2349,15 @@ int main(int argc, char *argv[], char *const envp[])
 		if (idlestat_init_trace(options.tbs.percpu_buffer_size))
 			goto err_restore_trace_options;
 
+		/* Size the buffer of each cpu from its own event rate */
+		if (options.calibrate && idlestat_calibrate_trace(&options.tbs))
+			goto err_restore_trace_options;
+
+		/* Selecting the clock resets the buffers, flushed below */
+		if (options.trace_clock &&
+		    idlestat_set_trace_clock(options.trace_clock))
+			goto err_restore_trace_options;
+
 		/* Remove all the previous traces */
 		if (idlestat_flush_trace())
 			goto err_restore_trace_options;
@@ -1500,6 +2368,41 @@ int main(int argc, char *argv[], char *const envp[])
 
 		initp = build_init_pstates(cpu_topo);
 
+		/* Save the raw ring buffers to the trace directory */
+		if (options.backend == RAW_BACKEND && options.filename) {
+			snprintf(capture_header, sizeof(capture_header),
+				 "%s/" RAW_CAPTURE_HEADER, options.filename);
+			capture = raw_capture_start(TRACE_PATH,
+						    options.filename,
+						    options.tbs.poll_interval);
+			if (is_err(capture)) {
+				capture = NULL;
+				goto err_restore_trace_options;
+			}
+		}
+
+		/* Analyze or copy the events while they are recorded */
+		if (options.live) {
+			live = live_trace_start(initp, start_ts, interval);
+			if (is_err(live)) {
+				live = NULL;
+				goto err_restore_trace_options;
+			}
+		} else if (options.backend == TEXT_BACKEND) {
+			trace_file = idlestat_store_begin(options.filename,
+							  start_ts, initp,
+							  cpu_topo);
+			if (!trace_file)
+				goto err_restore_trace_options;
+
+			drain = idlestat_drain_start(interval, store_events,
+						     trace_file);
+			if (is_err(drain)) {
+				drain = NULL;
+				goto err_restore_trace_options;
+			}
+		}
+
 		/* Start the recording */
 		if (idlestat_trace_enable(true))
 			goto err_restore_trace_options;
@@ -1507,7 +2410,7 @@ int main(int argc, char *argv[], char *const envp[])
 		/* We want to prevent to begin the acquisition with a cpu in
 		 * idle state because we won't be able later to close the
 		 * state and to determine which state it was. */
-		if (idlestat_wake_all())
+		if (idlestat_wake_all(1))
 			goto err_restore_trace_options;
 
 		/* Execute the command or wait a specified delay */
@@ -1515,7 +2418,7 @@ int main(int argc, char *argv[], char *const envp[])
 			goto err_restore_trace_options;
 
 		/* Wake up all cpus again to account for last idle state */
-		if (idlestat_wake_all())
+		if (idlestat_wake_all(0))
 			goto err_restore_trace_options;
 
 		/* Stop tracing */
@@ -1526,14 +2429,43 @@ int main(int argc, char *argv[], char *const envp[])
 		if (get_trace_ts(&end_ts) == -1)
 			goto err_restore_trace_options;
 
+		/* The analysis goes on, but the user must know it is
+		 * missing events */
+		idlestat_check_trace_loss();
+
 		/* At this point we should have some spurious wake up
 		 * at the beginning of the traces and at the end (wake
 		 * up all cpus and timer expiration for the timer
 		 * acquisition). We assume these will be lost in the number
 		 * of other traces and could be negligible. */
-		if (idlestat_store(options.filename, start_ts, end_ts,
-			initp, cpu_topo))
-			goto err_restore_trace_options;
+		if (capture) {
+			ret = raw_capture_stop(capture);
+			capture = NULL;
+			if (ret)
+				goto err_restore_trace_options;
+			if (idlestat_store(capture_header, start_ts, end_ts,
+					   initp, cpu_topo))
+				goto err_restore_trace_options;
+		} else if (live) {
+			datas = live_trace_stop(live, end_ts);
+			live = NULL;
+			if (is_err(datas))
+				goto err_restore_trace_options;
+		} else if (drain) {
+			ret = idlestat_drain_stop(drain);
+			drain = NULL;
+			if (idlestat_store_end(trace_file, end_ts, initp,
+					       cpu_topo))
+				ret = -1;
+			trace_file = NULL;
+			if (ret)
+				goto err_restore_trace_options;
+		} else {
+			datas = raw_trace_capture(TRACE_PATH, start_ts, end_ts,
+						  initp);
+			if (is_err(datas))
+				goto err_restore_trace_options;
+		}
 
 		/* Restore original kernel ftrace options */
 		if (idlestat_restore_trace_options(saved_trace_options))
@@ -1546,7 +2478,8 @@ int main(int argc, char *argv[], char *const envp[])
 	}
 
 	/* Load the idle states information */
-	datas = idlestat_load(options.filename);
+	if (!datas)
+		datas = idlestat_load(options.filename);
 
 	if (is_err(datas))
 		return 1;
@@ -1597,6 +2530,7 @@ int main(int argc, char *argv[], char *const envp[])
 
 	release_init_pstates(initp);
 	release_datas(datas);
+	release_interned_strings();
 
 	if (output_handler->release_report_data)
 		output_handler->release_report_data(report_data);
@@ -1604,6 +2538,26 @@ int main(int argc, char *argv[], char *const envp[])
 	return 0;
 
  err_restore_trace_options:
+	/* Stop saving the ring buffers, if not done yet */
+	if (capture) {
+		idlestat_trace_enable(false);
+		raw_capture_stop(capture);
+	}
+
+	/* Likewise for the copy or analysis of the trace */
+	if (live) {
+		idlestat_trace_enable(false);
+		datas = live_trace_stop(live, 0);
+		if (!is_err(datas))
+			release_datas(datas);
+	}
+	if (drain) {
+		idlestat_trace_enable(false);
+		idlestat_drain_stop(drain);
+	}
+	if (trace_file)
+		fclose(trace_file);
+
 	/* Restore original kernel ftrace options */
 	idlestat_restore_trace_options(saved_trace_options);
 	return 1;
@@ -28,13 +28,30 @@
 #ifndef __IDLESTAT_H
 #define __IDLESTAT_H
 
+#include <stdint.h>
+
+#include "arena.h"
+
 #define BUFSIZE 256
 #define NAMELEN 16
 #define MAXCSTATE 16
 #define MAXPSTATE 16
 #define MAX(A, B) (A > B ? A : B)
 #define MIN(A, B) (A < B ? A : B)
-#define AVG(A, B, I) ((A) + ((B - A) / (I)))
+
+/*
+ * Timestamps and durations are kept in integer nanoseconds and only
+ * converted to (floating point) microseconds by the reports.
+ */
+#define NSEC_PER_USEC 1000
+#define USEC_PER_SEC 1000000
+#define NSEC_PER_SEC 1000000000ULL
+#define TIME_MAX UINT64_MAX
+#define NSEC_TO_USEC(ns) ((double)(ns) / NSEC_PER_USEC)
+#define NSEC_TO_SEC(ns) ((double)(ns) / NSEC_PER_SEC)
+#define AVG_TIME_USEC(duration, count) \
+	((count) ? NSEC_TO_USEC(duration) / (count) : 0.)
+#define MIN_TIME_USEC(min) ((min) == TIME_MAX ? 0. : NSEC_TO_USEC(min))
 
 #define IRQ_WAKEUP_UNIT_NAME "cpu"
 
@@ -48,27 +65,27 @@
 	"/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_cur_freq"
 
 struct cpuidle_data {
-	double begin;
-	double end;
-	double duration;
+	uint64_t begin;
+	uint64_t end;
+	uint64_t duration;
+	struct cpuidle_data *prev;	/* previous interval, if retained */
 };
 
 struct cpuidle_cstate {
 	char *name;
-	struct cpuidle_data *data;
+	struct cpuidle_data *data;	/* last interval, see cstate_begin() */
 	int nrdata;
 	int early_wakings;
 	int late_wakings;
-	double avg_time;
-	double max_time;
-	double min_time;
-	double duration;
+	uint64_t max_time;
+	uint64_t min_time;
+	uint64_t duration;
 	int target_residency; /* -1 if not available */
 };
 
 struct wakeup_irq {
 	int id;
-	char name[NAMELEN+1];
+	const char *name;	/* interned */
 	int count;
 	int early_triggers;
 	int late_triggers;
@@ -77,6 +94,9 @@ struct wakeup_irq {
 struct wakeup_info {
 	struct wakeup_irq *irqinfo;
 	int nrdata;
+	int nralloc;
+	int *index;		/* irqinfo hashed by (id, name), -1 if free */
+	unsigned int index_mask;
 };
 
 struct cpuidle_cstates {
@@ -86,37 +106,60 @@ struct cpuidle_cstates {
 	int cstate_max;
 	struct wakeup_irq *wakeirq;
 	enum {as_expected, too_long, too_short} actual_residency;
+	struct arena arena;		/* retained cpuidle_data records */
+	struct cpuidle_data open_data;	/* interval in progress, if not */
+	uint64_t first_event;	/* first event the cpu logged about itself */
+	uint64_t last_event;	/* last event the cpu logged about itself */
+	uint64_t resync_time;	/* first event after a loss at the start */
+	uint64_t gap_time;	/* time the events were lost for */
+	int nrgaps;
+	int lost;		/* events were lost since last_event */
+	int64_t clock_offset;	/* trace clock minus CLOCK_MONOTONIC */
+	int clock_marks;	/* clock synchronization marks seen */
 };
 
 extern void release_cstate_info(struct cpuidle_cstates *cstates, int nrcpus);
+extern void set_idle_record_retention(int retain);
 
 struct cpufreq_pstate {
 	int id;
 	unsigned int freq;
 	int count;
-	double min_time;
-	double max_time;
-	double avg_time;
-	double duration;
+	uint64_t min_time;
+	uint64_t max_time;
+	uint64_t duration;
 };
 
 struct cpufreq_pstates {
 	struct cpufreq_pstate *pstate;
 	int current;
 	int idle;
-	double time_enter;
-	double time_exit;
+	uint64_t time_enter;
+	uint64_t time_exit;
 	int max;
+	int size;		/* allocated pstate entries */
+	int *index;		/* pstate index hashed by freq, -1 if free */
+	unsigned int index_mask;
+	unsigned int index_bits;	/* log2 of the index size */
 };
 
 struct cpu_topology;
 
+struct event_streams;
+struct reorder_buffer;
+struct clock_hold;
+
 struct cpuidle_datas {
 	struct cpuidle_cstates *cstates;
 	struct cpufreq_pstates *pstates;
 	struct cpu_topology *topo;
 	struct cpuidle_datas *baseline;
 	int nrcpus;
+	struct event_streams *streams;	/* events queued for --jobs */
+	struct reorder_buffer *reorder;	/* events not in time order yet */
+	struct clock_hold *clock_hold;	/* events before the clock marks */
+	int clock_synced;	/* the clock offsets of the cpus are known */
+	uint64_t clock_skew;	/* largest offset from cpu 0, ns */
 };
 
 enum modes {
@@ -124,6 +167,13 @@ enum modes {
 	IMPORT
 };
 
+enum backends {
+	TEXT_BACKEND = 0,
+	RAW_BACKEND,
+	PERF_BACKEND,
+	BPF_BACKEND
+};
+
 struct trace_buffer_settings {
 	unsigned int percpu_buffer_size;
 	unsigned int poll_interval;
@@ -140,6 +190,13 @@ struct program_options {
 	int verbose;
 	char *energy_model_filename;
 	char *report_type_name;
+	int jobs;
+	int backend;
+	int live;
+	int counters;
+	int calibrate;
+	int reorder_window;
+	char *trace_clock;
 };
 
 #define IDLE_DISPLAY      0x1
@@ -188,10 +245,26 @@ struct init_pstates {
 	unsigned int *freqs;
 };
 
-extern int store_data(double time, int state, int cpu, struct cpuidle_datas *datas);
+extern int store_data(uint64_t time, int state, int cpu, struct cpuidle_datas *datas);
 extern struct cpuidle_cstates *build_cstate_info(int nrcpus);
 extern struct cpufreq_pstates *build_pstate_info(int nrcpus);
-extern int cpu_change_pstate(struct cpuidle_datas *datas, int cpu, unsigned int freq, double time);
-extern int get_wakeup_irq(struct cpuidle_datas *datas, char *buffer);
+extern void release_pstate_tables(struct cpufreq_pstates *pstates);
+extern void release_datas(struct cpuidle_datas *datas);
+extern int alloc_pstate(struct cpufreq_pstates *pstates, unsigned int freq);
+extern int seed_pstates_from_sysfs(struct cpuidle_datas *datas);
+extern int cpu_change_pstate(struct cpuidle_datas *datas, int cpu, unsigned int freq, uint64_t time);
+extern int store_wakeup_irq(int cpu, int irqid, const char *irqname,
+			    struct cpuidle_datas *datas);
+extern int add_wakeup_irq(int cpu, int irqid, const char *irqname, int count,
+			  int early, int late, struct cpuidle_datas *datas);
+extern int update_group_cstates(struct cpuidle_datas *datas, int cpu,
+				uint64_t time, int old_cstate, int new_cstate,
+				int record);
+extern int account_trace_gap(struct cpuidle_datas *datas, int ring, int cpu,
+			     int type, uint64_t time);
+extern void report_trace_coverage(struct cpuidle_datas *datas);
+extern int update_group_pstates(struct cpuidle_datas *datas, int cpu,
+				uint64_t time, unsigned int core_freq,
+				unsigned int cluster_freq, int composite);
 
 #endif
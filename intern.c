@@ -0,0 +1,132 @@
+/*
+ *  intern.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "intern.h"
+#include "utils.h"
+
+#define INTERN_MIN_SLOTS 256
+
+struct interned {
+	uint32_t hash;
+	size_t len;
+	char str[];
+};
+
+static struct {
+	struct arena arena;
+	struct interned **slots;	/* open addressed, NULL if free */
+	unsigned int mask;
+	unsigned int count;
+} pool;
+
+/* FNV-1a */
+static uint32_t hash_string(const char *str, size_t len)
+{
+	uint32_t h = 2166136261U;
+
+	while (len--) {
+		h ^= (unsigned char)*str++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static int grow_pool(void)
+{
+	struct interned **slots;
+	unsigned int size, i, h;
+
+	size = pool.slots ? (pool.mask + 1) * 2 : INTERN_MIN_SLOTS;
+	slots = calloc(size, sizeof(*slots));
+	if (!slots)
+		return error(__func__);
+
+	for (i = 0; pool.slots && i <= pool.mask; i++) {
+		if (!pool.slots[i])
+			continue;
+		h = pool.slots[i]->hash & (size - 1);
+		while (slots[h])
+			h = (h + 1) & (size - 1);
+		slots[h] = pool.slots[i];
+	}
+
+	free(pool.slots);
+	pool.slots = slots;
+	pool.mask = size - 1;
+
+	return 0;
+}
+
+/**
+ * intern_string - get the unique copy of a string
+ * @str: characters of the string, need not be NUL terminated
+ * @len: number of characters
+ *
+ * @return: the NUL terminated interned string (success) or NULL (error)
+ */
+const char *intern_string(const char *str, size_t len)
+{
+	struct interned *s;
+	uint32_t hash;
+	unsigned int h;
+
+	/* Keep the table at most half full */
+	if (2 * (pool.count + 1) > pool.mask + 1 && grow_pool())
+		return NULL;
+
+	hash = hash_string(str, len);
+	for (h = hash & pool.mask; (s = pool.slots[h]);
+	     h = (h + 1) & pool.mask) {
+		if (s->hash == hash && s->len == len &&
+		    !memcmp(s->str, str, len))
+			return s->str;
+	}
+
+	s = arena_alloc(&pool.arena, sizeof(*s) + len + 1);
+	if (is_err(s))
+		return NULL;
+
+	s->hash = hash;
+	s->len = len;
+	memcpy(s->str, str, len);
+	s->str[len] = '\0';
+
+	pool.slots[h] = s;
+	pool.count++;
+
+	return s->str;
+}
+
+/**
+ * release_interned_strings - free all interned strings
+ */
+void release_interned_strings(void)
+{
+	arena_release(&pool.arena);
+	free(pool.slots);
+	memset(&pool, 0, sizeof(pool));
+}
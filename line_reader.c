@@ -0,0 +1,317 @@
+/*
+ *  line_reader.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "line_reader.h"
+#include "utils.h"
+
+#define LINE_READER_CHUNK (1 << 20)
+
+static int line_reader_fill(struct line_reader *r)
+{
+	size_t left = r->end - r->pos;
+	ssize_t n;
+	char *tmp;
+
+	/* Keep the partial line, grow the buffer if it is all we have */
+	if (left == r->buf_size) {
+		tmp = realloc(r->buf, r->buf_size * 2);
+		if (!tmp)
+			return error(__func__);
+		r->pos = tmp + (r->pos - r->buf);
+		r->buf = tmp;
+		r->buf_size *= 2;
+	}
+	memmove(r->buf, r->pos, left);
+	r->pos = r->buf;
+	r->line = NULL;
+	r->end = r->buf + left;
+
+	do {
+		n = read(r->fd, r->buf + left, r->buf_size - left);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return error(__func__);
+
+	if (n == 0)
+		r->eof = 1;
+
+	r->end += n;
+	return 0;
+}
+
+static struct line_reader *line_reader_alloc(int fd)
+{
+	struct line_reader *r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return ptrerror(__func__);
+
+	r->fd = fd;
+	return r;
+}
+
+static int line_reader_alloc_buffer(struct line_reader *r)
+{
+	r->buf_size = LINE_READER_CHUNK;
+	r->buf = malloc(r->buf_size);
+	if (!r->buf)
+		return error(__func__);
+
+	r->pos = r->end = r->buf;
+	return 0;
+}
+
+/**
+ * line_reader_fdopen - start reading lines from a trace file or stream
+ * @fd: descriptor of the trace, closed by line_reader_close()
+ *
+ * Reading starts at the current offset of @fd. A regular file is mapped.
+ * Other inputs, such as pipes, and regular files which cannot be mapped,
+ * e.g. ones larger than the address space, are read in large chunks.
+ *
+ * @return: the reader (success) or ptrerror() (error)
+ */
+struct line_reader *line_reader_fdopen(int fd)
+{
+	struct line_reader *r;
+	struct stat st;
+	off_t offset;
+
+	if (fstat(fd, &st)) {
+		error(__func__);
+		goto out_close;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "%s: not a trace file\n", __func__);
+		goto out_close;
+	}
+
+	r = line_reader_alloc(fd);
+	if (is_err(r))
+		goto out_close;
+
+	offset = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+	if (offset >= 0 && offset < st.st_size) {
+		r->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			      fd, 0);
+		if (r->map != MAP_FAILED) {
+			r->map_len = st.st_size;
+			madvise(r->map, r->map_len, MADV_SEQUENTIAL);
+			r->pos = r->map + offset;
+			r->end = r->map + r->map_len;
+			return r;
+		}
+		r->map = NULL;
+	}
+
+	if (line_reader_alloc_buffer(r)) {
+		free(r);
+		goto out_close;
+	}
+
+	return r;
+
+out_close:
+	close(fd);
+	return ptrerror(NULL);
+}
+
+/**
+ * line_reader_open - start reading lines of a trace
+ * @path: the trace file, a pipe, a FIFO...
+ *
+ * @return: the reader (success) or ptrerror() (error)
+ */
+struct line_reader *line_reader_open(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
+			path);
+		return ptrerror(NULL);
+	}
+
+	return line_reader_fdopen(fd);
+}
+
+/**
+ * line_reader_next - get the next line
+ * @r: the reader
+ * @line: set to the start of the line, which is not NUL terminated
+ * @len: set to the length of the line including its newline, if any
+ *
+ * The line stays valid until the next call.
+ *
+ * @return: 1 if a line was returned, 0 at end of file, -1 on error
+ */
+int line_reader_next(struct line_reader *r, const char **line, size_t *len)
+{
+	const char *nl;
+
+	for (;;) {
+		nl = r->pos < r->end ?
+			memchr(r->pos, '\n', r->end - r->pos) : NULL;
+		if (nl) {
+			r->line = r->pos;
+			*line = r->pos;
+			*len = nl + 1 - r->pos;
+			r->pos = nl + 1;
+			return 1;
+		}
+
+		if (r->map || r->eof) {
+			if (r->pos == r->end)
+				return 0;
+
+			/* Last line is not terminated */
+			r->line = r->pos;
+			*line = r->pos;
+			*len = r->end - r->pos;
+			r->pos = r->end;
+			return 1;
+		}
+
+		if (line_reader_fill(r))
+			return -1;
+	}
+}
+
+/**
+ * line_reader_unget - make the line last returned the next one again
+ *
+ * E.g. to leave the first event line, read along with the header of a
+ * trace, to the loop over the events. Only valid right after the line
+ * was returned.
+ */
+void line_reader_unget(struct line_reader *r)
+{
+	if (r->line)
+		r->pos = r->line;
+}
+
+/**
+ * line_reader_peek - get the next line without moving past it
+ *
+ * Same as line_reader_next(), except that the next call returns the
+ * same line again.
+ */
+int line_reader_peek(struct line_reader *r, const char **line, size_t *len)
+{
+	int ret;
+
+	ret = line_reader_next(r, line, len);
+	if (ret > 0)
+		line_reader_unget(r);
+
+	return ret;
+}
+
+/**
+ * line_reader_gets - copy the next line, like fgets() but whole lines
+ * @r: the reader
+ * @buf: destination, NUL terminated
+ * @size: size of @buf
+ *
+ * For the header lines of a trace. A line longer than @buf is cut, the
+ * rest of it is skipped rather than returned as a next line.
+ *
+ * @return: @buf, or NULL at end of file or on error
+ */
+char *line_reader_gets(struct line_reader *r, char *buf, size_t size)
+{
+	const char *line;
+	size_t len;
+
+	if (line_reader_next(r, &line, &len) <= 0)
+		return NULL;
+
+	if (len >= size)
+		len = size - 1;
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+
+	return buf;
+}
+
+/**
+ * line_reader_read - read raw bytes, starting with any already buffered
+ * @r: the reader
+ * @buf: destination
+ * @size: size of @buf
+ *
+ * Lets a caller take over reading from where line_reader_next() stopped.
+ *
+ * @return: number of bytes read, 0 at end of file, -1 on error
+ */
+ssize_t line_reader_read(struct line_reader *r, char *buf, size_t size)
+{
+	size_t left = r->end - r->pos;
+	ssize_t n;
+
+	if (left) {
+		if (left > size)
+			left = size;
+		memcpy(buf, r->pos, left);
+		r->pos += left;
+		return left;
+	}
+
+	if (r->map || r->eof)
+		return 0;
+
+	do {
+		n = read(r->fd, buf, size);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return error(__func__);
+
+	if (n == 0)
+		r->eof = 1;
+
+	return n;
+}
+
+void line_reader_close(struct line_reader *r)
+{
+	if (!r)
+		return;
+
+	if (r->map)
+		munmap(r->map, r->map_len);
+	free(r->buf);
+	close(r->fd);
+	free(r);
+}
@@ -0,0 +1,57 @@
+/*
+ *  line_reader.h
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef __LINE_READER_H
+#define __LINE_READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Iterates over the lines of a trace without copying them. A regular file
+ * is mapped in memory. Pipes, and files which cannot be mapped, are read
+ * in large chunks into a buffer that grows to fit the longest line.
+ */
+struct line_reader {
+	int fd;
+	char *map;
+	size_t map_len;
+	char *buf;
+	size_t buf_size;
+	const char *pos;
+	const char *end;
+	const char *line;	/* last line returned */
+	int eof;
+};
+
+extern struct line_reader *line_reader_open(const char *path);
+extern struct line_reader *line_reader_fdopen(int fd);
+extern int line_reader_next(struct line_reader *r, const char **line,
+			    size_t *len);
+extern int line_reader_peek(struct line_reader *r, const char **line,
+			    size_t *len);
+extern void line_reader_unget(struct line_reader *r);
+extern char *line_reader_gets(struct line_reader *r, char *buf, size_t size);
+extern ssize_t line_reader_read(struct line_reader *r, char *buf,
+				size_t size);
+extern void line_reader_close(struct line_reader *r);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ *  live.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * Live analysis of a capture: the events are decoded from trace_pipe
+ * and accounted while the workload runs, without a trace file.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+#include "idlestat.h"
+#include "live.h"
+#include "reorder.h"
+#include "topology.h"
+#include "trace.h"
+#include "trace_event.h"
+#include "trace_ops.h"
+#include "trace_raw.h"
+#include "utils.h"
+
+struct live_trace {
+	struct cpuidle_datas *datas;
+	struct init_pstates *initp;
+	struct trace_drain *drain;
+	uint64_t begin;
+	uint64_t end;
+	size_t start;
+	size_t count;
+	char *partial;		/* line cut by the end of a read */
+	size_t partial_len;
+};
+
+static void live_store_line(struct live_trace *lt, const char *line,
+			    size_t len)
+{
+	if (load_text_data_line(line, len, lt->datas, &lt->begin, &lt->end,
+				&lt->start) != -1)
+		lt->count++;
+}
+
+static int live_keep_partial(struct live_trace *lt, const char *data,
+			     size_t len)
+{
+	char *partial;
+
+	partial = realloc(lt->partial, lt->partial_len + len);
+	if (!partial)
+		return error(__func__);
+
+	memcpy(partial + lt->partial_len, data, len);
+	lt->partial = partial;
+	lt->partial_len += len;
+
+	return 0;
+}
+
+/* Store callback of the drain, runs on the drain thread */
+static int live_store(const char *data, size_t len, void *arg)
+{
+	struct live_trace *lt = arg;
+	const char *line = data, *end = data + len, *next;
+
+	while (line < end) {
+		next = memchr(line, '\n', end - line);
+		if (!next)
+			return live_keep_partial(lt, line, end - line);
+		next++;
+
+		if (lt->partial_len) {
+			if (live_keep_partial(lt, line, next - line))
+				return -1;
+			live_store_line(lt, lt->partial, lt->partial_len);
+			lt->partial_len = 0;
+		} else {
+			live_store_line(lt, line, next - line);
+		}
+
+		line = next;
+	}
+
+	return 0;
+}
+
+/*
+ * Account the P-states the cpus were in when the capture started, or
+ * close them when it ended, as idlestat_store() does in the trace file.
+ */
+static void live_pstate_events(struct live_trace *lt, uint64_t ts,
+			       int last)
+{
+	struct cpuidle_datas *datas = lt->datas;
+	struct trace_event ev;
+	int cpu;
+
+	if (!lt->initp)
+		return;
+
+	for (cpu = 0; cpu < lt->initp->nrcpus && cpu < datas->nrcpus; cpu++) {
+		if (!cpu_is_online(datas->topo, cpu))
+			continue;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.time = ts;
+		ev.type = TRACE_EVENT_CPU_FREQUENCY;
+		ev.cpu = 0;	/* the time was read on cpu 0 */
+		ev.cpu_id = cpu;
+		ev.value = last ? 0 : lt->initp->freqs[cpu];
+
+		if (load_trace_event(&ev, datas, &lt->begin, &lt->end,
+				     &lt->start) != -1)
+			lt->count++;
+	}
+}
+
+/**
+ * live_trace_start - start analyzing the trace as it is recorded
+ * @initp: P-states of the cpus when the capture started, or NULL
+ * @start_ts: time the capture started
+ * @interval: seconds between drains of trace_pipe, 0 for none
+ *
+ * The statistics are only to be used once live_trace_stop() returns
+ * them.
+ *
+ * @return: the live analysis (success) or ptrerror() (error)
+ */
+struct live_trace *live_trace_start(struct init_pstates *initp,
+				    uint64_t start_ts, unsigned int interval)
+{
+	struct live_trace *lt;
+
+	lt = calloc(1, sizeof(*lt));
+	if (!lt)
+		return ptrerror(__func__);
+
+	lt->datas = raw_capture_datas();
+	if (is_err(lt->datas)) {
+		free(lt);
+		return ptrerror(NULL);
+	}
+
+	if (setup_topo_states(lt->datas) || setup_event_streams(lt->datas) ||
+	    setup_reorder_buffer(lt->datas))
+		goto out_free;
+
+	lt->initp = initp;
+	lt->start = 1;
+	live_pstate_events(lt, start_ts, 0);
+
+	lt->drain = idlestat_drain_start(interval, live_store, lt);
+	if (is_err(lt->drain))
+		goto out_free;
+
+	return lt;
+
+out_free:
+	release_datas(lt->datas);
+	free(lt);
+	return ptrerror(NULL);
+}
+
+/**
+ * live_trace_stop - account what is left of the trace and finish
+ * @lt: the live analysis, freed
+ * @end_ts: time the capture ended
+ *
+ * To be called once tracing is off.
+ *
+ * @return: per-trace statistics, to be freed with release_datas()
+ * (success) or ptrerror() (error, they are freed)
+ */
+struct cpuidle_datas *live_trace_stop(struct live_trace *lt,
+				      uint64_t end_ts)
+{
+	struct cpuidle_datas *datas = lt->datas;
+	size_t failed;
+	int ret;
+
+	ret = idlestat_drain_stop(lt->drain);
+
+	/* A last line without its newline */
+	if (lt->partial_len)
+		live_store_line(lt, lt->partial, lt->partial_len);
+
+	live_pstate_events(lt, end_ts, 1);
+
+	lt->count -= flush_trace_events(datas, &lt->begin, &lt->end,
+					&lt->start);
+
+	if (analyze_event_streams(datas, &failed))
+		ret = -1;
+	lt->count -= failed;
+
+	fprintf(stderr, "Log is %lf secs long with %zu events\n",
+		NSEC_TO_SEC(lt->end - lt->begin), lt->count);
+	report_trace_coverage(datas);
+
+	free(lt->partial);
+	free(lt);
+
+	if (ret) {
+		release_datas(datas);
+		return ptrerror(NULL);
+	}
+
+	return datas;
+}
@@ -0,0 +1,40 @@
+/*
+ *  live.h
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef __LIVE_H
+#define __LIVE_H
+
+#include <stdint.h>
+
+/* Seconds between drains of trace_pipe, unless -I says otherwise */
+#define LIVE_POLL_INTERVAL 1
+
+struct cpuidle_datas;
+struct init_pstates;
+struct live_trace;
+
+extern struct live_trace *live_trace_start(struct init_pstates *initp,
+					   uint64_t start_ts,
+					   unsigned int interval);
+extern struct cpuidle_datas *live_trace_stop(struct live_trace *lt,
+					     uint64_t end_ts);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ *  reorder.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * Bounded reordering of the events of a trace before their analysis,
+ * see reorder.h.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "idlestat.h"
+#include "reorder.h"
+#include "trace_event.h"
+#include "utils.h"
+
+#define REORDER_MIN_EVENTS 256
+
+struct reorder_event {
+	struct saved_trace_event saved;
+	uint64_t seq;		/* position in the trace */
+};
+
+/* Events of a cpu in time order, in a ring of a power of two entries */
+struct reorder_queue {
+	struct reorder_event *events;
+	size_t first;
+	size_t nr;
+	size_t max;
+	int pos;		/* in the heap, -1 if the queue is empty */
+};
+
+struct reorder_buffer {
+	struct reorder_queue *queues;
+	int nrqueues;
+	int *heap;		/* non empty queues by time of their first event */
+	int nrheap;
+	uint64_t window;	/* ns */
+	uint64_t seq;
+	uint64_t last_time;	/* latest event queued */
+	uint64_t released_time;	/* latest event released */
+	int released;
+	size_t late;		/* events out of the window */
+	size_t failed;		/* events released which fn failed on */
+	struct trace_event out;	/* event released last */
+};
+
+static unsigned int reorder_window = REORDER_WINDOW_USEC;
+
+/**
+ * set_reorder_window - set how far out of order events may arrive
+ * @usec: the window, 0 to analyze the events as they arrive
+ */
+void set_reorder_window(unsigned int usec)
+{
+	reorder_window = usec;
+}
+
+/**
+ * setup_reorder_buffer - prepare @datas to reorder its events if enabled
+ *
+ * Once set up, the events given to load_trace_event() are reordered. The
+ * loaders release the last ones with flush_reorder_buffer().
+ *
+ * @return: 0 on success, -1 on error
+ */
+int setup_reorder_buffer(struct cpuidle_datas *datas)
+{
+	struct reorder_buffer *rb;
+	int i;
+
+	if (!reorder_window)
+		return 0;
+
+	rb = calloc(1, sizeof(*rb));
+	if (!rb)
+		return error(__func__);
+
+	rb->queues = calloc(datas->nrcpus, sizeof(*rb->queues));
+	rb->heap = calloc(datas->nrcpus, sizeof(*rb->heap));
+	if (!rb->queues || !rb->heap) {
+		free(rb->queues);
+		free(rb->heap);
+		free(rb);
+		return error(__func__);
+	}
+
+	for (i = 0; i < datas->nrcpus; i++)
+		rb->queues[i].pos = -1;
+
+	rb->nrqueues = datas->nrcpus;
+	rb->window = (uint64_t)reorder_window * NSEC_PER_USEC;
+	datas->reorder = rb;
+	return 0;
+}
+
+/**
+ * widen_reorder_window - make the window at least @ns long
+ * @rb: the reorder buffer
+ * @ns: how far out of order the events are known to arrive
+ */
+void widen_reorder_window(struct reorder_buffer *rb, uint64_t ns)
+{
+	if (ns > rb->window)
+		rb->window = ns;
+}
+
+static void release_queues(struct reorder_buffer *rb)
+{
+	int i;
+
+	for (i = 0; i < rb->nrqueues; i++)
+		free(rb->queues[i].events);
+
+	free(rb->queues);
+	free(rb->heap);
+	free(rb);
+}
+
+static inline struct reorder_event *queue_event(struct reorder_queue *q,
+						size_t i)
+{
+	return &q->events[(q->first + i) & (q->max - 1)];
+}
+
+static int grow_queue(struct reorder_queue *q)
+{
+	struct reorder_event *events;
+	size_t max = q->max ? q->max * 2 : REORDER_MIN_EVENTS, i;
+
+	events = malloc(max * sizeof(*events));
+	if (!events)
+		return error(__func__);
+
+	for (i = 0; i < q->nr; i++)
+		events[i] = *queue_event(q, i);
+
+	free(q->events);
+	q->events = events;
+	q->first = 0;
+	q->max = max;
+	return 0;
+}
+
+/* Events of the same time are taken in trace order */
+static int queue_before(struct reorder_buffer *rb, int a, int b)
+{
+	struct reorder_event *ea = queue_event(&rb->queues[a], 0);
+	struct reorder_event *eb = queue_event(&rb->queues[b], 0);
+
+	return ea->saved.ev.time < eb->saved.ev.time ||
+		(ea->saved.ev.time == eb->saved.ev.time && ea->seq < eb->seq);
+}
+
+static void heap_swap(struct reorder_buffer *rb, int i, int j)
+{
+	int tmp = rb->heap[i];
+
+	rb->heap[i] = rb->heap[j];
+	rb->heap[j] = tmp;
+	rb->queues[rb->heap[i]].pos = i;
+	rb->queues[rb->heap[j]].pos = j;
+}
+
+static void heap_sift_up(struct reorder_buffer *rb, int i)
+{
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!queue_before(rb, rb->heap[i], rb->heap[parent]))
+			return;
+		heap_swap(rb, i, parent);
+		i = parent;
+	}
+}
+
+static void heap_sift_down(struct reorder_buffer *rb, int i)
+{
+	int child;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= rb->nrheap)
+			return;
+		if (child + 1 < rb->nrheap &&
+		    queue_before(rb, rb->heap[child + 1], rb->heap[child]))
+			child++;
+		if (!queue_before(rb, rb->heap[child], rb->heap[i]))
+			return;
+		heap_swap(rb, i, child);
+		i = child;
+	}
+}
+
+/*
+ * Insert an event in the queue of its cpu. The events of a cpu mostly
+ * come in order, so the place is looked for from the end.
+ */
+static int queue_insert(struct reorder_buffer *rb, int cpu,
+			struct trace_event *ev)
+{
+	struct reorder_queue *q = &rb->queues[cpu];
+	struct saved_trace_event saved;
+	size_t i;
+
+	if (q->nr == q->max && grow_queue(q))
+		return -1;
+
+	if (save_trace_event(&saved, ev))
+		return -1;
+
+	for (i = q->nr;
+	     i > 0 && queue_event(q, i - 1)->saved.ev.time > ev->time; i--)
+		*queue_event(q, i) = *queue_event(q, i - 1);
+
+	queue_event(q, i)->saved = saved;
+	queue_event(q, i)->seq = rb->seq++;
+	q->nr++;
+
+	if (q->pos == -1) {
+		q->pos = rb->nrheap;
+		rb->heap[rb->nrheap++] = cpu;
+		heap_sift_up(rb, q->pos);
+	} else if (!i) {
+		heap_sift_up(rb, q->pos);
+	}
+
+	return 0;
+}
+
+/*
+ * Take the earliest event out of the queues if it is more than the
+ * window older than the latest one, or if @flush is set.
+ */
+static struct trace_event *release_event(struct reorder_buffer *rb,
+					 int flush)
+{
+	struct reorder_queue *q;
+	struct reorder_event *e;
+
+	if (!rb->nrheap)
+		return NULL;
+
+	q = &rb->queues[rb->heap[0]];
+	e = queue_event(q, 0);
+	if (!flush && e->saved.ev.time + rb->window >= rb->last_time)
+		return NULL;
+
+	q->first = (q->first + 1) & (q->max - 1);
+	if (--q->nr) {
+		heap_sift_down(rb, 0);
+	} else {
+		q->pos = -1;
+		if (--rb->nrheap) {
+			rb->heap[0] = rb->heap[rb->nrheap];
+			rb->queues[rb->heap[0]].pos = 0;
+			heap_sift_down(rb, 0);
+		}
+	}
+
+	/* The slot, holding the name, is only reused by queue_insert() */
+	restore_trace_event(&e->saved, &rb->out);
+	rb->released_time = rb->out.time;
+	rb->released = 1;
+	return &rb->out;
+}
+
+/**
+ * reorder_trace_event - queue an event and analyze those it releases
+ * @rb: the reorder buffer
+ * @ev: the event
+ * @fn: called on each released event, in time order
+ * @arg: passed to @fn
+ *
+ * An event which cannot be queued, being out of the window or for an
+ * unknown cpu, is passed to @fn at once.
+ *
+ * @return: the return value of @fn if the event was not queued,
+ * otherwise 0 on success, -1 on error
+ */
+int reorder_trace_event(struct reorder_buffer *rb, struct trace_event *ev,
+			reorder_fn fn, void *arg)
+{
+	struct reorder_queue *q;
+	struct trace_event *out;
+
+	if (ev->cpu < 0 || ev->cpu >= rb->nrqueues)
+		return fn(ev, arg);
+
+	q = &rb->queues[ev->cpu];
+
+	/*
+	 * A mark of lost events read from text has no time, it goes
+	 * after the events of the cpu seen so far.
+	 */
+	if (ev->type == TRACE_EVENT_LOST && !ev->time) {
+		if (!q->nr)
+			return fn(ev, arg);
+		ev->time = queue_event(q, q->nr - 1)->saved.ev.time;
+	} else if (rb->released && ev->time < rb->released_time) {
+		rb->late++;
+		return fn(ev, arg);
+	}
+
+	/* The name is copied, it may point into a buffer about to be reused */
+	if (queue_insert(rb, ev->cpu, ev))
+		return -1;
+
+	rb->last_time = MAX(rb->last_time, ev->time);
+
+	while ((out = release_event(rb, 0)))
+		if (fn(out, arg) == -1)
+			rb->failed++;
+
+	return 0;
+}
+
+/**
+ * flush_reorder_buffer - analyze the events left and free the buffer
+ * @datas: per-trace statistics, with or without a reorder buffer
+ * @fn: called on each released event, in time order
+ * @arg: passed to @fn
+ *
+ * Warns about the events which came out of the window.
+ *
+ * @return: the number of events queued by reorder_trace_event() which
+ * @fn failed on
+ */
+size_t flush_reorder_buffer(struct cpuidle_datas *datas, reorder_fn fn,
+			    void *arg)
+{
+	struct reorder_buffer *rb = datas->reorder;
+	struct trace_event *out;
+	size_t failed;
+
+	if (!rb)
+		return 0;
+
+	while ((out = release_event(rb, 1)))
+		if (fn(out, arg) == -1)
+			rb->failed++;
+
+	if (rb->late)
+		fprintf(stderr, "warning: %zu events out of order by more "
+			"than %llu us, the results of the analysis might be "
+			"wrong. Increase the reorder window "
+			"(--reorder-window).\n", rb->late,
+			(unsigned long long)(rb->window / NSEC_PER_USEC));
+
+	failed = rb->failed;
+	release_queues(rb);
+	datas->reorder = NULL;
+
+	return failed;
+}
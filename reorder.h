@@ -0,0 +1,55 @@
+/*
+ *  reorder.h
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * Bounded reordering of the events of a trace before their analysis.
+ */
+#ifndef __REORDER_H
+#define __REORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct cpuidle_datas;
+struct trace_event;
+
+/*
+ * The events are queued per cpu they were logged on and merged back in
+ * time order by a heap of the cpus. An event is released once an event
+ * more than the window later has been queued. Events arriving after
+ * later ones were released are out of the window, they are analyzed
+ * as they come and counted.
+ */
+#define REORDER_WINDOW_USEC 1000
+
+struct reorder_buffer;
+
+typedef int (*reorder_fn)(struct trace_event *ev, void *arg);
+
+extern void set_reorder_window(unsigned int usec);
+extern int setup_reorder_buffer(struct cpuidle_datas *datas);
+extern void widen_reorder_window(struct reorder_buffer *rb, uint64_t ns);
+extern int reorder_trace_event(struct reorder_buffer *rb,
+			       struct trace_event *ev,
+			       reorder_fn fn, void *arg);
+extern size_t flush_reorder_buffer(struct cpuidle_datas *datas,
+				   reorder_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ *  ring.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "ring.h"
+#include "utils.h"
+
+#define RING_YIELDS 16
+
+/*
+ * Sleep while *@index is still @val. The other side moves the index
+ * then wakes us up if we flagged that we wait, see ring_wake().
+ */
+static void ring_wait(unsigned int *index, unsigned int val, int *waits)
+{
+	__atomic_store_n(waits, 1, __ATOMIC_SEQ_CST);
+
+	/* The other side may have moved before seeing the flag */
+	if (__atomic_load_n(index, __ATOMIC_SEQ_CST) == val)
+		syscall(SYS_futex, index, FUTEX_WAIT_PRIVATE, val,
+			NULL, NULL, 0);
+
+	__atomic_store_n(waits, 0, __ATOMIC_RELAXED);
+}
+
+static void ring_wake(unsigned int *index, int *waits)
+{
+	if (__atomic_load_n(waits, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, index, FUTEX_WAKE_PRIVATE, 1,
+			NULL, NULL, 0);
+}
+
+/**
+ * spsc_ring_init - set up an empty ring
+ * @ring: the ring
+ * @size: number of slots, rounded up to a power of two
+ *
+ * @return: 0 on success, -1 on error
+ */
+int spsc_ring_init(struct spsc_ring *ring, unsigned int size)
+{
+	unsigned int nr = 1;
+
+	while (nr < size)
+		nr *= 2;
+
+	ring->slots = calloc(nr, sizeof(*ring->slots));
+	if (!ring->slots)
+		return error(__func__);
+
+	ring->mask = nr - 1;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->consumer_waits = 0;
+	ring->producer_waits = 0;
+	return 0;
+}
+
+void spsc_ring_release(struct spsc_ring *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+/**
+ * spsc_ring_push - append @item, waiting while the ring is full
+ *
+ * Must only be called from the producer thread.
+ */
+void spsc_ring_push(struct spsc_ring *ring, void *item)
+{
+	unsigned int head = ring->head, tail;
+	int tries = 0;
+
+	for (;;) {
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (head - tail <= ring->mask)
+			break;
+		if (tries++ < RING_YIELDS)
+			sched_yield();
+		else
+			ring_wait(&ring->tail, tail, &ring->producer_waits);
+	}
+
+	ring->slots[head & ring->mask] = item;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+	ring_wake(&ring->head, &ring->consumer_waits);
+}
+
+/**
+ * spsc_ring_pop - remove the oldest item, waiting while the ring is empty
+ *
+ * Must only be called from the consumer thread.
+ */
+void *spsc_ring_pop(struct spsc_ring *ring)
+{
+	unsigned int tail = ring->tail;
+	int tries = 0;
+	void *item;
+
+	while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+		if (tries++ < RING_YIELDS)
+			sched_yield();
+		else
+			ring_wait(&ring->head, tail, &ring->consumer_waits);
+	}
+
+	item = ring->slots[tail & ring->mask];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+	ring_wake(&ring->tail, &ring->producer_waits);
+	return item;
+}
@@ -0,0 +1,47 @@
+/*
+ *  ring.h
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef __RING_H
+#define __RING_H
+
+/*
+ * Lock-free ring of pointers between exactly one producer thread and one
+ * consumer thread. Each side only writes its own index, so no lock or
+ * atomic read-modify-write is needed. The items are meant to be large
+ * batches, making the cost of waiting on the other side negligible. A
+ * side finding the ring full or empty yields a few times, then sleeps on
+ * the index of the other side until it moves.
+ */
+struct spsc_ring {
+	void **slots;
+	unsigned int mask;
+	unsigned int head __attribute__((aligned(64)));	/* producer */
+	int consumer_waits;
+	unsigned int tail __attribute__((aligned(64)));	/* consumer */
+	int producer_waits;
+};
+
+extern int spsc_ring_init(struct spsc_ring *ring, unsigned int size);
+extern void spsc_ring_release(struct spsc_ring *ring);
+extern void spsc_ring_push(struct spsc_ring *ring, void *item);
+extern void *spsc_ring_pop(struct spsc_ring *ring);
+
+#endif
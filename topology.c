@@ -30,18 +30,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <strings.h>
 #include <unistd.h>
 #include <string.h>
 #include <dirent.h>
 #include <ctype.h>
 #include <sys/stat.h>
 #include <assert.h>
-#include <float.h>
 
 #include "list.h"
 #include "utils.h"
 #include "topology.h"
 #include "idlestat.h"
+#include "line_reader.h"
 
 struct topology_info {
 	int physical_id;
@@ -181,30 +182,191 @@ int cpu_is_online(struct cpu_topology *topo, int cpuid)
 	return topo->online_cpus[cpuid];
 }
 
+static inline struct cpu_map *cpu_map_entry(struct cpu_topology *topo,
+					    int cpuid)
+{
+	if (cpuid < 0 || cpuid >= topo->cpu_map_size)
+		return NULL;
+
+	return &topo->cpu_map[cpuid];
+}
+
+static void occupancy_add(struct cstate_occupancy *occ, int cstate)
+{
+	if (cstate < 0) {
+		occ->nr_running++;
+		return;
+	}
+
+	if (occ->nr_idle[cstate]++ == 0)
+		occ->idle_mask |= 1U << cstate;
+}
+
+static void occupancy_del(struct cstate_occupancy *occ, int cstate)
+{
+	if (cstate < 0) {
+		occ->nr_running--;
+		return;
+	}
+
+	if (--occ->nr_idle[cstate] == 0)
+		occ->idle_mask &= ~(1U << cstate);
+}
+
+static int occupancy_least_cstate(struct cstate_occupancy *occ)
+{
+	if (occ->nr_running)
+		return -1;
+
+	return occ->idle_mask ? ffs(occ->idle_mask) - 1 : MAXCSTATE;
+}
+
+static unsigned int freq_multiset_hash(struct freq_multiset *set,
+				       unsigned int freq)
+{
+	return (freq * 2654435761U) >> (32 - set->index_bits);
+}
+
+static void freq_multiset_index(struct freq_multiset *set, int slot)
+{
+	unsigned int mask = (1U << set->index_bits) - 1;
+	unsigned int h;
+
+	h = freq_multiset_hash(set, set->freq[slot]);
+	while (set->index[h] != -1)
+		h = (h + 1) & mask;
+	set->index[h] = slot;
+}
+
+static int freq_multiset_find(struct freq_multiset *set, unsigned int freq)
+{
+	unsigned int mask = (1U << set->index_bits) - 1;
+	unsigned int h;
+	int slot;
+
+	if (!set->index)
+		return -1;
+
+	h = freq_multiset_hash(set, freq);
+	while ((slot = set->index[h]) != -1) {
+		if (set->freq[slot] == freq)
+			return slot;
+		h = (h + 1) & mask;
+	}
+
+	return -1;
+}
+
+/*
+ * Double the slots of @set and rebuild its hash in a table at most half
+ * full.
+ */
+static int freq_multiset_grow(struct freq_multiset *set)
+{
+	int size = set->size ? set->size * 2 : MAXPSTATE;
+	unsigned int *freq;
+	unsigned int bits;
+	int *count, *index;
+	int i;
+
+	freq = realloc(set->freq, sizeof(*freq) * size);
+	if (!freq)
+		return error(__func__);
+	set->freq = freq;
+
+	count = realloc(set->count, sizeof(*count) * size);
+	if (!count)
+		return error(__func__);
+	set->count = count;
+
+	for (bits = 1; (1U << bits) < 2U * size; bits++)
+		;
+	index = malloc(sizeof(*index) << bits);
+	if (!index)
+		return error(__func__);
+
+	free(set->index);
+	set->index = index;
+	set->index_bits = bits;
+	set->size = size;
+
+	memset(set->index, -1, sizeof(*set->index) << bits);
+	for (i = 0; i < set->nr; i++)
+		freq_multiset_index(set, i);
+
+	return 0;
+}
+
+static int freq_multiset_add(struct freq_multiset *set, unsigned int freq)
+{
+	int slot;
+
+	if (!freq)
+		return 0;
+
+	slot = freq_multiset_find(set, freq);
+	if (slot < 0) {
+		if (set->nr == set->size && freq_multiset_grow(set))
+			return -1;
+		slot = set->nr++;
+		set->freq[slot] = freq;
+		set->count[slot] = 0;
+		freq_multiset_index(set, slot);
+	}
+
+	if (set->count[slot]++ == 0 &&
+	    (set->max < 0 || freq > set->freq[set->max]))
+		set->max = slot;
+
+	return 0;
+}
+
+static void freq_multiset_del(struct freq_multiset *set, unsigned int freq)
+{
+	int slot, i;
+
+	if (!freq)
+		return;
+
+	slot = freq_multiset_find(set, freq);
+	assert(slot >= 0 && set->count[slot] > 0);
+
+	if (--set->count[slot] || slot != set->max)
+		return;
+
+	set->max = -1;
+	for (i = 0; i < set->nr; i++)
+		if (set->count[i] &&
+		    (set->max < 0 || set->freq[i] > set->freq[set->max]))
+			set->max = i;
+}
+
+static unsigned int freq_multiset_max(struct freq_multiset *set)
+{
+	return set->nr && set->max >= 0 ? set->freq[set->max] : 0;
+}
+
+static void freq_multiset_reset(struct freq_multiset *set)
+{
+	free(set->freq);
+	free(set->count);
+	free(set->index);
+	memset(set, 0, sizeof(*set));
+	set->max = -1;
+}
+
 struct cpu_physical *cpu_to_cluster(int cpuid, struct cpu_topology *topo)
 {
-	struct cpu_physical *phy;
-	struct cpu_cpu *cpu;
+	struct cpu_map *map = cpu_map_entry(topo, cpuid);
 
-	topo_for_each_cluster(phy, topo)
-		cluster_for_each_cpu(cpu, phy)
-			if (cpu->cpu_id == cpuid)
-				return phy;
-	return NULL;
+	return map ? map->cluster : NULL;
 }
 
 struct cpu_core *cpu_to_core(int cpuid, struct cpu_topology *topo)
 {
-	struct cpu_physical *phy;
-	struct cpu_core *core;
-	struct cpu_cpu *cpu;
+	struct cpu_map *map = cpu_map_entry(topo, cpuid);
 
-	topo_for_each_cluster(phy, topo)
-		cluster_for_each_core(core, phy)
-			core_for_each_cpu(cpu, core)
-				if (cpu->cpu_id == cpuid)
-					return core;
-	return NULL;
+	return map ? map->core : NULL;
 }
 
 void free_cpu_cpu_list(struct list_head *head)
@@ -224,6 +386,9 @@ void free_cpu_core_list(struct list_head *head)
 
 	list_for_each_entry_safe(lcore, n, head, list_core) {
 		free_cpu_cpu_list(&lcore->cpu_head);
+		freq_multiset_reset(&lcore->freqs);
+		release_pstate_tables(lcore->pstates);
+		free(lcore->pstates);
 		list_del(&lcore->list_core);
 		free(lcore);
 	}
@@ -236,7 +401,9 @@ void free_cpu_topology(struct list_head *head)
 	list_for_each_entry_safe(lphysical, n, head, list_physical) {
 		free_cpu_core_list(&lphysical->core_head);
 		list_del(&lphysical->list_physical);
-		free(lphysical->pstates->pstate);
+		freq_multiset_reset(&lphysical->freqs);
+		release_pstate_tables(lphysical->pstates);
+		free(lphysical->pstates);
 		free(lphysical);
 	}
 }
@@ -278,18 +445,62 @@ int outfile_topo_info(FILE *f, struct cpu_topology *topo_list)
 }
 
 struct cpu_cpu *find_cpu_point(struct cpu_topology *topo_list, int cpuid)
+{
+	struct cpu_map *map = cpu_map_entry(topo_list, cpuid);
+
+	return map ? map->cpu : NULL;
+}
+
+/**
+ * build_cpu_map - index the topology by cpu id
+ * @topo: topology, complete with all online cpus
+ *
+ * The per-event paths look up the core and the cluster of a cpu for
+ * every event. Walking the lists would make this cost grow with the
+ * number of cpus, so the result is stored once in a dense array.
+ *
+ * @return: 0 on success, -1 on error
+ */
+static int build_cpu_map(struct cpu_topology *topo)
 {
 	struct cpu_physical *s_phy;
 	struct cpu_core     *s_core;
 	struct cpu_cpu      *s_cpu;
+	struct cpu_map      *map;
 
-	list_for_each_entry(s_phy, &topo_list->physical_head, list_physical)
-		list_for_each_entry(s_core, &s_phy->core_head, list_core)
-			list_for_each_entry(s_cpu, &s_core->cpu_head, list_cpu)
-				if (s_cpu->cpu_id == cpuid)
-					return s_cpu;
+	map = calloc(topo->online_array_size, sizeof(*map));
+	if (!map && topo->online_array_size)
+		return error(__func__);
 
-	return NULL;
+	topo_for_each_cluster(s_phy, topo) {
+		memset(&s_phy->occupancy, 0, sizeof(s_phy->occupancy));
+		freq_multiset_reset(&s_phy->freqs);
+		cluster_for_each_core(s_core, s_phy) {
+			memset(&s_core->occupancy, 0,
+			       sizeof(s_core->occupancy));
+			freq_multiset_reset(&s_core->freqs);
+			core_for_each_cpu(s_cpu, s_core) {
+				map[s_cpu->cpu_id].cpu = s_cpu;
+				map[s_cpu->cpu_id].core = s_core;
+				map[s_cpu->cpu_id].cluster = s_phy;
+
+				/*
+				 * All cpus start out running, at no known
+				 * frequency
+				 */
+				occupancy_add(&s_core->occupancy, -1);
+				occupancy_add(&s_phy->occupancy, -1);
+				s_cpu->core_freq = 0;
+				s_cpu->cluster_freq = 0;
+			}
+		}
+	}
+
+	free(topo->cpu_map);
+	topo->cpu_map = map;
+	topo->cpu_map_size = topo->online_array_size;
+
+	return 0;
 }
 
 static inline int read_topology_cb(char *path, struct topology_info *info)
@@ -451,7 +662,7 @@ struct cpu_topology *read_sysfs_cpu_topo(void)
 	return topo_folder_scan("/sys/devices/system/cpu", cpu_filter_cb);
 }
 
-struct cpu_topology *read_cpu_topo_info(FILE *f, char *buf)
+struct cpu_topology *read_cpu_topo_info(struct line_reader *reader, char *buf)
 {
 	int ret = 0;
 	struct topology_info cpu_info;
@@ -466,7 +677,7 @@ struct cpu_topology *read_cpu_topo_info(FILE *f, char *buf)
 	do {
 		/* Skip comment lines */
 		if (*buf == '#' || *buf == '\0') {
-			if (!fgets(buf, BUFSIZE, f))
+			if (!line_reader_gets(reader, buf, BUFSIZE))
 				goto read_error_or_eof;
 			continue;
 		}
@@ -477,14 +688,14 @@ struct cpu_topology *read_cpu_topo_info(FILE *f, char *buf)
 			break;
 		cpu_info.physical_id = pid - 'A';
 
-		if (!fgets(buf, BUFSIZE, f))
+		if (!line_reader_gets(reader, buf, BUFSIZE))
 			goto read_error_or_eof;
 
 		is_ht = false;
 		do {
 			/* Skip comment lines */
 			if (*buf == '#' || *buf == '\0') {
-				if (!fgets(buf, BUFSIZE, f))
+				if (!line_reader_gets(reader, buf, BUFSIZE))
 					goto read_error_or_eof;
 				continue;
 			}
@@ -492,7 +703,7 @@ struct cpu_topology *read_cpu_topo_info(FILE *f, char *buf)
 			/* Core line? */
 			ret = sscanf(buf, "\tcore%d", &cpu_info.core_id);
 			if (ret) {
-				if (!fgets(buf, BUFSIZE, f))
+				if (!line_reader_gets(reader, buf, BUFSIZE))
 					goto read_error_or_eof;
 				is_ht = true;
 				continue;
@@ -513,7 +724,7 @@ struct cpu_topology *read_cpu_topo_info(FILE *f, char *buf)
 
 			add_topo_info(result, &cpu_info);
 
-			if (!fgets(buf, BUFSIZE, f))
+			if (!line_reader_gets(reader, buf, BUFSIZE))
 				goto read_error_or_eof;
 		} while (1);
 	} while (1);
@@ -536,6 +747,7 @@ int release_cpu_topo_info(struct cpu_topology *topo)
 	/* Free alloced memory */
 	free_cpu_topology(&topo->physical_head);
 	free(topo->online_cpus);
+	free(topo->cpu_map);
 	free(topo);
 
 	return 0;
@@ -676,72 +888,94 @@ int release_cpu_topo_cstates(struct cpu_topology *topo)
 	return 0;
 }
 
-int cluster_get_least_cstate(struct cpu_physical *clust)
+/**
+ * cpu_cstate_changed - account a C-state change of a cpu in its groups
+ * @topo: topology the cpu belongs to
+ * @cpuid: the cpu
+ * @old_cstate: previous current_cstate of the cpu
+ * @new_cstate: new current_cstate of the cpu
+ *
+ * Must be called for every change of the current_cstate of a cpu so
+ * that core_get_least_cstate() and cluster_get_least_cstate() remain
+ * exact.
+ */
+void cpu_cstate_changed(struct cpu_topology *topo, int cpuid,
+			int old_cstate, int new_cstate)
 {
-	struct cpu_cpu *cpu;
-	int cpu_cstate;
-	int ret = MAXCSTATE;
+	struct cpu_map *map;
 
-	cluster_for_each_cpu(cpu, clust) {
-		cpu_cstate = cpu->cstates->current_cstate;
-		if (cpu_cstate < ret)
-			ret = cpu_cstate;
-	}
-	return ret;
+	if (old_cstate == new_cstate)
+		return;
+
+	map = cpu_map_entry(topo, cpuid);
+	if (!map || !map->cpu)
+		return;
+
+	occupancy_del(&map->core->occupancy, old_cstate);
+	occupancy_add(&map->core->occupancy, new_cstate);
+	occupancy_del(&map->cluster->occupancy, old_cstate);
+	occupancy_add(&map->cluster->occupancy, new_cstate);
 }
 
-int cluster_get_highest_freq(struct cpu_physical *clust)
+/**
+ * cpu_freq_changed - account the frequency of a cpu in its groups
+ * @topo: topology the cpu belongs to
+ * @cpuid: the cpu
+ * @core_freq: frequency the cpu counts for in its core, 0 if none
+ * @cluster_freq: frequency the cpu counts for in its cluster, 0 if none
+ *
+ * Must be called for every change of the frequency or idle state of a
+ * cpu so that core_get_highest_freq() and cluster_get_highest_freq()
+ * remain exact.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int cpu_freq_changed(struct cpu_topology *topo, int cpuid,
+		     unsigned int core_freq, unsigned int cluster_freq)
 {
+	struct cpu_map *map;
 	struct cpu_cpu *cpu;
-	int cpu_pstate_index;
-	unsigned int cpu_freq;
-	unsigned int ret = 0;
 
-	cluster_for_each_cpu(cpu, clust) {
-		cpu_pstate_index = cpu->pstates->current;
-		if (cpu_pstate_index < 0)
-			continue;
-		if (cpu->pstates->idle > 0)
-			continue;
-		cpu_freq = cpu->pstates->pstate[cpu_pstate_index].freq;
-		if (cpu_freq > ret)
-			ret = cpu_freq;
+	map = cpu_map_entry(topo, cpuid);
+	if (!map || !map->cpu)
+		return 0;
+	cpu = map->cpu;
+
+	if (cpu->core_freq != core_freq) {
+		if (freq_multiset_add(&map->core->freqs, core_freq))
+			return -1;
+		freq_multiset_del(&map->core->freqs, cpu->core_freq);
+		cpu->core_freq = core_freq;
 	}
 
-	return ret;
+	if (cpu->cluster_freq != cluster_freq) {
+		if (freq_multiset_add(&map->cluster->freqs, cluster_freq))
+			return -1;
+		freq_multiset_del(&map->cluster->freqs, cpu->cluster_freq);
+		cpu->cluster_freq = cluster_freq;
+	}
+
+	return 0;
 }
 
-int core_get_least_cstate(struct cpu_core *core)
+int cluster_get_least_cstate(struct cpu_physical *clust)
 {
-	struct cpu_cpu *cpu;
-	int cpu_cstate;
-	int ret = MAXCSTATE;
-
-	core_for_each_cpu(cpu, core) {
-		cpu_cstate = cpu->cstates->current_cstate;
-		if (cpu_cstate < ret)
-			ret = cpu_cstate;
-	}
-	return ret;
+	return occupancy_least_cstate(&clust->occupancy);
 }
 
-int core_get_highest_freq(struct cpu_core *core)
+int cluster_get_highest_freq(struct cpu_physical *clust)
 {
-	struct cpu_cpu *cpu;
-	int cpu_pstate_index;
-	unsigned int cpu_freq;
-	unsigned int ret = 0;
+	return freq_multiset_max(&clust->freqs);
+}
 
-	core_for_each_cpu(cpu, core) {
-		cpu_pstate_index = cpu->pstates->current;
-		if (cpu_pstate_index < 0)
-			continue;
-		cpu_freq = cpu->pstates->pstate[cpu_pstate_index].freq;
-		if (cpu_freq > ret)
-			ret = cpu_freq;
-	}
+int core_get_least_cstate(struct cpu_core *core)
+{
+	return occupancy_least_cstate(&core->occupancy);
+}
 
-	return ret;
+int core_get_highest_freq(struct cpu_core *core)
+{
+	return freq_multiset_max(&core->freqs);
 }
 
 /**
@@ -777,7 +1011,7 @@ static struct cpuidle_cstates *create_states(struct cpuidle_cstate *s_state)
 		if (s_state->name == NULL)
 			continue;
 
-		d_state->min_time = DBL_MAX;
+		d_state->min_time = TIME_MAX;
 		d_state->target_residency = s_state->target_residency;
 		d_state->name = strdup(s_state->name);
 
@@ -869,6 +1103,9 @@ int setup_topo_states(struct cpuidle_datas *datas)
 	topo = datas->topo;
 	assert(topo != NULL);
 
+	if (build_cpu_map(topo))
+		return -1;
+
 	/* Map cpu state arrays into topology structures */
 	for (i = 0; i < datas->nrcpus; i++) {
 		if (!cpu_is_online(topo, i))
@@ -876,8 +1113,19 @@ int setup_topo_states(struct cpuidle_datas *datas)
 
 		s_cpu = find_cpu_point(topo, i);
 		if (s_cpu) {
+			struct cpufreq_pstates *ps = &datas->pstates[i];
+			int j;
+
 			s_cpu->cstates = &datas->cstates[i];
-			s_cpu->pstates = &datas->pstates[i];
+			s_cpu->pstates = ps;
+
+			/* Groups run at the frequencies of their cpus */
+			for (j = 0; j < ps->max; j++) {
+				alloc_pstate(cpu_to_core(i, topo)->pstates,
+					     ps->pstate[j].freq);
+				alloc_pstate(cpu_to_cluster(i, topo)->pstates,
+					     ps->pstate[j].freq);
+			}
 		} else {
 			fprintf(stderr,
 				"Warning: Cannot map cpu %d into topology\n",
@@ -903,3 +1151,77 @@ int setup_topo_states(struct cpuidle_datas *datas)
 
 	return 0;
 }
+
+static void copy_cstates(struct cpuidle_cstates *dst,
+			 struct cpuidle_cstates *src)
+{
+	int state;
+
+	for (state = 0; state < MAXCSTATE; state++) {
+		dst->cstate[state].nrdata = src->cstate[state].nrdata;
+		dst->cstate[state].duration = src->cstate[state].duration;
+		dst->cstate[state].min_time = src->cstate[state].min_time;
+		dst->cstate[state].max_time = src->cstate[state].max_time;
+		dst->cstate[state].early_wakings =
+			src->cstate[state].early_wakings;
+		dst->cstate[state].late_wakings =
+			src->cstate[state].late_wakings;
+	}
+	dst->cstate_max = src->cstate_max;
+}
+
+static void copy_pstates(struct cpufreq_pstates *dst,
+			 struct cpufreq_pstates *src)
+{
+	struct cpufreq_pstate *p;
+	int i;
+
+	for (i = 0; i < src->max; i++) {
+		p = &dst->pstate[alloc_pstate(dst, src->pstate[i].freq)];
+		p->count = src->pstate[i].count;
+		p->duration = src->pstate[i].duration;
+		p->min_time = src->pstate[i].min_time;
+		p->max_time = src->pstate[i].max_time;
+	}
+}
+
+/**
+ * copy_single_cpu_groups - fill the groups of one cpu from that cpu
+ * @topo: topology whose cpu statistics are set, see setup_topo_states()
+ *
+ * The residency of a group depends on how the idle periods of its cpus
+ * overlap, which the backends aggregating per cpu (counters, bpf) do
+ * not tell. Only the cores and clusters of a single cpu can be
+ * reported: they are in the states of their cpu.
+ */
+void copy_single_cpu_groups(struct cpu_topology *topo)
+{
+	struct cpu_physical *s_phy;
+	struct cpu_core *s_core;
+	struct cpu_cpu *s_cpu, *last;
+	int nrcpus;
+
+	topo_for_each_cluster(s_phy, topo) {
+		nrcpus = 0;
+		last = NULL;
+		cluster_for_each_cpu(s_cpu, s_phy) {
+			nrcpus++;
+			last = s_cpu;
+		}
+		if (nrcpus == 1 && last->cstates) {
+			copy_cstates(s_phy->cstates, last->cstates);
+			copy_pstates(s_phy->pstates, last->pstates);
+		}
+
+		cluster_for_each_core(s_core, s_phy) {
+			if (s_core->cpu_num != 1)
+				continue;
+			s_cpu = list_first_entry(&s_core->cpu_head,
+						 struct cpu_cpu, list_cpu);
+			if (!s_cpu->cstates)
+				continue;
+			copy_cstates(s_core->cstates, s_cpu->cstates);
+			copy_pstates(s_core->pstates, s_cpu->pstates);
+		}
+	}
+}
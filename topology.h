@@ -29,14 +29,33 @@
 #define __TOPOLOGY_H
 
 #include "list.h"
+#include "idlestat.h"
 #include <stdbool.h>
 
 struct cpuidle_datas;
 struct report_ops;
+struct line_reader;
+
+/*
+ * Number of member cpus of a group at each frequency. Every frequency
+ * seen keeps its slot, found through a hash, and the slot of the
+ * highest counted one is cached so only removing it needs a rescan.
+ */
+struct freq_multiset {
+	unsigned int *freq;	/* frequency of each slot */
+	int *count;		/* member cpus at the frequency of each slot */
+	int nr;			/* slots in use */
+	int size;		/* allocated slots */
+	int *index;		/* slot hashed by freq, -1 if free */
+	unsigned int index_bits;	/* log2 of the index size */
+	int max;		/* slot of the highest counted freq, -1 if none */
+};
 
 struct cpu_cpu {
 	struct list_head list_cpu;
 	int cpu_id;
+	unsigned int core_freq;		/* counted in core freqs */
+	unsigned int cluster_freq;	/* counted in cluster freqs */
 	struct list_head list_phy_enum;
 	struct cpuidle_cstates *cstates;
 	struct cpufreq_pstates *pstates;
@@ -44,12 +63,25 @@ struct cpu_cpu {
 	struct cpufreq_pstates *base_pstates;
 };
 
+/*
+ * Number of member cpus running (current_cstate == -1) and in each
+ * C-state. Bit N of idle_mask is set when nr_idle[N] is not zero, so
+ * the least C-state of a group is found without looking at its cpus.
+ */
+struct cstate_occupancy {
+	int nr_running;
+	int nr_idle[MAXCSTATE];
+	unsigned int idle_mask;
+};
+
 struct cpu_core {
 	struct list_head list_core;
 	int core_id;
 	struct list_head cpu_head;
 	int cpu_num;
 	bool is_ht;
+	struct cstate_occupancy occupancy;
+	struct freq_multiset freqs;
 	struct cpuidle_cstates *cstates;
 	struct cpufreq_pstates *pstates;
 	struct cpuidle_cstates *base_cstates;
@@ -62,20 +94,32 @@ struct cpu_physical {
 	struct list_head core_head;
 	int core_num;
 	struct list_head cpu_enum_head;
+	struct cstate_occupancy occupancy;
+	struct freq_multiset freqs;
 	struct cpuidle_cstates *cstates;
 	struct cpufreq_pstates *pstates;
 	struct cpuidle_cstates *base_cstates;
 	struct cpufreq_pstates *base_pstates;
 };
 
+/* Where a cpu sits in the topology, see setup_topo_states() */
+struct cpu_map {
+	struct cpu_cpu *cpu;
+	struct cpu_core *core;
+	struct cpu_physical *cluster;
+};
+
 struct cpu_topology {
 	struct list_head physical_head;
 	int *online_cpus;
 	int online_array_size;
+	struct cpu_map *cpu_map;	/* indexed by cpu id */
+	int cpu_map_size;
 };
 
 extern struct cpu_topology *alloc_cpu_topo_info(void);
-extern struct cpu_topology *read_cpu_topo_info(FILE *f, char *buf);
+extern struct cpu_topology *read_cpu_topo_info(struct line_reader *reader,
+					       char *buf);
 extern struct cpu_topology *read_sysfs_cpu_topo(void);
 extern int release_cpu_topo_info(struct cpu_topology *topo);
 extern int output_cpu_topo_info(struct cpu_topology *topo, FILE *f);
@@ -107,6 +151,12 @@ extern int cluster_get_highest_freq(struct cpu_physical *clust);
 #define get_affected_cluster_highest_freq(cpuid, topo)		\
 	cluster_get_highest_freq(cpu_to_cluster(cpuid, topo))
 
+extern void cpu_cstate_changed(struct cpu_topology *topo, int cpuid,
+			       int old_cstate, int new_cstate);
+
+extern int cpu_freq_changed(struct cpu_topology *topo, int cpuid,
+			    unsigned int core_freq, unsigned int cluster_freq);
+
 extern int core_get_least_cstate(struct cpu_core *core);
 extern int core_get_highest_freq(struct cpu_core *core);
 #define get_affected_core_least_cstate(cpuid, topo)		\
@@ -115,5 +165,6 @@ extern int core_get_highest_freq(struct cpu_core *core);
 	core_get_highest_freq(cpu_to_core(cpuid, topo))
 
 extern int setup_topo_states(struct cpuidle_datas *datas);
+extern void copy_single_cpu_groups(struct cpu_topology *topo);
 
 #endif
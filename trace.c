@@ -31,17 +31,26 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fts.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "trace.h"
+#include "trace_event.h"
 #include "idlestat.h"
 #include "utils.h"
 #include "list.h"
 
 struct trace_options {
 	int buffer_size;
+	char clock[TRACE_CLOCK_LEN];	/* empty without trace_clock */
 	struct list_head list;
 };
 
@@ -50,14 +59,220 @@ struct enabled_eventtype {
 	struct list_head list;
 };
 
+#define TRACE_DRAIN_BUFSIZE (64 << 10)
+
+struct trace_drain {
+	int (*store)(const char *data, size_t len, void *arg);
+	void *arg;
+	int trace_fd;		/* trace_pipe, non blocking */
+	int stop[2];		/* closing stop[1] ends the drain */
+	int interval;		/* ms between drains, -1 for none */
+	int error;
+	pthread_t thread;
+	char buf[TRACE_DRAIN_BUFSIZE];
+};
+
+/* Clocks the trace timestamps are printed in nanoseconds for */
+static const char * const trace_clocks[] = {
+	"local", "global", "perf", "mono", "mono_raw", "boot", "tai", NULL
+};
+
+/*
+ * Read the trace clock in use, listed between brackets in trace_clock.
+ * @clock is left empty if it cannot be read.
+ */
+static int read_trace_clock(char *clock)
+{
+	char line[BUFSIZE], *b, *e;
+	FILE *f;
+
+	clock[0] = '\0';
+
+	f = fopen(TRACE_CLOCK_PATH, "r");
+	if (!f)
+		return -1;
+
+	b = fgets(line, sizeof(line), f);
+	fclose(f);
+	if (!b)
+		return -1;
+
+	b = strchr(line, '[');
+	e = b ? strchr(b, ']') : NULL;
+	if (!e || e - b - 1 >= TRACE_CLOCK_LEN)
+		return -1;
+
+	memcpy(clock, b + 1, e - b - 1);
+	clock[e - b - 1] = '\0';
+	return 0;
+}
+
+/* Selecting a trace clock resets the trace buffers */
+static int write_trace_clock(const char *clock)
+{
+	FILE *f;
+
+	f = fopen(TRACE_CLOCK_PATH, "w");
+	if (!f) {
+		fprintf(stderr, "failed to open '%s': %m\n", TRACE_CLOCK_PATH);
+		return -1;
+	}
+
+	fputs(clock, f);
+
+	if (fclose(f)) {
+		fprintf(stderr, "failed to select the '%s' trace clock: %m\n",
+			clock);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * idlestat_set_trace_clock - select the clock the events are stamped with
+ * @clock: name of the clock, as listed in trace_clock
+ *
+ * Only the clocks ftrace prints in seconds and nanoseconds are accepted,
+ * counters like x86-tsc are printed in raw ticks idlestat cannot convert.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int idlestat_set_trace_clock(const char *clock)
+{
+	char current[TRACE_CLOCK_LEN];
+	int i;
+
+	for (i = 0; trace_clocks[i]; i++)
+		if (!strcmp(clock, trace_clocks[i]))
+			break;
+
+	if (!trace_clocks[i]) {
+		fprintf(stderr, "unsupported trace clock '%s', use one of "
+			"local, global, perf, mono, mono_raw, boot or tai\n",
+			clock);
+		return -1;
+	}
+
+	if (read_trace_clock(current)) {
+		fprintf(stderr, "the kernel does not allow to select the "
+			"trace clock\n");
+		return -1;
+	}
+
+	if (!strcmp(current, clock))
+		return 0;
+
+	return write_trace_clock(clock);
+}
+
+/**
+ * idlestat_trace_clock_synced - whether the cpus share the trace clock
+ *
+ * The local clock, and the perf clock which is based on it, is read on
+ * each cpu and the cpus may disagree. The global, mono, mono_raw, boot
+ * and tai clocks are the same on all cpus, the capture needs no clock
+ * synchronization marks.
+ *
+ * @return: 1 if the clock in use is synchronized, 0 if it is not or
+ * cannot be read
+ */
+int idlestat_trace_clock_synced(void)
+{
+	static const char * const synced_clocks[] = {
+		"global", "mono", "mono_raw", "boot", "tai", NULL
+	};
+	char clock[TRACE_CLOCK_LEN];
+	int i;
+
+	if (read_trace_clock(clock))
+		return 0;
+
+	for (i = 0; synced_clocks[i]; i++)
+		if (!strcmp(clock, synced_clocks[i]))
+			return 1;
+
+	return 0;
+}
+
+/**
+ * idlestat_open_trace_marker - open trace_marker for writing
+ *
+ * @return: the file descriptor, -1 on error
+ */
+int idlestat_open_trace_marker(void)
+{
+	int fd;
+
+	fd = open(TRACE_MARKER_PATH, O_WRONLY);
+	if (fd < 0)
+		return error("open " TRACE_MARKER_PATH);
+
+	return fd;
+}
+
+/**
+ * idlestat_clock_sync_mark - relate the trace clock of the cpu we run on
+ * to CLOCK_MONOTONIC
+ * @fd: trace_marker, see idlestat_open_trace_marker()
+ *
+ * Each mark holds the CLOCK_MONOTONIC time read just before it is written.
+ * The trace clock stamps it a little later, so the import keeps the mark
+ * of each cpu which was delayed the least.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int idlestat_clock_sync_mark(int fd)
+{
+	char mark[64];
+	struct timespec ts;
+	int i, len;
+
+	for (i = 0; i < TRACE_CLOCK_SYNC_NRMARKS; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		len = snprintf(mark, sizeof(mark),
+			       TRACE_CLOCK_SYNC_MARK " mono=%llu\n",
+			       (unsigned long long)ts.tv_sec * NSEC_PER_SEC +
+			       ts.tv_nsec);
+		if (write(fd, mark, len) != len)
+			return error("write " TRACE_MARKER_PATH);
+	}
+
+	return 0;
+}
+
+/**
+ * idlestat_clock_synced_mark - tell the import the trace clock is the
+ * same on all cpus, see idlestat_trace_clock_synced()
+ * @fd: trace_marker, see idlestat_open_trace_marker()
+ *
+ * @return: 0 on success, -1 on error
+ */
+int idlestat_clock_synced_mark(int fd)
+{
+	static const char mark[] = TRACE_CLOCK_SYNC_MARK " "
+		TRACE_CLOCK_SYNCED "\n";
+
+	if (write(fd, mark, sizeof(mark) - 1) != sizeof(mark) - 1)
+		return error("write " TRACE_MARKER_PATH);
+
+	return 0;
+}
+
 int idlestat_restore_trace_options(struct trace_options *options)
 {
 	struct enabled_eventtype *pos, *n;
+	char clock[TRACE_CLOCK_LEN];
 	int write_problem = 0;
 
 	if (write_int(TRACE_BUFFER_SIZE_PATH, options->buffer_size))
 		write_problem = -1;
 
+	if (options->clock[0] && !read_trace_clock(clock) &&
+	    strcmp(clock, options->clock) &&
+	    write_trace_clock(options->clock))
+		write_problem = -1;
+
 	list_for_each_entry_safe(pos, n, &options->list, list) {
 		if (write_int(pos->name, 1))
 			write_problem = -1;
@@ -148,6 +363,9 @@ struct trace_options *idlestat_store_trace_options()
 	if (read_int(TRACE_BUFFER_SIZE_PATH, &options->buffer_size))
 		goto cannot_get_event_options;
 
+	/* Older kernels have no trace_clock, there is nothing to restore */
+	read_trace_clock(options->clock);
+
 	status = events_scan(TRACE_EVENTS_DIR, &options->list);
 	if (status == 0)
 		return options;
@@ -248,3 +466,264 @@ int idlestat_init_trace(unsigned int percpu_bufsize)
 
 	return 0;
 }
+
+struct trace_cpu_stats {
+	uint64_t entries;	/* events in the buffer */
+	uint64_t overrun;	/* events overwritten before being read */
+	uint64_t bytes;		/* bytes in the buffer */
+	uint64_t dropped;	/* events discarded on a full buffer */
+};
+
+/* Parse per_cpu/cpuN/stats, @return: 0 on success, -1 if not readable */
+static int read_trace_cpu_stats(int cpu, struct trace_cpu_stats *st)
+{
+	char path[BUFSIZE], line[BUFSIZE];
+	unsigned long long v;
+	FILE *f;
+
+	snprintf(path, sizeof(path), TRACE_CPU_STAT_FORMAT, cpu);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	memset(st, 0, sizeof(*st));
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "entries: %llu", &v) == 1)
+			st->entries = v;
+		else if (sscanf(line, "overrun: %llu", &v) == 1)
+			st->overrun = v;
+		else if (sscanf(line, "bytes: %llu", &v) == 1)
+			st->bytes = v;
+		else if (sscanf(line, "dropped events: %llu", &v) == 1)
+			st->dropped = v;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+/**
+ * idlestat_calibrate_trace - size the buffer of each cpu from its event rate
+ * @tbs: the polling interval to size the buffers for, the buffer size is
+ * set to the largest one
+ *
+ * The events enabled by idlestat_init_trace() are recorded for
+ * TRACE_CALIBRATION_SEC seconds. Each cpu then gets a buffer holding
+ * TRACE_CALIBRATION_MARGIN times what it recorded over a polling
+ * interval. The rate is the one of the system before the run: the
+ * margin absorbs a moderately busier workload.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int idlestat_calibrate_trace(struct trace_buffer_settings *tbs)
+{
+	struct trace_cpu_stats st;
+	char path[BUFSIZE];
+	unsigned int kb, max_kb = 0;
+	uint64_t bytes;
+	int nrcpus, cpu;
+
+	if (idlestat_flush_trace() || idlestat_trace_enable(true))
+		return -1;
+	sleep(TRACE_CALIBRATION_SEC);
+	if (idlestat_trace_enable(false))
+		return -1;
+
+	nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	for (cpu = 0; cpu < nrcpus; cpu++) {
+		if (read_trace_cpu_stats(cpu, &st))
+			continue;
+
+		/* Account for what did not fit in the buffer */
+		bytes = st.bytes;
+		if (st.entries && (st.overrun || st.dropped))
+			bytes = bytes * (st.entries + st.overrun + st.dropped) /
+				st.entries;
+
+		kb = bytes * tbs->poll_interval * TRACE_CALIBRATION_MARGIN /
+			TRACE_CALIBRATION_SEC / (1 << 10) + 1;
+		if (kb < TRACE_MIN_BUFFER_KB)
+			kb = TRACE_MIN_BUFFER_KB;
+
+		snprintf(path, sizeof(path), TRACE_CPU_BUFFER_SIZE_FORMAT, cpu);
+		if (write_int(path, kb)) {
+			fprintf(stderr, "Failed to set the trace buffer of cpu "
+				"%d to %u kB\n", cpu, kb);
+			return -1;
+		}
+
+		verbose_printf(1, "cpu%d trace buffer:    %u kB (%llu bytes/s)\n",
+			       cpu, kb, (unsigned long long)bytes /
+			       TRACE_CALIBRATION_SEC);
+		if (kb > max_kb)
+			max_kb = kb;
+	}
+
+	if (max_kb)
+		tbs->percpu_buffer_size = max_kb;
+
+	return 0;
+}
+
+/**
+ * idlestat_check_trace_loss - report the events the trace buffers lost
+ *
+ * To be called once tracing is off, before the buffers are resized.
+ *
+ * @return: the number of events lost, on all cpus
+ */
+int idlestat_check_trace_loss(void)
+{
+	struct trace_cpu_stats st;
+	uint64_t lost, total = 0;
+	int nrcpus, cpu;
+
+	nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	for (cpu = 0; cpu < nrcpus; cpu++) {
+		if (read_trace_cpu_stats(cpu, &st))
+			continue;
+
+		lost = st.overrun + st.dropped;
+		if (!lost)
+			continue;
+
+		fprintf(stderr, "WARNING: %llu events lost on cpu %d "
+			"(overrun %llu, dropped %llu), the results of the "
+			"analysis are wrong. Increase the buffer size (-S), "
+			"calibrate it (--calibrate) or decrease the polling "
+			"interval (-I).\n", (unsigned long long)lost, cpu,
+			(unsigned long long)st.overrun,
+			(unsigned long long)st.dropped);
+		total += lost;
+	}
+
+	return total > INT_MAX ? INT_MAX : (int)total;
+}
+
+/*
+ * Hand everything trace_pipe holds to the store callback. The reads
+ * consume the events, so each drain only sees what was recorded since
+ * the previous one. Each read returns whole lines.
+ */
+static int drain_trace_pipe(struct trace_drain *drain)
+{
+	ssize_t n;
+
+	for (;;) {
+		n = read(drain->trace_fd, drain->buf, sizeof(drain->buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return 0;
+		if (n < 0) {
+			fprintf(stderr, "%s: failed to read '%s': %m\n",
+				__func__, TRACE_PIPE_FILE);
+			return -1;
+		}
+		if (!n)
+			return 0;
+		if (drain->store(drain->buf, n, drain->arg))
+			return -1;
+	}
+}
+
+static void *drain_thread(void *arg)
+{
+	struct trace_drain *drain = arg;
+	struct pollfd fd = { .fd = drain->stop[0], .events = POLLIN };
+
+	/*
+	 * Only the timer wakes us up: polling trace_pipe itself would
+	 * wake on every event.
+	 */
+	for (;;) {
+		if (poll(&fd, 1, drain->interval) < 0 && errno != EINTR)
+			break;
+		if (fd.revents)
+			break;
+		if (drain_trace_pipe(drain)) {
+			drain->error = -1;
+			return NULL;
+		}
+	}
+
+	if (drain_trace_pipe(drain))
+		drain->error = -1;
+
+	return NULL;
+}
+
+/**
+ * idlestat_drain_start - consume the trace while it is being recorded
+ * @interval: seconds between drains, 0 to drain only when stopping
+ * @store: called with the new lines of the trace, returns non zero to
+ *	   stop draining
+ * @arg: passed to @store
+ *
+ * A thread running on the current cpu hands the new content of
+ * trace_pipe to @store every @interval seconds, so the trace buffer
+ * only needs to hold one interval worth of events. Whatever @store
+ * writes to must not be used until idlestat_drain_stop().
+ *
+ * @return: the drain (success) or ptrerror() (error)
+ */
+struct trace_drain *idlestat_drain_start(unsigned int interval,
+	int (*store)(const char *data, size_t len, void *arg), void *arg)
+{
+	struct trace_drain *drain;
+
+	drain = malloc(sizeof(*drain));
+	if (!drain)
+		return ptrerror(__func__);
+
+	drain->store = store;
+	drain->arg = arg;
+	drain->interval = interval ? (int)interval * 1000 : -1;
+	drain->error = 0;
+
+	drain->trace_fd = open(TRACE_PIPE_FILE, O_RDONLY | O_NONBLOCK);
+	if (drain->trace_fd < 0) {
+		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
+			TRACE_PIPE_FILE);
+		free(drain);
+		return ptrerror(NULL);
+	}
+
+	if (pipe(drain->stop)) {
+		close(drain->trace_fd);
+		free(drain);
+		return ptrerror(__func__);
+	}
+
+	if (start_pinned_thread(&drain->thread, drain_thread, drain)) {
+		close(drain->stop[0]);
+		close(drain->stop[1]);
+		close(drain->trace_fd);
+		free(drain);
+		return ptrerror(__func__);
+	}
+
+	return drain;
+}
+
+/**
+ * idlestat_drain_stop - copy what is left of the trace and stop draining
+ *
+ * To be called once tracing is off. Frees @drain.
+ *
+ * @return: 0 on success, -1 if the trace could not be copied
+ */
+int idlestat_drain_stop(struct trace_drain *drain)
+{
+	int ret;
+
+	close(drain->stop[1]);
+	pthread_join(drain->thread, NULL);
+	close(drain->stop[0]);
+	close(drain->trace_fd);
+
+	ret = drain->error;
+	free(drain);
+
+	return ret;
+}
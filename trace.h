@@ -33,21 +33,41 @@
 #define TRACE_EVENT_PATH TRACE_PATH "/events/enable"
 #define TRACE_FREE TRACE_PATH "/free_buffer"
 #define TRACE_FILE TRACE_PATH "/trace"
+#define TRACE_PIPE_FILE TRACE_PATH "/trace_pipe"
+#define TRACE_CLOCK_PATH TRACE_PATH "/trace_clock"
+#define TRACE_MARKER_PATH TRACE_PATH "/trace_marker"
 #define TRACE_STAT_FILE TRACE_PATH "/per_cpu/cpu0/stats"
+#define TRACE_CPU_STAT_FORMAT TRACE_PATH "/per_cpu/cpu%d/stats"
+#define TRACE_CPU_BUFFER_SIZE_FORMAT TRACE_PATH "/per_cpu/cpu%d/buffer_size_kb"
 #define TRACE_IDLE_NRHITS_PER_SEC 10000
 #define TRACE_IDLE_LENGTH 196
 #define TRACE_CPUFREQ_NRHITS_PER_SEC 100
 #define TRACE_CPUFREQ_LENGTH 196
+#define TRACE_CALIBRATION_SEC 1
+#define TRACE_CALIBRATION_MARGIN 2
+#define TRACE_MIN_BUFFER_KB 1024
+#define TRACE_CLOCK_LEN 16
 
 struct trace_options;
 struct trace_buffer_settings;
+struct trace_drain;
 
 extern int idlestat_trace_enable(bool enable);
 extern int idlestat_flush_trace(void);
 extern int calculate_buffer_parameters(unsigned int duration,
 					struct trace_buffer_settings *tbs);
 extern int idlestat_init_trace(unsigned int duration);
+extern int idlestat_calibrate_trace(struct trace_buffer_settings *tbs);
+extern int idlestat_check_trace_loss(void);
+extern int idlestat_set_trace_clock(const char *clock);
+extern int idlestat_open_trace_marker(void);
+extern int idlestat_clock_sync_mark(int fd);
+extern int idlestat_trace_clock_synced(void);
+extern int idlestat_clock_synced_mark(int fd);
 extern struct trace_options *idlestat_store_trace_options(void);
 extern int idlestat_restore_trace_options(struct trace_options *options);
+extern struct trace_drain *idlestat_drain_start(unsigned int interval,
+	int (*store)(const char *data, size_t len, void *arg), void *arg);
+extern int idlestat_drain_stop(struct trace_drain *drain);
 
 #endif
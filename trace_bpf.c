@@ -0,0 +1,1234 @@
+/*
+ *  trace_bpf.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * Capture backend aggregating the idle statistics in the kernel. Small
+ * BPF programs attached to the cpu_idle, cpu_frequency and
+ * irq_handler_entry tracepoints maintain, per cpu, the count, total,
+ * minimum and maximum residency of each C-state and P-state and the
+ * irqs waking the cpu up. No event reaches userspace: the maps are
+ * read once, at the end of the capture. No log2 residency histogram
+ * is kept, as no report shows one.
+ *
+ * The programs are assembled here, so neither a BPF compiler nor a
+ * BPF library is needed.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/bpf.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "intern.h"
+#include "idlestat.h"
+#include "topology.h"
+#include "trace_bpf.h"
+#include "trace_event.h"
+#include "trace_raw.h"
+#include "utils.h"
+
+#define BPF_MAX_INSNS		256
+#define BPF_MAX_LABELS		32
+#define BPF_LOG_SIZE		(64 << 10)
+#define BPF_MAX_IRQS_PER_CPU	64
+#define BPF_MAX_PSTATES_PER_CPU	64
+#define BPF_CAS_TRIES		8
+
+/* State of a cpu, in a per-cpu map */
+struct bpf_idle_state {
+	uint64_t enter;		/* time the current C-state was entered */
+	uint32_t state;
+	uint32_t idle;
+	uint32_t armed;		/* the next irq is a wakeup */
+	uint32_t residency;	/* as_expected, too_short or too_long */
+};
+
+/* Statistics of a C-state of a cpu, in a per-cpu map */
+struct bpf_cstate_stat {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;		/* 0 until the first interval */
+	uint64_t max;
+	uint64_t early;
+	uint64_t late;
+	uint64_t early_ns;	/* set by idlestat: target residency */
+	uint64_t late_ns;	/* set by idlestat: next target, 0 if none */
+};
+
+/*
+ * Frequency of a cpu, indexed by cpu as any cpu may change it. The
+ * running interval is handed off atomically through @since: whoever
+ * swaps it out accounts the interval, so none is lost or counted twice.
+ */
+struct bpf_freq_state {
+	uint64_t since;		/* start of the running interval, 0 if idle */
+	uint32_t freq;
+	uint32_t pad;
+};
+
+/* Key of the P-state and wakeup statistics */
+struct bpf_key {
+	uint32_t cpu;
+	uint32_t id;		/* frequency or irq */
+};
+
+struct bpf_pstate_stat {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;		/* 0 until the first interval */
+	uint64_t max;
+};
+
+struct bpf_wakeup_stat {
+	uint64_t count;
+	uint64_t early;
+	uint64_t late;
+};
+
+enum {
+	BPF_MAP_IDLE_STATE,
+	BPF_MAP_CSTATES,
+	BPF_MAP_FREQ_STATE,
+	BPF_MAP_PSTATES,
+	BPF_MAP_WAKEUPS,
+	BPF_NR_MAPS
+};
+
+/* Stack of the programs, below the frame pointer */
+#define FP_KEY		-8	/* u32 map index */
+#define FP_DELTA	-16	/* u64 interval */
+#define FP_PAIR		-24	/* struct bpf_key */
+#define FP_ZERO		-56	/* zeroed value, up to 32 bytes */
+
+struct bpf_asm {
+	struct bpf_insn insns[BPF_MAX_INSNS];
+	int jumps[BPF_MAX_INSNS];	/* label of a jump, -1 otherwise */
+	int nr;
+	int labels[BPF_MAX_LABELS];	/* instruction of each label */
+	int nr_labels;
+	int *maps;
+	int error;			/* program or labels overflowed */
+};
+
+struct bpf_capture {
+	struct raw_trace *rt;
+	struct cpuidle_datas *datas;
+	int maps[BPF_NR_MAPS];
+	int progs[3];
+	int *fds;
+	int nr_fds;
+	int nrpossible;
+	uint64_t start_ts;
+};
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static uint64_t bpf_clock_ns(void)
+{
+	struct timespec ts;
+
+	/* The clock of bpf_ktime_get_ns() */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void emit(struct bpf_asm *a, uint8_t code, int dst, int src,
+		 int16_t off, int32_t imm)
+{
+	struct bpf_insn *insn;
+
+	/* Overflows fail bpf_asm_end() */
+	if (a->nr >= BPF_MAX_INSNS) {
+		a->error = -1;
+		return;
+	}
+
+	insn = &a->insns[a->nr];
+	insn->code = code;
+	insn->dst_reg = dst;
+	insn->src_reg = src;
+	insn->off = off;
+	insn->imm = imm;
+	a->jumps[a->nr++] = -1;
+}
+
+/* Returns -1 once the labels overflowed, which fails bpf_asm_end() */
+static int new_label(struct bpf_asm *a)
+{
+	if (a->nr_labels >= BPF_MAX_LABELS) {
+		a->error = -1;
+		return -1;
+	}
+
+	a->labels[a->nr_labels] = -1;
+	return a->nr_labels++;
+}
+
+static void set_label(struct bpf_asm *a, int label)
+{
+	if (label >= 0)
+		a->labels[label] = a->nr;
+}
+
+static void set_jump(struct bpf_asm *a, int label)
+{
+	if (!a->error)
+		a->jumps[a->nr - 1] = label;
+}
+
+static void mov_reg(struct bpf_asm *a, int dst, int src)
+{
+	emit(a, BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);
+}
+
+static void mov_imm(struct bpf_asm *a, int dst, int32_t imm)
+{
+	emit(a, BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm);
+}
+
+static void alu_imm(struct bpf_asm *a, int op, int dst, int32_t imm)
+{
+	emit(a, BPF_ALU64 | op | BPF_K, dst, 0, 0, imm);
+}
+
+static void alu_reg(struct bpf_asm *a, int op, int dst, int src)
+{
+	emit(a, BPF_ALU64 | op | BPF_X, dst, src, 0, 0);
+}
+
+static void load(struct bpf_asm *a, int size, int dst, int src, int off)
+{
+	emit(a, BPF_LDX | size | BPF_MEM, dst, src, off, 0);
+}
+
+static void store(struct bpf_asm *a, int size, int dst, int off, int src)
+{
+	emit(a, BPF_STX | size | BPF_MEM, dst, src, off, 0);
+}
+
+static void store_imm(struct bpf_asm *a, int size, int dst, int off,
+		      int32_t imm)
+{
+	emit(a, BPF_ST | size | BPF_MEM, dst, 0, off, imm);
+}
+
+/* Atomic add, for the statistics any cpu may update */
+static void atomic_add(struct bpf_asm *a, int dst, int off, int src)
+{
+	emit(a, BPF_STX | BPF_DW | BPF_ATOMIC, dst, src, off, BPF_ADD);
+}
+
+/* Swap the u64 at @off of @dst with @src, which gets the old value */
+static void atomic_xchg(struct bpf_asm *a, int dst, int off, int src)
+{
+	emit(a, BPF_STX | BPF_DW | BPF_ATOMIC, dst, src, off, BPF_XCHG);
+}
+
+/* Set the u64 at @off of @dst to @src if it is r0, r0 = the old value */
+static void atomic_cmpxchg(struct bpf_asm *a, int dst, int off, int src)
+{
+	emit(a, BPF_STX | BPF_DW | BPF_ATOMIC, dst, src, off, BPF_CMPXCHG);
+}
+
+/* Add one to the u64 at @off of @dst, using r2 */
+static void increment(struct bpf_asm *a, int dst, int off)
+{
+	load(a, BPF_DW, BPF_REG_2, dst, off);
+	alu_imm(a, BPF_ADD, BPF_REG_2, 1);
+	store(a, BPF_DW, dst, off, BPF_REG_2);
+}
+
+static void jump_imm(struct bpf_asm *a, int op, int dst, int32_t imm,
+		     int label)
+{
+	emit(a, BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+	set_jump(a, label);
+}
+
+static void jump_reg(struct bpf_asm *a, int op, int dst, int src, int label)
+{
+	emit(a, BPF_JMP | op | BPF_X, dst, src, 0, 0);
+	set_jump(a, label);
+}
+
+static void jump(struct bpf_asm *a, int label)
+{
+	jump_imm(a, BPF_JA, 0, 0, label);
+}
+
+static void call(struct bpf_asm *a, int func)
+{
+	emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, func);
+}
+
+static void load_map(struct bpf_asm *a, int dst, int map)
+{
+	emit(a, BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0,
+	     a->maps[map]);
+	emit(a, 0, 0, 0, 0, 0);
+}
+
+/* r0 = the value of @map whose key is on the stack at @key */
+static void lookup(struct bpf_asm *a, int map, int key)
+{
+	load_map(a, BPF_REG_1, map);
+	mov_reg(a, BPF_REG_2, BPF_REG_10);
+	alu_imm(a, BPF_ADD, BPF_REG_2, key);
+	call(a, BPF_FUNC_map_lookup_elem);
+}
+
+/*
+ * r0 = the value of the hash @map whose key is on the stack at @key,
+ * added zeroed if missing. Jumps to @fail if it cannot be added.
+ */
+static void lookup_or_add(struct bpf_asm *a, int map, int key,
+			  size_t value_size, int fail)
+{
+	int found = new_label(a);
+	size_t off;
+
+	lookup(a, map, key);
+	jump_imm(a, BPF_JNE, BPF_REG_0, 0, found);
+
+	for (off = 0; off < value_size; off += sizeof(uint64_t))
+		store_imm(a, BPF_DW, BPF_REG_10, FP_ZERO + off, 0);
+	load_map(a, BPF_REG_1, map);
+	mov_reg(a, BPF_REG_2, BPF_REG_10);
+	alu_imm(a, BPF_ADD, BPF_REG_2, key);
+	mov_reg(a, BPF_REG_3, BPF_REG_10);
+	alu_imm(a, BPF_ADD, BPF_REG_3, FP_ZERO);
+	mov_imm(a, BPF_REG_4, BPF_NOEXIST);
+	call(a, BPF_FUNC_map_update_elem);
+
+	lookup(a, map, key);
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, fail);
+	set_label(a, found);
+}
+
+/* Update min and max at @min and @max of r0 with r1, using r2 */
+static void min_max(struct bpf_asm *a, int min, int max)
+{
+	int set_min = new_label(a), min_done = new_label(a);
+	int max_done = new_label(a);
+
+	load(a, BPF_DW, BPF_REG_2, BPF_REG_0, min);
+	jump_imm(a, BPF_JEQ, BPF_REG_2, 0, set_min);
+	jump_reg(a, BPF_JGE, BPF_REG_1, BPF_REG_2, min_done);
+	set_label(a, set_min);
+	store(a, BPF_DW, BPF_REG_0, min, BPF_REG_1);
+	set_label(a, min_done);
+
+	load(a, BPF_DW, BPF_REG_2, BPF_REG_0, max);
+	jump_reg(a, BPF_JLE, BPF_REG_1, BPF_REG_2, max_done);
+	store(a, BPF_DW, BPF_REG_0, max, BPF_REG_1);
+	set_label(a, max_done);
+}
+
+/*
+ * Same as min_max(), for the statistics any cpu may update: each bound
+ * is replaced with a compare and exchange, retried if another cpu
+ * changed it meanwhile. Uses r2 to r5.
+ */
+static void atomic_min_max(struct bpf_asm *a, int min, int max)
+{
+	int retry_min = new_label(a), set_min = new_label(a);
+	int min_done = new_label(a), retry_max = new_label(a);
+	int max_done = new_label(a);
+
+	mov_reg(a, BPF_REG_4, BPF_REG_0);
+
+	mov_imm(a, BPF_REG_5, BPF_CAS_TRIES);
+	set_label(a, retry_min);
+	load(a, BPF_DW, BPF_REG_0, BPF_REG_4, min);
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, set_min);
+	jump_reg(a, BPF_JGE, BPF_REG_1, BPF_REG_0, min_done);
+	set_label(a, set_min);
+	mov_reg(a, BPF_REG_3, BPF_REG_0);
+	atomic_cmpxchg(a, BPF_REG_4, min, BPF_REG_1);
+	jump_reg(a, BPF_JEQ, BPF_REG_0, BPF_REG_3, min_done);
+	alu_imm(a, BPF_SUB, BPF_REG_5, 1);
+	jump_imm(a, BPF_JNE, BPF_REG_5, 0, retry_min);
+	set_label(a, min_done);
+
+	mov_imm(a, BPF_REG_5, BPF_CAS_TRIES);
+	set_label(a, retry_max);
+	load(a, BPF_DW, BPF_REG_0, BPF_REG_4, max);
+	jump_reg(a, BPF_JLE, BPF_REG_1, BPF_REG_0, max_done);
+	mov_reg(a, BPF_REG_3, BPF_REG_0);
+	atomic_cmpxchg(a, BPF_REG_4, max, BPF_REG_1);
+	jump_reg(a, BPF_JEQ, BPF_REG_0, BPF_REG_3, max_done);
+	alu_imm(a, BPF_SUB, BPF_REG_5, 1);
+	jump_imm(a, BPF_JNE, BPF_REG_5, 0, retry_max);
+	set_label(a, max_done);
+
+	mov_reg(a, BPF_REG_0, BPF_REG_4);
+}
+
+/*
+ * Close a running interval of @delta ns of cpu r8 at frequency @freq.
+ * Both the cpu_idle program of the cpu and the cpu_frequency program
+ * of any cpu do, hence the atomic updates.
+ */
+static void account_pstate(struct bpf_asm *a, int freq, int delta)
+{
+	int done = new_label(a);
+
+	store(a, BPF_W, BPF_REG_10, FP_PAIR, BPF_REG_8);
+	store(a, BPF_W, BPF_REG_10, FP_PAIR + 4, freq);
+	store(a, BPF_DW, BPF_REG_10, FP_DELTA, delta);
+
+	lookup_or_add(a, BPF_MAP_PSTATES, FP_PAIR,
+		      sizeof(struct bpf_pstate_stat), done);
+
+	load(a, BPF_DW, BPF_REG_1, BPF_REG_10, FP_DELTA);
+	mov_imm(a, BPF_REG_2, 1);
+	atomic_add(a, BPF_REG_0, offsetof(struct bpf_pstate_stat, count),
+		   BPF_REG_2);
+	atomic_add(a, BPF_REG_0, offsetof(struct bpf_pstate_stat, sum),
+		   BPF_REG_1);
+	atomic_min_max(a, offsetof(struct bpf_pstate_stat, min),
+		       offsetof(struct bpf_pstate_stat, max));
+
+	set_label(a, done);
+}
+
+static void bpf_asm_begin(struct bpf_asm *a, int *maps)
+{
+	a->nr = 0;
+	a->nr_labels = 0;
+	a->maps = maps;
+	a->error = 0;
+}
+
+static int bpf_asm_end(struct bpf_asm *a)
+{
+	int i, target;
+
+	mov_imm(a, BPF_REG_0, 0);
+	emit(a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	if (a->error) {
+		fprintf(stderr, "%s: BPF program too large\n", __func__);
+		return -1;
+	}
+
+	for (i = 0; i < a->nr; i++) {
+		if (a->jumps[i] < 0)
+			continue;
+		target = a->labels[a->jumps[i]];
+		a->insns[i].off = target - i - 1;
+	}
+
+	return 0;
+}
+
+/*
+ * cpu_idle: close the C-state being left and account its residency,
+ * then open the new one. Entering idle closes the running interval of
+ * the current P-state, leaving idle opens a new one.
+ */
+static int assemble_cpu_idle(struct bpf_asm *a, int *maps, int state_off,
+			     int cpu_off)
+{
+	int out, begin, running, early_done;
+	const int cs_off_count = offsetof(struct bpf_cstate_stat, count);
+	const int cs_off_sum = offsetof(struct bpf_cstate_stat, sum);
+
+	bpf_asm_begin(a, maps);
+	out = new_label(a);
+	begin = new_label(a);
+	running = new_label(a);
+	early_done = new_label(a);
+
+	/* r7 = state, sign extended so that leaving idle is -1 */
+	mov_reg(a, BPF_REG_6, BPF_REG_1);
+	load(a, BPF_W, BPF_REG_7, BPF_REG_6, state_off);
+	alu_imm(a, BPF_LSH, BPF_REG_7, 32);
+	alu_imm(a, BPF_ARSH, BPF_REG_7, 32);
+	load(a, BPF_W, BPF_REG_8, BPF_REG_6, cpu_off);
+	call(a, BPF_FUNC_ktime_get_ns);
+	mov_reg(a, BPF_REG_9, BPF_REG_0);
+
+	/* r6 = state of this cpu */
+	store_imm(a, BPF_W, BPF_REG_10, FP_KEY, 0);
+	lookup(a, BPF_MAP_IDLE_STATE, FP_KEY);
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, out);
+	mov_reg(a, BPF_REG_6, BPF_REG_0);
+
+	/* Close the current C-state, unless it is entered again */
+	load(a, BPF_W, BPF_REG_1, BPF_REG_6,
+	     offsetof(struct bpf_idle_state, idle));
+	jump_imm(a, BPF_JEQ, BPF_REG_1, 0, begin);
+	load(a, BPF_W, BPF_REG_1, BPF_REG_6,
+	     offsetof(struct bpf_idle_state, state));
+	jump_reg(a, BPF_JEQ, BPF_REG_1, BPF_REG_7, out);
+	store_imm(a, BPF_W, BPF_REG_6, offsetof(struct bpf_idle_state, idle),
+		  0);
+
+	load(a, BPF_DW, BPF_REG_2, BPF_REG_6,
+	     offsetof(struct bpf_idle_state, enter));
+	mov_reg(a, BPF_REG_3, BPF_REG_9);
+	alu_reg(a, BPF_SUB, BPF_REG_3, BPF_REG_2);
+	jump_imm(a, BPF_JSLE, BPF_REG_3, 0, begin);
+	store(a, BPF_DW, BPF_REG_10, FP_DELTA, BPF_REG_3);
+
+	jump_imm(a, BPF_JGE, BPF_REG_1, MAXCSTATE, begin);
+	store(a, BPF_W, BPF_REG_10, FP_KEY, BPF_REG_1);
+	lookup(a, BPF_MAP_CSTATES, FP_KEY);
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, begin);
+
+	load(a, BPF_DW, BPF_REG_1, BPF_REG_10, FP_DELTA);
+	increment(a, BPF_REG_0, cs_off_count);
+	load(a, BPF_DW, BPF_REG_2, BPF_REG_0, cs_off_sum);
+	alu_reg(a, BPF_ADD, BPF_REG_2, BPF_REG_1);
+	store(a, BPF_DW, BPF_REG_0, cs_off_sum, BPF_REG_2);
+	min_max(a, offsetof(struct bpf_cstate_stat, min),
+		offsetof(struct bpf_cstate_stat, max));
+
+	/* Shorter than the target residency, or long enough for the next */
+	store_imm(a, BPF_W, BPF_REG_6,
+		  offsetof(struct bpf_idle_state, residency), as_expected);
+	load(a, BPF_DW, BPF_REG_2, BPF_REG_0,
+	     offsetof(struct bpf_cstate_stat, early_ns));
+	jump_reg(a, BPF_JGE, BPF_REG_1, BPF_REG_2, early_done);
+	increment(a, BPF_REG_0, offsetof(struct bpf_cstate_stat, early));
+	store_imm(a, BPF_W, BPF_REG_6,
+		  offsetof(struct bpf_idle_state, residency), too_short);
+	jump(a, begin);
+	set_label(a, early_done);
+	load(a, BPF_DW, BPF_REG_2, BPF_REG_0,
+	     offsetof(struct bpf_cstate_stat, late_ns));
+	jump_imm(a, BPF_JEQ, BPF_REG_2, 0, begin);
+	jump_reg(a, BPF_JLT, BPF_REG_1, BPF_REG_2, begin);
+	increment(a, BPF_REG_0, offsetof(struct bpf_cstate_stat, late));
+	store_imm(a, BPF_W, BPF_REG_6,
+		  offsetof(struct bpf_idle_state, residency), too_long);
+
+	/* Open the new C-state and arm the wakeup */
+	set_label(a, begin);
+	jump_imm(a, BPF_JEQ, BPF_REG_7, -1, running);
+	store(a, BPF_W, BPF_REG_6, offsetof(struct bpf_idle_state, state),
+	      BPF_REG_7);
+	store(a, BPF_DW, BPF_REG_6, offsetof(struct bpf_idle_state, enter),
+	      BPF_REG_9);
+	store_imm(a, BPF_W, BPF_REG_6, offsetof(struct bpf_idle_state, idle),
+		  1);
+	store_imm(a, BPF_W, BPF_REG_6, offsetof(struct bpf_idle_state, armed),
+		  1);
+
+	/*
+	 * The cpu stops running at its frequency: take the interval over.
+	 * The frequency is read first, a change racing with the swap can
+	 * only misattribute the few ns between the two.
+	 */
+	store(a, BPF_W, BPF_REG_10, FP_KEY, BPF_REG_8);
+	lookup(a, BPF_MAP_FREQ_STATE, FP_KEY);
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, out);
+	load(a, BPF_W, BPF_REG_1, BPF_REG_0,
+	     offsetof(struct bpf_freq_state, freq));
+	mov_imm(a, BPF_REG_2, 0);
+	atomic_xchg(a, BPF_REG_0, offsetof(struct bpf_freq_state, since),
+		    BPF_REG_2);
+	jump_imm(a, BPF_JEQ, BPF_REG_2, 0, out);
+	jump_imm(a, BPF_JEQ, BPF_REG_1, 0, out);
+	mov_reg(a, BPF_REG_3, BPF_REG_9);
+	alu_reg(a, BPF_SUB, BPF_REG_3, BPF_REG_2);
+	jump_imm(a, BPF_JSLE, BPF_REG_3, 0, out);
+	account_pstate(a, BPF_REG_1, BPF_REG_3);
+	jump(a, out);
+
+	/* The cpu runs again at its frequency */
+	set_label(a, running);
+	store(a, BPF_W, BPF_REG_10, FP_KEY, BPF_REG_8);
+	lookup(a, BPF_MAP_FREQ_STATE, FP_KEY);
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, out);
+	store(a, BPF_DW, BPF_REG_0, offsetof(struct bpf_freq_state, since),
+	      BPF_REG_9);
+
+	set_label(a, out);
+	return bpf_asm_end(a);
+}
+
+/*
+ * cpu_frequency: a running cpu closes the interval at its previous
+ * frequency and opens one at the new frequency. The event may be
+ * logged on any cpu, racing with the cpu entering idle: the interval
+ * is swapped with a compare and exchange, which fails if the cpu took
+ * it over meanwhile.
+ */
+static int assemble_cpu_frequency(struct bpf_asm *a, int *maps,
+				  int state_off, int cpu_off)
+{
+	int out, set, retry, close;
+
+	bpf_asm_begin(a, maps);
+	out = new_label(a);
+	set = new_label(a);
+	retry = new_label(a);
+	close = new_label(a);
+
+	mov_reg(a, BPF_REG_6, BPF_REG_1);
+	load(a, BPF_W, BPF_REG_7, BPF_REG_6, state_off);
+	load(a, BPF_W, BPF_REG_8, BPF_REG_6, cpu_off);
+	call(a, BPF_FUNC_ktime_get_ns);
+	mov_reg(a, BPF_REG_9, BPF_REG_0);
+
+	store(a, BPF_W, BPF_REG_10, FP_KEY, BPF_REG_8);
+	lookup(a, BPF_MAP_FREQ_STATE, FP_KEY);
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, out);
+	mov_reg(a, BPF_REG_6, BPF_REG_0);
+
+	/* r2 = start of the interval, replaced with now unless idle */
+	load(a, BPF_W, BPF_REG_1, BPF_REG_6,
+	     offsetof(struct bpf_freq_state, freq));
+	mov_imm(a, BPF_REG_4, BPF_CAS_TRIES);
+	set_label(a, retry);
+	load(a, BPF_DW, BPF_REG_0, BPF_REG_6,
+	     offsetof(struct bpf_freq_state, since));
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, set);
+	mov_reg(a, BPF_REG_2, BPF_REG_0);
+	mov_reg(a, BPF_REG_3, BPF_REG_9);
+	atomic_cmpxchg(a, BPF_REG_6, offsetof(struct bpf_freq_state, since),
+		       BPF_REG_3);
+	jump_reg(a, BPF_JEQ, BPF_REG_0, BPF_REG_2, close);
+	alu_imm(a, BPF_SUB, BPF_REG_4, 1);
+	jump_imm(a, BPF_JNE, BPF_REG_4, 0, retry);
+	jump(a, set);
+
+	set_label(a, close);
+	jump_imm(a, BPF_JEQ, BPF_REG_1, 0, set);
+	mov_reg(a, BPF_REG_3, BPF_REG_9);
+	alu_reg(a, BPF_SUB, BPF_REG_3, BPF_REG_2);
+	jump_imm(a, BPF_JSLE, BPF_REG_3, 0, set);
+	account_pstate(a, BPF_REG_1, BPF_REG_3);
+
+	set_label(a, set);
+	store(a, BPF_W, BPF_REG_6, offsetof(struct bpf_freq_state, freq),
+	      BPF_REG_7);
+
+	set_label(a, out);
+	return bpf_asm_end(a);
+}
+
+/* irq_handler_entry: the first irq after entering idle woke the cpu */
+static int assemble_irq_handler_entry(struct bpf_asm *a, int *maps,
+				      int irq_off)
+{
+	int out, not_early;
+
+	bpf_asm_begin(a, maps);
+	out = new_label(a);
+	not_early = new_label(a);
+
+	mov_reg(a, BPF_REG_6, BPF_REG_1);
+	load(a, BPF_W, BPF_REG_7, BPF_REG_6, irq_off);
+
+	store_imm(a, BPF_W, BPF_REG_10, FP_KEY, 0);
+	lookup(a, BPF_MAP_IDLE_STATE, FP_KEY);
+	jump_imm(a, BPF_JEQ, BPF_REG_0, 0, out);
+	load(a, BPF_W, BPF_REG_1, BPF_REG_0,
+	     offsetof(struct bpf_idle_state, armed));
+	jump_imm(a, BPF_JEQ, BPF_REG_1, 0, out);
+	store_imm(a, BPF_W, BPF_REG_0, offsetof(struct bpf_idle_state, armed),
+		  0);
+	load(a, BPF_W, BPF_REG_8, BPF_REG_0,
+	     offsetof(struct bpf_idle_state, residency));
+
+	call(a, BPF_FUNC_get_smp_processor_id);
+	store(a, BPF_W, BPF_REG_10, FP_PAIR, BPF_REG_0);
+	store(a, BPF_W, BPF_REG_10, FP_PAIR + 4, BPF_REG_7);
+	lookup_or_add(a, BPF_MAP_WAKEUPS, FP_PAIR,
+		      sizeof(struct bpf_wakeup_stat), out);
+
+	/* Only this cpu updates its wakeups */
+	increment(a, BPF_REG_0, offsetof(struct bpf_wakeup_stat, count));
+	jump_imm(a, BPF_JNE, BPF_REG_8, too_short, not_early);
+	increment(a, BPF_REG_0, offsetof(struct bpf_wakeup_stat, early));
+	jump(a, out);
+	set_label(a, not_early);
+	jump_imm(a, BPF_JNE, BPF_REG_8, too_long, out);
+	increment(a, BPF_REG_0, offsetof(struct bpf_wakeup_stat, late));
+
+	set_label(a, out);
+	return bpf_asm_end(a);
+}
+
+static int bpf_create_map(int type, size_t key_size, size_t value_size,
+			  int entries)
+{
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = type;
+	attr.key_size = key_size;
+	attr.value_size = value_size;
+	attr.max_entries = entries;
+
+	fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (fd < 0)
+		fprintf(stderr, "%s: failed to create BPF map: %m\n", __func__);
+	return fd;
+}
+
+static int bpf_map_lookup(int fd, const void *key, void *value)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = (uintptr_t)key;
+	attr.value = (uintptr_t)value;
+	return sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+static int bpf_map_update(int fd, const void *key, const void *value)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = (uintptr_t)key;
+	attr.value = (uintptr_t)value;
+	attr.flags = BPF_ANY;
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int bpf_map_next_key(int fd, const void *key, void *next)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = (uintptr_t)key;
+	attr.next_key = (uintptr_t)next;
+	return sys_bpf(BPF_MAP_GET_NEXT_KEY, &attr);
+}
+
+static int bpf_load_program(struct bpf_asm *a, const char *name)
+{
+	union bpf_attr attr;
+	char *log;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_TRACEPOINT;
+	attr.insns = (uintptr_t)a->insns;
+	attr.insn_cnt = a->nr;
+	attr.license = (uintptr_t)"GPL";
+
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd >= 0)
+		return fd;
+
+	/* Load again for the verifier to tell why */
+	fprintf(stderr, "%s: failed to load the %s program: %m\n",
+		__func__, name);
+	log = malloc(BPF_LOG_SIZE);
+	if (!log)
+		return -1;
+	log[0] = '\0';
+	attr.log_buf = (uintptr_t)log;
+	attr.log_size = BPF_LOG_SIZE;
+	attr.log_level = 1;
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd >= 0)
+		close(fd);
+	else
+		fprintf(stderr, "%s", log);
+	free(log);
+
+	return -1;
+}
+
+/* Number of cpus the per-cpu maps have a value for */
+static int bpf_possible_cpus(void)
+{
+	char buf[BUFSIZE], *p;
+	int last = -1;
+	FILE *f;
+
+	f = fopen("/sys/devices/system/cpu/possible", "r");
+	if (!f)
+		return sysconf(_SC_NPROCESSORS_CONF);
+
+	/* "0-7", "0,2-3": the highest cpu is listed last */
+	if (fgets(buf, sizeof(buf), f)) {
+		p = buf + strcspn(buf, "\n");
+		while (p > buf && p[-1] >= '0' && p[-1] <= '9')
+			p--;
+		last = atoi(p);
+	}
+	fclose(f);
+
+	return last + 1;
+}
+
+static int bpf_create_maps(struct bpf_capture *bc)
+{
+	int nrcpus = bc->datas->nrcpus;
+
+	bc->maps[BPF_MAP_IDLE_STATE] = bpf_create_map(
+		BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(uint32_t),
+		sizeof(struct bpf_idle_state), 1);
+	bc->maps[BPF_MAP_CSTATES] = bpf_create_map(
+		BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(uint32_t),
+		sizeof(struct bpf_cstate_stat), MAXCSTATE);
+	bc->maps[BPF_MAP_FREQ_STATE] = bpf_create_map(
+		BPF_MAP_TYPE_ARRAY, sizeof(uint32_t),
+		sizeof(struct bpf_freq_state), nrcpus);
+	bc->maps[BPF_MAP_PSTATES] = bpf_create_map(
+		BPF_MAP_TYPE_HASH, sizeof(struct bpf_key),
+		sizeof(struct bpf_pstate_stat),
+		nrcpus * BPF_MAX_PSTATES_PER_CPU);
+	bc->maps[BPF_MAP_WAKEUPS] = bpf_create_map(
+		BPF_MAP_TYPE_HASH, sizeof(struct bpf_key),
+		sizeof(struct bpf_wakeup_stat),
+		nrcpus * BPF_MAX_IRQS_PER_CPU);
+
+	return bc->maps[BPF_MAP_IDLE_STATE] < 0 ||
+		bc->maps[BPF_MAP_CSTATES] < 0 ||
+		bc->maps[BPF_MAP_FREQ_STATE] < 0 ||
+		bc->maps[BPF_MAP_PSTATES] < 0 ||
+		bc->maps[BPF_MAP_WAKEUPS] < 0 ? -1 : 0;
+}
+
+/*
+ * Give the programs the residency thresholds of each C-state and the
+ * frequency of each cpu when the capture starts.
+ */
+static int bpf_init_maps(struct bpf_capture *bc, struct init_pstates *initp,
+			 uint64_t start_ts)
+{
+	struct cpuidle_cstates *cstates;
+	struct bpf_cstate_stat *stats;
+	struct bpf_freq_state freq;
+	uint32_t key;
+	int cpu, tr, ret = 0;
+
+	stats = calloc(bc->nrpossible, sizeof(*stats));
+	if (!stats)
+		return error(__func__);
+
+	for (key = 0; !ret && key < MAXCSTATE; key++) {
+		for (cpu = 0; cpu < bc->nrpossible; cpu++) {
+			memset(&stats[cpu], 0, sizeof(stats[cpu]));
+			if (cpu >= bc->datas->nrcpus)
+				continue;
+
+			cstates = &bc->datas->cstates[cpu];
+			tr = cstates->cstate[key].target_residency;
+			if (tr > 0)
+				stats[cpu].early_ns = (uint64_t)tr *
+					NSEC_PER_USEC;
+			if (key + 1 >= MAXCSTATE ||
+			    !cstates->cstate[key + 1].name)
+				continue;
+			tr = cstates->cstate[key + 1].target_residency;
+			if (tr > 0)
+				stats[cpu].late_ns = (uint64_t)tr *
+					NSEC_PER_USEC;
+		}
+		ret = bpf_map_update(bc->maps[BPF_MAP_CSTATES], &key, stats);
+	}
+	free(stats);
+	if (ret)
+		return error("BPF_MAP_UPDATE_ELEM");
+
+	/* The cpus are taken as running, at a frequency maybe unknown */
+	for (key = 0; key < (uint32_t)bc->datas->nrcpus; key++) {
+		memset(&freq, 0, sizeof(freq));
+		if (initp && key < (uint32_t)initp->nrcpus)
+			freq.freq = initp->freqs[key];
+		freq.since = start_ts;
+		if (bpf_map_update(bc->maps[BPF_MAP_FREQ_STATE], &key, &freq))
+			return error("BPF_MAP_UPDATE_ELEM");
+	}
+
+	return 0;
+}
+
+static int bpf_load_programs(struct bpf_capture *bc)
+{
+	struct bpf_asm *a;
+	int value, cpu_id, ret = -1;
+
+	a = malloc(sizeof(*a));
+	if (!a)
+		return error(__func__);
+
+	if (raw_trace_event_fields(bc->rt, TRACE_EVENT_CPU_IDLE, &value,
+				   &cpu_id) < 0 || cpu_id < 0 ||
+	    assemble_cpu_idle(a, bc->maps, value, cpu_id))
+		goto out;
+	bc->progs[0] = bpf_load_program(a, "cpu_idle");
+	if (bc->progs[0] < 0)
+		goto out;
+
+	/* Without cpufreq or irq events, only the C-states are known */
+	if (raw_trace_event_fields(bc->rt, TRACE_EVENT_CPU_FREQUENCY, &value,
+				   &cpu_id) >= 0 && cpu_id >= 0) {
+		if (assemble_cpu_frequency(a, bc->maps, value, cpu_id))
+			goto out;
+		bc->progs[1] = bpf_load_program(a, "cpu_frequency");
+		if (bc->progs[1] < 0)
+			goto out;
+	}
+
+	if (raw_trace_event_fields(bc->rt, TRACE_EVENT_IRQ_HANDLER_ENTRY,
+				   &value, &cpu_id) >= 0) {
+		if (assemble_irq_handler_entry(a, bc->maps, value))
+			goto out;
+		bc->progs[2] = bpf_load_program(a, "irq_handler_entry");
+		if (bc->progs[2] < 0)
+			goto out;
+	}
+
+	ret = 0;
+out:
+	if (ret && bc->progs[0] < 0)
+		fprintf(stderr, "%s: cpu_idle event not available\n",
+			__func__);
+	free(a);
+	return ret;
+}
+
+static const int bpf_event_types[] = {
+	TRACE_EVENT_CPU_IDLE,
+	TRACE_EVENT_CPU_FREQUENCY,
+	TRACE_EVENT_IRQ_HANDLER_ENTRY,
+};
+
+/* Run the programs on the tracepoints of each online cpu */
+static int bpf_attach(struct bpf_capture *bc)
+{
+	struct perf_event_attr attr;
+	int nrcpus = bc->datas->nrcpus;
+	int cpu, i, id, fd;
+
+	bc->fds = malloc(nrcpus * 3 * sizeof(*bc->fds));
+	if (!bc->fds)
+		return error(__func__);
+
+	for (cpu = 0; cpu < nrcpus; cpu++) {
+		if (!cpu_is_online(bc->datas->topo, cpu))
+			continue;
+
+		for (i = 0; i < 3; i++) {
+			if (bc->progs[i] < 0)
+				continue;
+			id = raw_trace_event_id(bc->rt, bpf_event_types[i]);
+
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_TRACEPOINT;
+			attr.config = id;
+			attr.sample_period = 1;
+			attr.disabled = 1;
+
+			fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1,
+				     PERF_FLAG_FD_CLOEXEC);
+			if (fd < 0) {
+				fprintf(stderr, "%s: failed to open event %d "
+					"on cpu %d: %m\n", __func__, id, cpu);
+				return -1;
+			}
+			bc->fds[bc->nr_fds++] = fd;
+
+			if (ioctl(fd, PERF_EVENT_IOC_SET_BPF, bc->progs[i]))
+				return error("PERF_EVENT_IOC_SET_BPF");
+		}
+	}
+
+	return 0;
+}
+
+static void bpf_enable(struct bpf_capture *bc, unsigned long request)
+{
+	int i;
+
+	for (i = 0; i < bc->nr_fds; i++)
+		ioctl(bc->fds[i], request, 0);
+}
+
+static void bpf_capture_release(struct bpf_capture *bc)
+{
+	int i;
+
+	for (i = 0; i < bc->nr_fds; i++)
+		close(bc->fds[i]);
+	free(bc->fds);
+
+	for (i = 0; i < 3; i++)
+		if (bc->progs[i] >= 0)
+			close(bc->progs[i]);
+
+	for (i = 0; i < BPF_NR_MAPS; i++)
+		if (bc->maps[i] >= 0)
+			close(bc->maps[i]);
+
+	if (bc->datas)
+		raw_release_datas(bc->datas);
+	if (bc->rt)
+		raw_trace_close(bc->rt);
+	free(bc);
+}
+
+static int bpf_read_cstates(struct bpf_capture *bc)
+{
+	struct cpuidle_cstates *cstates;
+	struct cpuidle_cstate *cstate;
+	struct bpf_cstate_stat *stats, *st;
+	uint32_t key;
+	int cpu;
+
+	stats = calloc(bc->nrpossible, sizeof(*stats));
+	if (!stats)
+		return error(__func__);
+
+	for (key = 0; key < MAXCSTATE; key++) {
+		if (bpf_map_lookup(bc->maps[BPF_MAP_CSTATES], &key, stats)) {
+			free(stats);
+			return error("BPF_MAP_LOOKUP_ELEM");
+		}
+
+		for (cpu = 0; cpu < bc->datas->nrcpus &&
+			     cpu < bc->nrpossible; cpu++) {
+			st = &stats[cpu];
+			if (!st->count)
+				continue;
+
+			cstates = &bc->datas->cstates[cpu];
+			cstate = &cstates->cstate[key];
+			cstate->nrdata = st->count;
+			cstate->duration = st->sum;
+			cstate->min_time = st->min;
+			cstate->max_time = st->max;
+			cstate->early_wakings = st->early;
+			cstate->late_wakings = st->late;
+			if ((int)key > cstates->cstate_max)
+				cstates->cstate_max = key;
+		}
+	}
+
+	free(stats);
+	return 0;
+}
+
+static void bpf_add_pstate(struct cpuidle_datas *datas, int cpu,
+			   unsigned int freq, uint64_t count, uint64_t sum,
+			   uint64_t min, uint64_t max)
+{
+	struct cpufreq_pstate *p;
+
+	p = &datas->pstates[cpu].pstate[alloc_pstate(&datas->pstates[cpu],
+						      freq)];
+	p->count += count;
+	p->duration += sum;
+	if (min < p->min_time)
+		p->min_time = min;
+	if (max > p->max_time)
+		p->max_time = max;
+}
+
+static int bpf_read_pstates(struct bpf_capture *bc, uint64_t end_ts)
+{
+	struct bpf_key key, next, *prev = NULL;
+	struct bpf_pstate_stat st;
+	struct bpf_freq_state freq;
+	uint32_t cpu;
+	uint64_t d;
+
+	while (!bpf_map_next_key(bc->maps[BPF_MAP_PSTATES], prev, &next)) {
+		key = next;
+		prev = &key;
+		if (key.cpu >= (uint32_t)bc->datas->nrcpus ||
+		    bpf_map_lookup(bc->maps[BPF_MAP_PSTATES], &key, &st))
+			continue;
+		bpf_add_pstate(bc->datas, key.cpu, key.id, st.count, st.sum,
+			       st.min, st.max);
+	}
+
+	/* Close the intervals the cpus are still running */
+	for (cpu = 0; cpu < (uint32_t)bc->datas->nrcpus; cpu++) {
+		if (bpf_map_lookup(bc->maps[BPF_MAP_FREQ_STATE], &cpu, &freq))
+			return error("BPF_MAP_LOOKUP_ELEM");
+		if (!freq.freq || !freq.since ||
+		    end_ts <= freq.since)
+			continue;
+		d = end_ts - freq.since;
+		bpf_add_pstate(bc->datas, cpu, freq.freq, 1, d, d, d);
+	}
+
+	return 0;
+}
+
+/* Name of an irq, as shown by /proc/interrupts */
+static const char *bpf_irq_name(int irq)
+{
+	char line[BUFSIZE * 4], *p, *end;
+	const char *name = NULL;
+	FILE *f;
+
+	f = fopen("/proc/interrupts", "r");
+	if (f) {
+		while (!name && fgets(line, sizeof(line), f)) {
+			if (strtol(line, &p, 10) != irq || p == line ||
+			    *p != ':')
+				continue;
+
+			/* The handlers are listed last */
+			end = line + strcspn(line, "\n");
+			while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+				end--;
+			p = end;
+			while (p > line && p[-1] != ' ' && p[-1] != '\t')
+				p--;
+			if (p < end)
+				name = intern_string(p, end - p);
+		}
+		fclose(f);
+	}
+
+	if (!name) {
+		snprintf(line, sizeof(line), "irq%d", irq);
+		name = intern_string(line, strlen(line));
+	}
+
+	return name;
+}
+
+static int bpf_read_wakeups(struct bpf_capture *bc)
+{
+	struct bpf_key key, next, *prev = NULL;
+	struct bpf_wakeup_stat st;
+	const char *name;
+
+	while (!bpf_map_next_key(bc->maps[BPF_MAP_WAKEUPS], prev, &next)) {
+		key = next;
+		prev = &key;
+		if (key.cpu >= (uint32_t)bc->datas->nrcpus ||
+		    bpf_map_lookup(bc->maps[BPF_MAP_WAKEUPS], &key, &st))
+			continue;
+
+		name = bpf_irq_name(key.id);
+		if (!name)
+			return -1;
+		if (add_wakeup_irq(key.cpu, key.id, name, st.count, st.early,
+				   st.late, bc->datas))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * bpf_capture_start - aggregate the idle statistics in the kernel
+ * @tracing_dir: e.g. /sys/kernel/debug/tracing, for the event formats
+ * @initp: P-states of the cpus when the capture starts, or NULL
+ *
+ * The global ftrace state is neither read nor changed.
+ *
+ * @return: the capture (success) or ptrerror() (error)
+ */
+struct bpf_capture *bpf_capture_start(const char *tracing_dir,
+				      struct init_pstates *initp)
+{
+	struct bpf_capture *bc;
+	int i;
+
+	bc = calloc(1, sizeof(*bc));
+	if (!bc)
+		return ptrerror(__func__);
+
+	for (i = 0; i < BPF_NR_MAPS; i++)
+		bc->maps[i] = -1;
+	for (i = 0; i < 3; i++)
+		bc->progs[i] = -1;
+	bc->nrpossible = bpf_possible_cpus();
+
+	bc->rt = raw_trace_open(tracing_dir);
+	if (is_err(bc->rt)) {
+		bc->rt = NULL;
+		goto out_release;
+	}
+
+	bc->datas = raw_capture_datas();
+	if (is_err(bc->datas)) {
+		bc->datas = NULL;
+		goto out_release;
+	}
+
+	bc->start_ts = bpf_clock_ns();
+	if (bpf_create_maps(bc) || bpf_init_maps(bc, initp, bc->start_ts) ||
+	    bpf_load_programs(bc) || bpf_attach(bc))
+		goto out_release;
+
+	bpf_enable(bc, PERF_EVENT_IOC_ENABLE);
+
+	return bc;
+
+out_release:
+	bpf_capture_release(bc);
+	return ptrerror(NULL);
+}
+
+/**
+ * bpf_capture_stop - stop the capture and read its statistics
+ * @bc: the capture, freed
+ *
+ * Only the per-cpu statistics are available: the cluster and core
+ * states, which idlestat derives from the intervals of their cpus, are
+ * only filled for the groups of a single cpu.
+ *
+ * @return: per-trace statistics (success) or ptrerror() (error)
+ */
+struct cpuidle_datas *bpf_capture_stop(struct bpf_capture *bc)
+{
+	struct cpuidle_datas *datas;
+	uint64_t end_ts;
+
+	bpf_enable(bc, PERF_EVENT_IOC_DISABLE);
+	end_ts = bpf_clock_ns();
+
+	if (bpf_read_cstates(bc) || bpf_read_pstates(bc, end_ts) ||
+	    bpf_read_wakeups(bc) || setup_topo_states(bc->datas)) {
+		bpf_capture_release(bc);
+		return ptrerror(NULL);
+	}
+	copy_single_cpu_groups(bc->datas->topo);
+
+	datas = bc->datas;
+	bc->datas = NULL;
+	bpf_capture_release(bc);
+
+	return datas;
+}
@@ -0,0 +1,487 @@
+/*
+ *  trace_event.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * Tokenizer for the text event lines shared by the ftrace, trace-cmd
+ * report and idlestat trace file formats:
+ *
+ *   <comm>-<pid> [<cpu>] [<flags>] <sec>.<frac>: <event>: <arguments>
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "intern.h"
+#include "trace_event.h"
+
+#define NSEC_DIGITS 9
+
+static inline bool is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char *skip_blanks(const char *p, const char *end)
+{
+	while (p < end && is_blank(*p))
+		p++;
+	return p;
+}
+
+static inline const char *skip_token(const char *p, const char *end)
+{
+	while (p < end && !is_blank(*p))
+		p++;
+	return p;
+}
+
+/*
+ * Parse a decimal integer, with the same wrap-around semantics as
+ * sscanf("%u"): "state=4294967295" and "state=-1" both yield -1 once
+ * the result is converted to int.
+ */
+static const char *parse_uint(const char *p, const char *end,
+			      unsigned int *val)
+{
+	unsigned int v = 0;
+	bool neg = false;
+	const char *start;
+
+	if (p < end && *p == '-') {
+		neg = true;
+		p++;
+	}
+
+	start = p;
+	while (p < end && is_digit(*p))
+		v = v * 10 + (*p++ - '0');
+
+	if (p == start)
+		return NULL;
+
+	*val = neg ? -v : v;
+	return p;
+}
+
+/**
+ * parse_timestamp_ns - parse a "<sec>.<frac>" timestamp into nanoseconds
+ * @p: first character of the timestamp
+ * @end: end of the timestamp
+ * @ns: result
+ *
+ * Leading blanks are skipped. Fractional digits beyond the nanosecond
+ * are ignored.
+ *
+ * @return: 0 on success, -1 if the text is not a timestamp
+ */
+int parse_timestamp_ns(const char *p, const char *end, uint64_t *ns)
+{
+	uint64_t sec = 0, frac = 0;
+	int nfrac = 0;
+	const char *start;
+
+	p = skip_blanks(p, end);
+	start = p;
+	while (p < end && is_digit(*p))
+		sec = sec * 10 + (*p++ - '0');
+
+	if (p == start)
+		return -1;
+
+	if (p < end && *p == '.') {
+		for (p++; p < end && is_digit(*p); p++) {
+			if (nfrac < NSEC_DIGITS) {
+				frac = frac * 10 + (*p - '0');
+				nfrac++;
+			}
+		}
+	}
+
+	for (; nfrac < NSEC_DIGITS; nfrac++)
+		frac *= 10;
+
+	*ns = sec * 1000000000ULL + frac;
+
+	p = skip_blanks(p, end);
+	return (p == end || *p == '\n') ? 0 : -1;
+}
+
+/* Locate the value of "<key>=" among blank separated arguments */
+static const char *find_arg(const char *p, const char *end,
+			    const char *key, size_t keylen)
+{
+	while (p < end) {
+		p = skip_blanks(p, end);
+		if ((size_t)(end - p) > keylen && p[keylen] == '=' &&
+		    !memcmp(p, key, keylen))
+			return p + keylen + 1;
+		p = skip_token(p, end);
+	}
+
+	return NULL;
+}
+
+#define FIND_ARG(p, end, key) find_arg(p, end, key, sizeof(key) - 1)
+
+static int parse_state_args(const char *p, const char *end,
+			    struct trace_event *ev)
+{
+	const char *v;
+	unsigned int cpu_id;
+
+	v = FIND_ARG(p, end, "state");
+	if (!v || !parse_uint(v, end, &ev->value))
+		return -1;
+
+	v = FIND_ARG(v, end, "cpu_id");
+	if (!v || !parse_uint(v, end, &cpu_id))
+		return -1;
+
+	ev->cpu_id = cpu_id;
+	return 0;
+}
+
+static int parse_irq_args(const char *p, const char *end,
+			  struct trace_event *ev)
+{
+	const char *v;
+
+	v = FIND_ARG(p, end, "irq");
+	if (!v || !parse_uint(v, end, &ev->value))
+		return -1;
+
+	/* The name is the last argument and may contain blanks */
+	v = FIND_ARG(v, end, "name");
+	if (!v || v == end)
+		return -1;
+
+	ev->name = v;
+	ev->namelen = end - v;
+	return 0;
+}
+
+static int parse_ipi_args(const char *p, const char *end,
+			  struct trace_event *ev)
+{
+	const char *close;
+
+	/* "(<reason>)" */
+	p = skip_blanks(p, end);
+	if (p == end || *p != '(')
+		return -1;
+	p++;
+
+	for (close = end; close > p && close[-1] != ')'; close--)
+		;
+	if (close > p)
+		close--;
+	else
+		close = end;
+
+	if (close == p)
+		return -1;
+
+	ev->name = p;
+	ev->namelen = close - p;
+	return 0;
+}
+
+/*
+ * The marks written where the events of a cpu were lost, by ftrace and
+ * by trace-cmd report respectively:
+ *
+ *   CPU:<cpu> [LOST <count> EVENTS]
+ *   CPU:<cpu> [<count> EVENTS DROPPED]
+ *
+ * The count is missing when it is not known. The mark has no timestamp,
+ * it stands before the next event of the cpu.
+ */
+static int decode_lost_events(const char *p, const char *end,
+			      struct trace_event *ev)
+{
+	const char *close;
+	unsigned int cpu, count = 0;
+
+	p = parse_uint(p, end, &cpu);
+	if (!p)
+		return 0;
+
+	p = skip_blanks(p, end);
+	if (p == end || *p != '[' || end[-1] != ']')
+		return 0;
+	p++;
+	close = end - 1;
+
+	if (close - p >= 4 && !memcmp(p, "LOST", 4)) {
+		p = skip_blanks(p + 4, close);
+		if (close - p < 6 || memcmp(close - 6, "EVENTS", 6))
+			return 0;
+	} else if (close - p < 14 || memcmp(close - 14, "EVENTS DROPPED", 14)) {
+		return 0;
+	}
+
+	if (p < close && is_digit(*p))
+		parse_uint(p, close, &count);
+
+	ev->time = 0;
+	ev->type = TRACE_EVENT_LOST;
+	ev->cpu = cpu;
+	ev->cpu_id = -1;
+	ev->value = count;
+	ev->name = NULL;
+	ev->namelen = 0;
+
+	return ev->type;
+}
+
+/**
+ * decode_clock_sync_mark - decode the text of a clock synchronization mark
+ * @p: start of the text written to trace_marker
+ * @end: end of the text
+ * @ev: event to fill the type and CLOCK_MONOTONIC time of
+ *
+ * The mark reads "idlestat_clock_sync mono=<ns>", see idlestat_wake_all(),
+ * or "idlestat_clock_sync synced" if the cpus share the trace clock, in
+ * which case @ev->mono is 0.
+ *
+ * @return: TRACE_EVENT_CLOCK_SYNC if the text is such a mark, 0 otherwise
+ */
+int decode_clock_sync_mark(const char *p, const char *end,
+			   struct trace_event *ev)
+{
+	size_t len = sizeof(TRACE_CLOCK_SYNC_MARK) - 1;
+	const char *v;
+	uint64_t mono = 0;
+
+	p = skip_blanks(p, end);
+	if ((size_t)(end - p) <= len || memcmp(p, TRACE_CLOCK_SYNC_MARK, len) ||
+	    !is_blank(p[len]))
+		return 0;
+
+	v = skip_blanks(p + len, end);
+	if ((size_t)(end - v) >= sizeof(TRACE_CLOCK_SYNCED) - 1 &&
+	    !memcmp(v, TRACE_CLOCK_SYNCED, sizeof(TRACE_CLOCK_SYNCED) - 1)) {
+		ev->type = TRACE_EVENT_CLOCK_SYNC;
+		ev->mono = 0;
+		return ev->type;
+	}
+
+	v = FIND_ARG(p + len, end, "mono");
+	if (!v || v == end || !is_digit(*v))
+		return 0;
+
+	while (v < end && is_digit(*v))
+		mono = mono * 10 + (*v++ - '0');
+
+	ev->type = TRACE_EVENT_CLOCK_SYNC;
+	ev->mono = mono;
+	return ev->type;
+}
+
+#define EVENT_IS(name, len, str) \
+	((len) == sizeof(str) - 1 && !memcmp(name, str, sizeof(str) - 1))
+
+/**
+ * decode_trace_event - decode one text trace line in a single pass
+ * @line: start of the line, need not be NUL terminated
+ * @len: length of the line, with or without the trailing newline
+ * @ev: decoded event
+ *
+ * The line is walked once to locate the [cpu], timestamp and event
+ * name fields. The event name selects how the arguments are decoded.
+ * The marks of lost events are decoded as TRACE_EVENT_LOST, the clock
+ * synchronization marks written to trace_marker as TRACE_EVENT_CLOCK_SYNC.
+ * Nothing is printed, so lines may be decoded on several threads.
+ *
+ * @return: the event type (> 0) if @ev was filled, 0 if the line does
+ * not hold an event idlestat is interested in, -1 if the line holds
+ * such an event but it could not be decoded, in which case @ev->type
+ * is set to the type of the event
+ */
+int decode_trace_event(const char *line, size_t len, struct trace_event *ev)
+{
+	const char *p = line, *end = line + len, *tok, *name;
+	unsigned int cpu;
+	int namelen, ret;
+
+	while (end > p && (end[-1] == '\n' || end[-1] == '\r' ||
+			   is_blank(end[-1])))
+		end--;
+
+	if (end - p > 4 && !memcmp(p, "CPU:", 4))
+		return decode_lost_events(p + 4, end, ev);
+
+	/* Find the "[<cpu>]" field */
+	for (;;) {
+		p = memchr(p, '[', end - p);
+		if (!p)
+			return 0;
+		p++;
+		if (p < end && is_digit(*p))
+			break;
+	}
+
+	p = parse_uint(p, end, &cpu);
+	if (!p || p == end || *p != ']')
+		return 0;
+	p++;
+
+	/* Timestamp, optionally preceded by the latency flags */
+	p = skip_blanks(p, end);
+	tok = p;
+	p = skip_token(p, end);
+	if (p == tok || p[-1] != ':') {
+		p = skip_blanks(p, end);
+		tok = p;
+		p = skip_token(p, end);
+		if (p == tok || p[-1] != ':')
+			return 0;
+	}
+
+	if (parse_timestamp_ns(tok, p - 1, &ev->time))
+		return 0;
+
+	/* Event name */
+	p = skip_blanks(p, end);
+	name = p;
+	while (p < end && *p != ':' && !is_blank(*p))
+		p++;
+	if (p == end || *p != ':')
+		return 0;
+	namelen = p - name;
+	p++;
+
+	ev->cpu = cpu;
+	ev->cpu_id = -1;
+	ev->name = NULL;
+	ev->namelen = 0;
+
+	if (EVENT_IS(name, namelen, "cpu_idle")) {
+		ev->type = TRACE_EVENT_CPU_IDLE;
+		ret = parse_state_args(p, end, ev);
+	} else if (EVENT_IS(name, namelen, "cpu_frequency")) {
+		ev->type = TRACE_EVENT_CPU_FREQUENCY;
+		ret = parse_state_args(p, end, ev);
+	} else if (EVENT_IS(name, namelen, "irq_handler_entry")) {
+		ev->type = TRACE_EVENT_IRQ_HANDLER_ENTRY;
+		ret = parse_irq_args(p, end, ev);
+	} else if (EVENT_IS(name, namelen, "ipi_entry")) {
+		ev->type = TRACE_EVENT_IPI_ENTRY;
+		ret = parse_ipi_args(p, end, ev);
+	} else if (EVENT_IS(name, namelen, "tracing_mark_write")) {
+		return decode_clock_sync_mark(p, end, ev);
+	} else {
+		return 0;
+	}
+
+	return ret ? -1 : ev->type;
+}
+
+/**
+ * warn_trace_event - report an event decode_trace_event() failed on
+ * @type: the type of the event
+ */
+void warn_trace_event(int type)
+{
+	switch (type) {
+	case TRACE_EVENT_CPU_IDLE:
+		fprintf(stderr, "warning: Unrecognized cpuidle "
+			"record. The result of analysis might "
+			"be wrong.\n");
+		break;
+	case TRACE_EVENT_CPU_FREQUENCY:
+		fprintf(stderr, "warning: Unrecognized cpufreq "
+			"record. The result of analysis might "
+			"be wrong.\n");
+		break;
+	case TRACE_EVENT_IRQ_HANDLER_ENTRY:
+		fprintf(stderr, "warning: Unrecognized "
+			"irq_handler_entry record skipped.\n");
+		break;
+	case TRACE_EVENT_IPI_ENTRY:
+		fprintf(stderr, "warning: Unrecognized ipi_entry "
+			"record skipped\n");
+		break;
+	}
+}
+
+/**
+ * save_trace_event - keep an event whose name points into a buffer
+ * @se: where the event is kept, may be moved around afterwards
+ * @ev: the event
+ *
+ * The name is copied next to the event, or interned if it does not fit.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int save_trace_event(struct saved_trace_event *se,
+		     const struct trace_event *ev)
+{
+	se->ev = *ev;
+	se->copied = 0;
+
+	if (!ev->name)
+		return 0;
+
+	if (ev->namelen >= 0 && ev->namelen <= TRACE_EVENT_NAME_MAX) {
+		memcpy(se->name, ev->name, ev->namelen);
+		se->copied = 1;
+		return 0;
+	}
+
+	se->ev.name = intern_string(ev->name, ev->namelen);
+	return se->ev.name ? 0 : -1;
+}
+
+/**
+ * restore_trace_event - get back an event kept by save_trace_event()
+ * @se: the event kept
+ * @ev: set to the event, whose name is valid as long as @se is
+ */
+void restore_trace_event(const struct saved_trace_event *se,
+			 struct trace_event *ev)
+{
+	*ev = se->ev;
+	if (se->copied)
+		ev->name = se->name;
+}
+
+/**
+ * parse_trace_event - decode one text trace line, see decode_trace_event()
+ *
+ * A warning is printed if the line holds an event of interest which
+ * could not be decoded.
+ */
+int parse_trace_event(const char *line, size_t len, struct trace_event *ev)
+{
+	int ret;
+
+	ret = decode_trace_event(line, len, ev);
+	if (ret < 0)
+		warn_trace_event(ev->type);
+
+	return ret;
+}
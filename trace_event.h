@@ -0,0 +1,96 @@
+/*
+ *  trace_event.h
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef __TRACE_EVENT_H
+#define __TRACE_EVENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct cpuidle_datas;
+
+enum trace_event_type {
+	TRACE_EVENT_NONE = 0,
+	TRACE_EVENT_CPU_IDLE,
+	TRACE_EVENT_CPU_FREQUENCY,
+	TRACE_EVENT_IRQ_HANDLER_ENTRY,
+	TRACE_EVENT_IPI_ENTRY,
+	TRACE_EVENT_LOST,
+	TRACE_EVENT_CLOCK_SYNC,
+};
+
+/* Written to trace_marker by idlestat_wake_all() on each cpu it visits */
+#define TRACE_CLOCK_SYNC_MARK "idlestat_clock_sync"
+#define TRACE_CLOCK_SYNC_NRMARKS 3
+/* Argument of the single mark written when the cpus share the clock */
+#define TRACE_CLOCK_SYNCED "synced"
+
+/*
+ * A single decoded trace event, independent of the format it was read
+ * from. The meaning of @value depends on @type: C-state for cpu_idle,
+ * frequency for cpu_frequency, irq number for irq_handler_entry and
+ * number of events lost on @cpu, 0 if unknown, for TRACE_EVENT_LOST.
+ * @name points into the source buffer and is not NUL terminated.
+ * @mono is the CLOCK_MONOTONIC time a TRACE_EVENT_CLOCK_SYNC mark was
+ * written at, to be compared with the trace clock of @cpu, or 0 if the
+ * mark tells the trace clock is the same on all cpus.
+ */
+struct trace_event {
+	uint64_t time;		/* ns */
+	int type;
+	int cpu;		/* cpu the event was logged on */
+	int cpu_id;		/* cpu affected by cpu_idle/cpu_frequency */
+	unsigned int value;
+	const char *name;
+	int namelen;
+	uint64_t mono;		/* ns */
+};
+
+/* Room for the name of an event kept after its source buffer is reused */
+#define TRACE_EVENT_NAME_MAX 32
+
+/*
+ * An event kept beyond the buffer it was decoded from, with its own copy
+ * of the name, see save_trace_event(). The copy is only interned if the
+ * analysis keeps the name.
+ */
+struct saved_trace_event {
+	struct trace_event ev;
+	int copied;		/* the name is in @name */
+	char name[TRACE_EVENT_NAME_MAX];
+};
+
+extern int save_trace_event(struct saved_trace_event *se,
+			    const struct trace_event *ev);
+extern void restore_trace_event(const struct saved_trace_event *se,
+				struct trace_event *ev);
+extern int parse_timestamp_ns(const char *p, const char *end, uint64_t *ns);
+extern int decode_trace_event(const char *line, size_t len,
+			      struct trace_event *ev);
+extern int decode_clock_sync_mark(const char *p, const char *end,
+				  struct trace_event *ev);
+extern void warn_trace_event(int type);
+extern int parse_trace_event(const char *line, size_t len,
+			     struct trace_event *ev);
+extern int store_trace_event(struct cpuidle_datas *datas,
+			     struct trace_event *ev);
+
+#endif
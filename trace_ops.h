@@ -27,17 +27,31 @@
 #define __TRACE_OPS_H
 
 #include <stdio.h>
+#include <stdint.h>
 
 struct cpuidle_datas;
+struct cpuidle_cstates;
+struct cpu_topology;
+struct trace_event;
+struct line_reader;
 
+/*
+ * @reader reads the trace from its first line. It is NULL when the trace
+ * is a directory, such as a raw capture.
+ */
 struct trace_ops {
 	const char *name;
-	int (*check_magic)(const char *filename);
-	struct cpuidle_datas *(*load)(const char *filename);
+	int (*check_magic)(const char *filename, struct line_reader *reader);
+	struct cpuidle_datas *(*load)(const char *filename,
+				      struct line_reader *reader);
 };
 
-extern int load_text_data_line(char *buffer, struct cpuidle_datas *datas, char *format, double *begin, double *end, size_t *start);
-extern void load_text_data_lines(FILE *f, char *buffer, struct cpuidle_datas *datas);
+extern int load_trace_event(struct trace_event *ev, struct cpuidle_datas *datas, uint64_t *begin, uint64_t *end, size_t *start);
+extern size_t flush_trace_events(struct cpuidle_datas *datas, uint64_t *begin, uint64_t *end, size_t *start);
+extern int load_text_data_line(const char *line, size_t len, struct cpuidle_datas *datas, uint64_t *begin, uint64_t *end, size_t *start);
+extern int load_text_data_lines(struct line_reader *reader, struct cpuidle_datas *datas);
+extern int check_trace_magic(struct line_reader *reader, const char *magic);
+extern struct cpuidle_cstates *load_and_build_cstate_info(struct line_reader *reader, char *buffer, int nrcpus, struct cpu_topology *topo);
 
 #define EXPORT_TRACE_OPS(tracetype_name)			\
 	static const struct trace_ops				\
@@ -0,0 +1,576 @@
+/*
+ *  trace_perf.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * Capture backend reading the tracepoints of interest with
+ * perf_event_open(). Each cpu has its own perf ring buffer, which is
+ * private to idlestat. The global ftrace state (tracing_on, the buffer
+ * size, the enabled events) is neither read nor changed. The format
+ * files of the tracing directory are still needed to decode the
+ * samples, which carry the same payload as the ftrace ring buffer.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "intern.h"
+#include "idlestat.h"
+#include "topology.h"
+#include "trace_event.h"
+#include "trace_perf.h"
+#include "trace_raw.h"
+#include "utils.h"
+
+/* Smallest perf ring buffer, in pages besides the control page */
+#define PERF_MIN_DATA_PAGES	8
+
+static const int perf_event_types[] = {
+	TRACE_EVENT_CPU_IDLE,
+	TRACE_EVENT_CPU_FREQUENCY,
+	TRACE_EVENT_IRQ_HANDLER_ENTRY,
+	TRACE_EVENT_IPI_ENTRY,
+};
+
+#define PERF_NR_EVENTS \
+	(int)(sizeof(perf_event_types) / sizeof(perf_event_types[0]))
+
+/* The PERF_SAMPLE_TIME | PERF_SAMPLE_RAW sample layout */
+struct perf_sample {
+	struct perf_event_header header;
+	uint64_t time;
+	uint32_t size;
+	char data[];
+};
+
+struct perf_lost {
+	struct perf_event_header header;
+	uint64_t id;
+	uint64_t lost;
+};
+
+struct perf_cpu {
+	int cpu;
+	int fds[PERF_NR_EVENTS];
+	int nr_fds;
+	struct perf_event_mmap_page *meta;	/* control page of the ring */
+	char *data;
+	size_t data_size;			/* power of two */
+	uint64_t lost;
+	struct raw_stream stream;		/* decoded samples */
+};
+
+struct perf_capture {
+	struct raw_trace *rt;
+	struct perf_cpu *cpus;
+	int nrcpus;
+	size_t map_size;
+	int interval;		/* ms between drains, -1 for none */
+	int stop[2];		/* closing stop[1] ends the drain */
+	pthread_t thread;
+	int started;
+	int error;
+	char *record;		/* copy of a record wrapping around a ring */
+	size_t record_size;
+	uint64_t start_ts;
+	int count_lost;		/* the kernel counts the lost samples */
+};
+
+static uint64_t perf_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int perf_event_open(struct perf_event_attr *attr, int cpu,
+			   int group_fd)
+{
+	return syscall(__NR_perf_event_open, attr, -1, cpu, group_fd,
+		       PERF_FLAG_FD_CLOEXEC);
+}
+
+static int perf_store_sample(struct perf_capture *pc, struct perf_cpu *pcpu,
+			     const struct perf_sample *sample)
+{
+	struct trace_event ev;
+	int ret;
+
+	ret = raw_trace_decode_event(pc->rt, pcpu->cpu, sample->time,
+				     sample->data, sample->size, &ev);
+	if (ret < 0)
+		warn_trace_event(ev.type);
+	if (ret <= 0)
+		return 0;
+
+	/* The ring is reused, keep the name */
+	if (ev.name) {
+		ev.name = intern_string(ev.name, ev.namelen);
+		if (!ev.name)
+			return -1;
+	}
+
+	return raw_stream_add_event(&ev, &pcpu->stream);
+}
+
+/*
+ * Mark where samples were lost in the stream of the cpu, after the last
+ * sample before them, or at @time if there is none.
+ */
+static int perf_store_lost(struct perf_capture *pc, struct perf_cpu *pcpu,
+			   uint64_t lost, uint64_t time)
+{
+	struct raw_stream *rs = &pcpu->stream;
+	struct trace_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.time = rs->nr_events ? rs->events[rs->nr_events - 1].time :
+		MAX(time, pc->start_ts);
+	ev.type = TRACE_EVENT_LOST;
+	ev.cpu = pcpu->cpu;
+	ev.cpu_id = -1;
+	ev.value = MIN(lost, UINT_MAX);
+
+	return raw_stream_add_event(&ev, rs);
+}
+
+static int perf_store_record(struct perf_capture *pc, struct perf_cpu *pcpu,
+			     const struct perf_event_header *header)
+{
+	const struct perf_sample *sample;
+	uint64_t lost;
+
+	switch (header->type) {
+	case PERF_RECORD_SAMPLE:
+		sample = (const struct perf_sample *)header;
+		if (header->size < sizeof(*sample) ||
+		    offsetof(struct perf_sample, data) + sample->size >
+		    header->size)
+			return 0;
+		return perf_store_sample(pc, pcpu, sample);
+
+	case PERF_RECORD_LOST:
+		if (header->size < sizeof(struct perf_lost))
+			return 0;
+		lost = ((const struct perf_lost *)header)->lost;
+		pcpu->lost += lost;
+		return perf_store_lost(pc, pcpu, lost, 0);
+	}
+
+	return 0;
+}
+
+/* Decode the records written to the ring of a cpu since the last drain */
+static int perf_drain_cpu(struct perf_capture *pc, struct perf_cpu *pcpu)
+{
+	const struct perf_event_header *header;
+	uint64_t head, tail;
+	size_t off, len, first;
+	char *tmp;
+	int ret = 0;
+
+	head = __atomic_load_n(&pcpu->meta->data_head, __ATOMIC_ACQUIRE);
+	tail = pcpu->meta->data_tail;
+
+	while (!ret && tail < head) {
+		/* Records are 8 byte aligned, headers never wrap */
+		off = tail & (pcpu->data_size - 1);
+		header = (const struct perf_event_header *)(pcpu->data + off);
+		len = header->size;
+		if (!len)
+			break;
+
+		if (off + len > pcpu->data_size) {
+			if (len > pc->record_size) {
+				tmp = realloc(pc->record, len);
+				if (!tmp) {
+					ret = error(__func__);
+					break;
+				}
+				pc->record = tmp;
+				pc->record_size = len;
+			}
+			first = pcpu->data_size - off;
+			memcpy(pc->record, pcpu->data + off, first);
+			memcpy(pc->record + first, pcpu->data, len - first);
+			header = (const struct perf_event_header *)pc->record;
+		}
+
+		ret = perf_store_record(pc, pcpu, header);
+		tail += len;
+	}
+
+	__atomic_store_n(&pcpu->meta->data_tail, tail, __ATOMIC_RELEASE);
+
+	return ret;
+}
+
+static int perf_drain(struct perf_capture *pc)
+{
+	int i;
+
+	for (i = 0; i < pc->nrcpus; i++)
+		if (pc->cpus[i].meta && perf_drain_cpu(pc, &pc->cpus[i]))
+			return -1;
+
+	return 0;
+}
+
+static void *perf_drain_thread(void *arg)
+{
+	struct perf_capture *pc = arg;
+	struct pollfd fd = { .fd = pc->stop[0], .events = POLLIN };
+
+	/* The rings are not polled, only the timer wakes us up */
+	for (;;) {
+		if (poll(&fd, 1, pc->interval) < 0 && errno != EINTR)
+			break;
+		if (fd.revents)
+			break;
+		if (perf_drain(pc)) {
+			pc->error = -1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Samples of a cpu are written in time order, except for an event
+ * nested in the recording of another one. Put these few back in place.
+ */
+static void perf_sort_stream(struct raw_stream *rs)
+{
+	struct trace_event ev;
+	size_t i, j;
+
+	for (i = 1; i < rs->nr_events; i++) {
+		if (rs->events[i].time >= rs->events[i - 1].time)
+			continue;
+
+		ev = rs->events[i];
+		for (j = i; j > 0 && rs->events[j - 1].time > ev.time; j--)
+			rs->events[j] = rs->events[j - 1];
+		rs->events[j] = ev;
+	}
+}
+
+static int perf_open_cpu(struct perf_capture *pc, struct perf_cpu *pcpu)
+{
+	struct perf_event_attr attr;
+	void *map;
+	int i, id, fd;
+
+	for (i = 0; i < PERF_NR_EVENTS; i++) {
+		id = raw_trace_event_id(pc->rt, perf_event_types[i]);
+		if (id < 0)
+			continue;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_TRACEPOINT;
+		attr.config = id;
+		attr.sample_period = 1;
+		attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+		attr.disabled = 1;
+		attr.use_clockid = 1;
+		attr.clockid = CLOCK_MONOTONIC;
+
+		/*
+		 * Samples dropped on a full ring are only reported in the
+		 * ring once there is room again, which may never happen
+		 * if the capture ends first. Kernels since 6.0 count them.
+		 */
+		if (pc->count_lost)
+			attr.read_format = PERF_FORMAT_LOST;
+
+		fd = perf_event_open(&attr, pcpu->cpu, -1);
+		if (fd < 0 && errno == EINVAL && pc->count_lost) {
+			pc->count_lost = 0;
+			attr.read_format = 0;
+			fd = perf_event_open(&attr, pcpu->cpu, -1);
+		}
+		if (fd < 0) {
+			fprintf(stderr, "%s: failed to open event %d on cpu "
+				"%d: %m\n", __func__, id, pcpu->cpu);
+			return -1;
+		}
+		pcpu->fds[pcpu->nr_fds++] = fd;
+
+		/* All the events of the cpu share the ring of the first */
+		if (pcpu->nr_fds > 1) {
+			if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, pcpu->fds[0]))
+				return error("PERF_EVENT_IOC_SET_OUTPUT");
+			continue;
+		}
+
+		map = mmap(NULL, pc->map_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			fprintf(stderr, "%s: failed to map %zu bytes of perf "
+				"ring for cpu %d: %m\n", __func__,
+				pc->map_size, pcpu->cpu);
+			return -1;
+		}
+		pcpu->meta = map;
+		pcpu->data = (char *)map + sysconf(_SC_PAGESIZE);
+		pcpu->data_size = pc->map_size - sysconf(_SC_PAGESIZE);
+	}
+
+	return 0;
+}
+
+/* Samples of a cpu dropped because its ring was full */
+static uint64_t perf_lost(struct perf_capture *pc, struct perf_cpu *pcpu)
+{
+	struct {
+		uint64_t value;
+		uint64_t lost;
+	} count;
+	uint64_t lost = 0;
+	int i;
+
+	if (!pc->count_lost)
+		return pcpu->lost;
+
+	for (i = 0; i < pcpu->nr_fds; i++)
+		if (read(pcpu->fds[i], &count, sizeof(count)) ==
+		    sizeof(count))
+			lost += count.lost;
+
+	return lost;
+}
+
+static void perf_close_cpu(struct perf_capture *pc, struct perf_cpu *pcpu)
+{
+	int i;
+
+	if (pcpu->meta)
+		munmap(pcpu->meta, pc->map_size);
+	for (i = 0; i < pcpu->nr_fds; i++)
+		close(pcpu->fds[i]);
+	raw_stream_release(&pcpu->stream);
+}
+
+static void perf_capture_release(struct perf_capture *pc)
+{
+	int i;
+
+	for (i = 0; pc->cpus && i < pc->nrcpus; i++)
+		perf_close_cpu(pc, &pc->cpus[i]);
+	if (pc->stop[0] >= 0)
+		close(pc->stop[0]);
+	if (pc->stop[1] >= 0)
+		close(pc->stop[1]);
+	free(pc->cpus);
+	free(pc->record);
+	raw_trace_close(pc->rt);
+	free(pc);
+}
+
+static void perf_enable(struct perf_capture *pc, unsigned long request)
+{
+	int i, j;
+
+	for (i = 0; i < pc->nrcpus; i++)
+		for (j = 0; j < pc->cpus[i].nr_fds; j++)
+			ioctl(pc->cpus[i].fds[j], request, 0);
+}
+
+static int perf_start_drain(struct perf_capture *pc)
+{
+	if (pipe(pc->stop)) {
+		pc->stop[0] = pc->stop[1] = -1;
+		return error(__func__);
+	}
+
+	if (start_pinned_thread(&pc->thread, perf_drain_thread, pc))
+		return error(__func__);
+
+	pc->started = 1;
+	return 0;
+}
+
+/**
+ * perf_capture_start - open the tracepoints of interest on every cpu
+ * @tracing_dir: e.g. /sys/kernel/debug/tracing, for the format files
+ * @buffer_kb: size of the ring of each cpu, rounded to a power of two
+ * @interval: seconds between drains, 0 to drain only when stopping
+ *
+ * The events of each cpu go to a ring of its own, which a thread
+ * running on the current cpu decodes every @interval seconds.
+ *
+ * @return: the capture (success) or ptrerror() (error)
+ */
+struct perf_capture *perf_capture_start(const char *tracing_dir,
+					unsigned int buffer_kb,
+					unsigned int interval)
+{
+	struct perf_capture *pc;
+	struct cpu_topology *topo;
+	size_t page_size = sysconf(_SC_PAGESIZE), pages;
+	int i;
+
+	pc = calloc(1, sizeof(*pc));
+	if (!pc)
+		return ptrerror(__func__);
+
+	pc->stop[0] = pc->stop[1] = -1;
+	pc->interval = interval ? (int)interval * 1000 : -1;
+	pc->count_lost = 1;
+
+	pc->rt = raw_trace_open(tracing_dir);
+	if (is_err(pc->rt)) {
+		pc->rt = NULL;
+		goto out_release;
+	}
+
+	for (pages = PERF_MIN_DATA_PAGES;
+	     pages * page_size < (size_t)buffer_kb << 10; pages *= 2)
+		;
+	pc->map_size = (pages + 1) * page_size;
+
+	topo = read_sysfs_cpu_topo();
+	if (is_err(topo))
+		goto out_release;
+
+	pc->nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	pc->cpus = calloc(pc->nrcpus > 0 ? pc->nrcpus : 1,
+			  sizeof(*pc->cpus));
+	if (!pc->cpus) {
+		error(__func__);
+		release_cpu_topo_info(topo);
+		goto out_release;
+	}
+
+	for (i = 0; i < pc->nrcpus; i++) {
+		pc->cpus[i].cpu = i;
+		pc->cpus[i].stream.cpu = i;
+		if (cpu_is_online(topo, i) && perf_open_cpu(pc, &pc->cpus[i]))
+			break;
+	}
+	release_cpu_topo_info(topo);
+	if (i < pc->nrcpus)
+		goto out_release;
+
+	if (perf_start_drain(pc))
+		goto out_release;
+
+	pc->start_ts = perf_clock_ns();
+	perf_enable(pc, PERF_EVENT_IOC_ENABLE);
+
+	return pc;
+
+out_release:
+	perf_capture_release(pc);
+	return ptrerror(NULL);
+}
+
+/**
+ * perf_capture_stop - stop the capture and analyze its events
+ * @pc: the capture, freed
+ * @initp: P-states of the cpus when the capture started, or NULL
+ *
+ * @return: per-trace statistics (success) or ptrerror() (error)
+ */
+struct cpuidle_datas *perf_capture_stop(struct perf_capture *pc,
+					struct init_pstates *initp)
+{
+	struct cpuidle_datas *datas;
+	struct raw_stream *streams;
+	uint64_t end_ts, lost;
+	int i, ret;
+
+	perf_enable(pc, PERF_EVENT_IOC_DISABLE);
+	end_ts = perf_clock_ns();
+
+	if (pc->started) {
+		close(pc->stop[1]);
+		pc->stop[1] = -1;
+		pthread_join(pc->thread, NULL);
+	}
+
+	ret = pc->error || perf_drain(pc) ? -1 : 0;
+
+	for (i = 0; i < pc->nrcpus; i++) {
+		lost = perf_lost(pc, &pc->cpus[i]);
+		if (lost)
+			fprintf(stderr, "warning: %" PRIu64 " events lost on "
+				"cpu %d, increase the buffer size (-S) or "
+				"decrease the polling interval (-I)\n",
+				lost, i);
+
+		/* Lost at the end, with no record in the ring to tell */
+		if (lost > pc->cpus[i].lost &&
+		    perf_store_lost(pc, &pc->cpus[i],
+				    lost - pc->cpus[i].lost, end_ts))
+			ret = -1;
+		perf_sort_stream(&pc->cpus[i].stream);
+	}
+
+	datas = ret ? ptrerror(NULL) : raw_capture_datas();
+	if (is_err(datas))
+		goto out_release;
+
+	/* One stream per cpu, plus the P-states of the capture */
+	streams = calloc(pc->nrcpus + 1, sizeof(*streams));
+	if (!streams) {
+		error(__func__);
+		goto out_free_datas;
+	}
+	for (i = 0; i < pc->nrcpus; i++)
+		streams[i] = pc->cpus[i].stream;
+
+	if (initp)
+		ret = raw_capture_pstates(datas, initp, pc->start_ts, end_ts,
+					  &streams[pc->nrcpus]);
+	if (!ret)
+		ret = load_raw_streams(pc->rt, datas, streams,
+				       pc->nrcpus + 1);
+
+	/* The streams of the cpus are released with the capture */
+	raw_stream_release(&streams[pc->nrcpus]);
+	free(streams);
+	if (ret)
+		goto out_free_datas;
+
+	perf_capture_release(pc);
+	return datas;
+
+out_free_datas:
+	raw_release_datas(datas);
+out_release:
+	perf_capture_release(pc);
+	return ptrerror(NULL);
+}
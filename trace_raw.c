@@ -0,0 +1,1441 @@
+/*
+ *  trace_raw.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "analysis.h"
+#include "idlestat.h"
+#include "reorder.h"
+#include "topology.h"
+#include "trace_event.h"
+#include "trace_ops.h"
+#include "trace_raw.h"
+#include "utils.h"
+
+/* Ring buffer event header: 5 bits of type/length, 27 bits of delta */
+#define RAW_TYPE_LEN_MASK	0x1f
+#define RAW_TS_SHIFT		27
+#define RAW_TYPE_PADDING	29
+#define RAW_TYPE_TIME_EXTEND	30
+#define RAW_TYPE_TIME_STAMP	31
+#define RAW_ABS_TS_MASK		((1ULL << 59) - 1)
+#define RAW_COMMIT_MASK		((1ULL << 27) - 1)
+#define RAW_MISSED_EVENTS	(1ULL << 31)
+#define RAW_MISSED_STORED	(1ULL << 30)
+#define RAW_NR_EVENTS		5
+
+struct raw_field {
+	int offset;
+	int size;		/* 0 if not found or for a trailing array */
+};
+
+struct raw_event_format {
+	int id;			/* -1 if the event is not available */
+	int type;
+	struct raw_field value;
+	struct raw_field cpu_id;
+	struct raw_field name;
+};
+
+/* Address and text of a string the kernel traces by pointer */
+struct raw_string {
+	uint64_t addr;
+	const char *str;
+};
+
+struct raw_trace {
+	struct raw_field timestamp;	/* page header */
+	struct raw_field commit;
+	struct raw_field data;
+	struct raw_field common_type;
+	struct raw_event_format events[RAW_NR_EVENTS];
+	struct raw_string *strings;
+	size_t nr_strings;
+	struct arena arena;		/* text of the strings */
+};
+
+/* The events idlestat decodes and the fields it needs from them */
+static const struct {
+	int type;
+	const char *path;
+	const char *value;
+	const char *cpu_id;
+	const char *name;
+} raw_events[RAW_NR_EVENTS] = {
+	{ TRACE_EVENT_CPU_IDLE, "power/cpu_idle", "state", "cpu_id", NULL },
+	{ TRACE_EVENT_CPU_FREQUENCY, "power/cpu_frequency",
+	  "state", "cpu_id", NULL },
+	{ TRACE_EVENT_IRQ_HANDLER_ENTRY, "irq/irq_handler_entry",
+	  "irq", NULL, "name" },
+	{ TRACE_EVENT_IPI_ENTRY, "ipi/ipi_entry", NULL, NULL, "reason" },
+	{ TRACE_EVENT_CLOCK_SYNC, "ftrace/print", NULL, NULL, "buf" },
+};
+
+/*
+ * Parse a "field:<declaration>;	offset:<n>;	size:<n>;" line. The
+ * name is the last word of the declaration, without any array size.
+ */
+static int parse_field(const char *line, char *name, size_t namelen,
+		       struct raw_field *field)
+{
+	const char *decl, *semi, *p, *end, *off, *size;
+
+	decl = strstr(line, "field:");
+	if (!decl)
+		return -1;
+	decl += 6;
+
+	semi = strchr(decl, ';');
+	if (!semi)
+		return -1;
+
+	end = semi;
+	while (end > decl && end[-1] == ' ')
+		end--;
+	if (end > decl && end[-1] == ']')
+		while (end > decl && *end != '[')
+			end--;
+
+	for (p = end; p > decl && p[-1] != ' ' && p[-1] != '*' &&
+		     p[-1] != '\t'; p--)
+		;
+
+	off = strstr(semi, "offset:");
+	size = strstr(semi, "size:");
+	if (p == end || (size_t)(end - p) >= namelen || !off || !size)
+		return -1;
+
+	memcpy(name, p, end - p);
+	name[end - p] = '\0';
+	field->offset = atoi(off + 7);
+	field->size = atoi(size + 5);
+	return 0;
+}
+
+static uint64_t read_field(const char *data, size_t len,
+			   const struct raw_field *field)
+{
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+
+	if ((size_t)field->offset + field->size > len)
+		return 0;
+
+	data += field->offset;
+	switch (field->size) {
+	case 1:
+		memcpy(&u8, data, 1);
+		return u8;
+	case 2:
+		memcpy(&u16, data, 2);
+		return u16;
+	case 4:
+		memcpy(&u32, data, 4);
+		return u32;
+	case 8:
+		memcpy(&u64, data, 8);
+		return u64;
+	}
+
+	return 0;
+}
+
+static int read_header_page(struct raw_trace *rt, const char *dir)
+{
+	char path[PATH_MAX], line[BUFSIZE], name[NAMELEN];
+	struct raw_field field;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/events/header_page", dir);
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
+			path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (parse_field(line, name, sizeof(name), &field))
+			continue;
+		if (!strcmp(name, "timestamp"))
+			rt->timestamp = field;
+		else if (!strcmp(name, "commit"))
+			rt->commit = field;
+		else if (!strcmp(name, "data"))
+			rt->data = field;
+	}
+
+	fclose(f);
+
+	if (!rt->timestamp.size || !rt->commit.size || !rt->data.size) {
+		fprintf(stderr, "%s: unsupported ring buffer page layout\n",
+			__func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void read_event_format(struct raw_trace *rt, const char *dir, int i)
+{
+	struct raw_event_format *fmt = &rt->events[i];
+	char path[PATH_MAX], line[BUFSIZE], name[BUFSIZE];
+	struct raw_field field;
+	FILE *f;
+
+	fmt->id = -1;
+	fmt->type = raw_events[i].type;
+
+	snprintf(path, sizeof(path), "%s/events/%s/format", dir,
+		 raw_events[i].path);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "ID: %d", &fmt->id) == 1)
+			continue;
+		if (parse_field(line, name, sizeof(name), &field))
+			continue;
+		if (!strcmp(name, "common_type"))
+			rt->common_type = field;
+		else if (raw_events[i].value &&
+			 !strcmp(name, raw_events[i].value))
+			fmt->value = field;
+		else if (raw_events[i].cpu_id &&
+			 !strcmp(name, raw_events[i].cpu_id))
+			fmt->cpu_id = field;
+		else if (raw_events[i].name &&
+			 !strcmp(name, raw_events[i].name))
+			fmt->name = field;
+	}
+
+	fclose(f);
+
+	/* The fields of the event follow the common ones, at offset 0 */
+	if ((raw_events[i].value && !fmt->value.offset) ||
+	    (raw_events[i].cpu_id && !fmt->cpu_id.offset) ||
+	    (raw_events[i].name && !fmt->name.offset)) {
+		fprintf(stderr, "warning: unsupported format for %s, "
+			"events skipped\n", raw_events[i].path);
+		fmt->id = -1;
+	}
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+	const struct raw_string *sa = a, *sb = b;
+
+	return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+/*
+ * The IPI reason is traced as a pointer to a kernel string. Such strings
+ * are listed with their address in printk_formats:
+ *
+ *   0xffffffff81a0c2e8 : "Rescheduling interrupts"
+ */
+static int read_printk_formats(struct raw_trace *rt, const char *dir)
+{
+	char path[PATH_MAX], *line = NULL, *q, *e, *str;
+	struct raw_string *tmp;
+	size_t linesize = 0, max = 0;
+	uint64_t addr;
+	FILE *f;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/printk_formats", dir);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+
+	while (getline(&line, &linesize, f) > 0) {
+		if (sscanf(line, "%" SCNx64, &addr) != 1)
+			continue;
+		q = strchr(line, '"');
+		e = strrchr(line, '"');
+		if (!q || e <= q)
+			continue;
+
+		if (rt->nr_strings == max) {
+			max = max ? max * 2 : 256;
+			tmp = realloc(rt->strings, max * sizeof(*tmp));
+			if (!tmp) {
+				ret = error(__func__);
+				break;
+			}
+			rt->strings = tmp;
+		}
+
+		str = arena_alloc(&rt->arena, e - q);
+		if (is_err(str)) {
+			ret = -1;
+			break;
+		}
+		memcpy(str, q + 1, e - q - 1);
+		str[e - q - 1] = '\0';
+
+		rt->strings[rt->nr_strings].addr = addr;
+		rt->strings[rt->nr_strings].str = str;
+		rt->nr_strings++;
+	}
+
+	free(line);
+	fclose(f);
+
+	qsort(rt->strings, rt->nr_strings, sizeof(*rt->strings),
+	      compare_strings);
+	return ret;
+}
+
+static const char *lookup_string(struct raw_trace *rt, uint64_t addr)
+{
+	struct raw_string key = { .addr = addr }, *s;
+
+	s = bsearch(&key, rt->strings, rt->nr_strings, sizeof(*s),
+		    compare_strings);
+	return s ? s->str : NULL;
+}
+
+/**
+ * raw_trace_open - read the ring buffer layout of a tracing directory
+ * @tracing_dir: e.g. /sys/kernel/debug/tracing
+ *
+ * @return: the layout (success) or ptrerror() (error)
+ */
+struct raw_trace *raw_trace_open(const char *tracing_dir)
+{
+	struct raw_trace *rt;
+	int i;
+
+	rt = calloc(1, sizeof(*rt));
+	if (!rt)
+		return ptrerror(__func__);
+
+	if (read_header_page(rt, tracing_dir))
+		goto out_free;
+
+	for (i = 0; i < RAW_NR_EVENTS; i++)
+		read_event_format(rt, tracing_dir, i);
+
+	if (!rt->common_type.size) {
+		fprintf(stderr, "%s: no event format found in %s\n",
+			__func__, tracing_dir);
+		goto out_free;
+	}
+
+	if (raw_trace_event_id(rt, TRACE_EVENT_IPI_ENTRY) != -1 &&
+	    read_printk_formats(rt, tracing_dir))
+		goto out_free;
+
+	return rt;
+
+out_free:
+	raw_trace_close(rt);
+	return ptrerror(NULL);
+}
+
+void raw_trace_close(struct raw_trace *rt)
+{
+	if (!rt)
+		return;
+
+	free(rt->strings);
+	arena_release(&rt->arena);
+	free(rt);
+}
+
+/**
+ * raw_trace_page_size - size of the pages read from trace_pipe_raw
+ */
+size_t raw_trace_page_size(struct raw_trace *rt)
+{
+	return rt->data.offset + rt->data.size;
+}
+
+/**
+ * raw_trace_event_id - id the kernel gave to an event of interest
+ * @rt: the ring buffer layout
+ * @type: TRACE_EVENT_* type of the event
+ *
+ * @return: the id, -1 if the event is not available
+ */
+int raw_trace_event_id(struct raw_trace *rt, int type)
+{
+	int i;
+
+	for (i = 0; i < RAW_NR_EVENTS; i++)
+		if (rt->events[i].type == type)
+			return rt->events[i].id;
+
+	return -1;
+}
+
+/**
+ * raw_trace_event_fields - where the fields of an event of interest are
+ * @rt: the ring buffer layout
+ * @type: TRACE_EVENT_* type of the event
+ * @value: set to the offset of the state or irq field
+ * @cpu_id: set to the offset of the cpu_id field, -1 if there is none
+ *
+ * The offsets are from the start of the payload, and only 32 bit fields
+ * are reported.
+ *
+ * @return: the id of the event, -1 if it is not available
+ */
+int raw_trace_event_fields(struct raw_trace *rt, int type, int *value,
+			   int *cpu_id)
+{
+	struct raw_event_format *fmt = NULL;
+	int i;
+
+	for (i = 0; i < RAW_NR_EVENTS; i++)
+		if (rt->events[i].type == type)
+			fmt = &rt->events[i];
+
+	if (!fmt || fmt->id < 0 || fmt->value.size != 4 ||
+	    (fmt->cpu_id.size && fmt->cpu_id.size != 4))
+		return -1;
+
+	*value = fmt->value.offset;
+	*cpu_id = fmt->cpu_id.size ? fmt->cpu_id.offset : -1;
+
+	return fmt->id;
+}
+
+/**
+ * raw_trace_decode_event - decode the payload of a binary event
+ * @rt: the ring buffer layout
+ * @cpu: cpu the event was logged on
+ * @ts: time of the event
+ * @data: the payload, starting with the common fields
+ * @len: length of the payload
+ * @ev: decoded event, whose name points into @data or into @rt
+ *
+ * @return: the event type (> 0) if @ev was filled, 0 if the event is not
+ * one idlestat is interested in, -1 if it could not be decoded
+ */
+int raw_trace_decode_event(struct raw_trace *rt, int cpu, uint64_t ts,
+			   const char *data, size_t len,
+			   struct trace_event *ev)
+{
+	struct raw_event_format *fmt = NULL;
+	unsigned int loc, off;
+	int id, i;
+
+	id = read_field(data, len, &rt->common_type);
+	for (i = 0; i < RAW_NR_EVENTS; i++) {
+		if (rt->events[i].id == id) {
+			fmt = &rt->events[i];
+			break;
+		}
+	}
+
+	if (!fmt)
+		return 0;
+
+	ev->time = ts;
+	ev->type = fmt->type;
+	ev->cpu = cpu;
+	ev->cpu_id = -1;
+	ev->value = 0;
+	ev->name = NULL;
+	ev->namelen = 0;
+
+	switch (fmt->type) {
+	case TRACE_EVENT_CPU_IDLE:
+	case TRACE_EVENT_CPU_FREQUENCY:
+		ev->value = read_field(data, len, &fmt->value);
+		ev->cpu_id = (int)read_field(data, len, &fmt->cpu_id);
+		break;
+
+	case TRACE_EVENT_IRQ_HANDLER_ENTRY:
+		/* __data_loc: offset in the low 16 bits, length above */
+		ev->value = read_field(data, len, &fmt->value);
+		loc = read_field(data, len, &fmt->name);
+		off = loc & 0xffff;
+		if (off + (loc >> 16) > len || !(loc >> 16))
+			return -1;
+		ev->name = data + off;
+		ev->namelen = strnlen(ev->name, loc >> 16);
+		break;
+
+	case TRACE_EVENT_IPI_ENTRY:
+		ev->name = lookup_string(rt, read_field(data, len, &fmt->name));
+		if (!ev->name)
+			return -1;
+		ev->namelen = strlen(ev->name);
+		break;
+
+	case TRACE_EVENT_CLOCK_SYNC:
+		/* The text written to trace_marker fills the payload */
+		off = fmt->name.offset;
+		if (off >= len)
+			return -1;
+		return decode_clock_sync_mark(data + off, data + off +
+					      strnlen(data + off, len - off),
+					      ev);
+	}
+
+	return ev->namelen || !ev->name ? ev->type : -1;
+}
+
+/**
+ * raw_trace_decode_page - decode the events of a ring buffer page
+ * @rt: the ring buffer layout
+ * @cpu: cpu whose buffer the page was read from
+ * @page: the page
+ * @size: number of bytes read
+ * @fn: called with each decoded event, in time order
+ * @arg: passed to @fn
+ *
+ * The names of the events point into @page or into @rt.
+ *
+ * @return: 0 on success, 1 if the page is corrupt, in which case the
+ * events before the corruption were passed to @fn, -1 if @fn failed
+ */
+int raw_trace_decode_page(struct raw_trace *rt, int cpu,
+			  const char *page, size_t size,
+			  raw_event_fn fn, void *arg)
+{
+	const char *p, *end, *data;
+	uint32_t header, type_len, delta, len;
+	uint64_t ts, flags, commit, abs_ts, missed;
+	struct raw_field count;
+	struct trace_event ev;
+	size_t datalen;
+	int ret;
+
+	if (size < (size_t)rt->data.offset)
+		return 1;
+
+	ts = read_field(page, size, &rt->timestamp);
+	flags = read_field(page, size, &rt->commit);
+	commit = flags & RAW_COMMIT_MASK;
+	if (commit > size - rt->data.offset)
+		return 1;
+
+	p = page + rt->data.offset;
+	end = p + commit;
+
+	/* Events of the cpu were lost before this page */
+	if (flags & RAW_MISSED_EVENTS) {
+		memset(&ev, 0, sizeof(ev));
+		ev.time = ts;
+		ev.type = TRACE_EVENT_LOST;
+		ev.cpu = cpu;
+		ev.cpu_id = -1;
+
+		/* The count may be stored after the data, as a long */
+		if (flags & RAW_MISSED_STORED) {
+			count.offset = rt->data.offset + commit;
+			count.size = rt->commit.size;
+			missed = read_field(page, size, &count);
+			ev.value = MIN(missed, UINT_MAX);
+		}
+
+		if (fn(&ev, arg))
+			return -1;
+	}
+
+	while (p + sizeof(header) <= end) {
+		memcpy(&header, p, sizeof(header));
+		type_len = header & RAW_TYPE_LEN_MASK;
+		delta = header >> 5;
+
+		/* All but the short data events have a 32 bit argument */
+		if (type_len == 0 || type_len >= RAW_TYPE_PADDING) {
+			if (type_len == RAW_TYPE_PADDING && !delta)
+				return 0;	/* the rest is empty */
+			if (p + 8 > end)
+				return 1;
+			memcpy(&len, p + 4, sizeof(len));
+		}
+
+		switch (type_len) {
+		case RAW_TYPE_PADDING:
+			/* Discarded event */
+			p += 4 + len;
+			continue;
+
+		case RAW_TYPE_TIME_EXTEND:
+			ts += ((uint64_t)len << RAW_TS_SHIFT) + delta;
+			p += 8;
+			continue;
+
+		case RAW_TYPE_TIME_STAMP:
+			/* The top bits of the absolute time are implied */
+			abs_ts = ((uint64_t)len << RAW_TS_SHIFT) | delta;
+			ts = (ts & ~RAW_ABS_TS_MASK) | abs_ts;
+			p += 8;
+			continue;
+
+		case 0:
+			if (len < 4)
+				return 1;
+			data = p + 8;
+			datalen = len - 4;
+			break;
+
+		default:
+			data = p + 4;
+			datalen = type_len * 4;
+		}
+
+		if (data + datalen > end)
+			return 1;
+		p = data + datalen;
+		ts += delta;
+
+		ret = raw_trace_decode_event(rt, cpu, ts, data, datalen, &ev);
+		if (ret < 0)
+			warn_trace_event(ev.type);
+		else if (ret > 0 && fn(&ev, arg))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * raw_stream_add_event - append a decoded event to a stream
+ * @ev: the event
+ * @arg: the stream
+ *
+ * Used as raw_event_fn and to queue events which do not come from a
+ * ring buffer, such as the P-states at the start of a capture.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int raw_stream_add_event(struct trace_event *ev, void *arg)
+{
+	struct raw_stream *rs = arg;
+	struct trace_event *tmp;
+	size_t max;
+
+	if (rs->nr_events == rs->max_events) {
+		max = rs->max_events ? rs->max_events * 2 : 4096;
+		tmp = realloc(rs->events, max * sizeof(*tmp));
+		if (!tmp)
+			return error(__func__);
+		rs->events = tmp;
+		rs->max_events = max;
+	}
+
+	rs->events[rs->nr_events++] = *ev;
+	return 0;
+}
+
+/**
+ * raw_stream_map - map a file of ring buffer pages saved by a capture
+ * @rs: the stream, zeroed
+ * @cpu: cpu whose buffer the pages come from
+ * @path: the file; a missing or empty file gives an empty stream
+ *
+ * @return: 0 on success, -1 on error
+ */
+int raw_stream_map(struct raw_stream *rs, int cpu, const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	rs->cpu = cpu;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : error(path);
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return error(path);
+	}
+
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return error(path);
+		}
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		rs->pages = map;
+		rs->len = st.st_size;
+		rs->mapped = 1;
+	}
+
+	close(fd);
+	return 0;
+}
+
+void raw_stream_release(struct raw_stream *rs)
+{
+	if (rs->mapped)
+		munmap((void *)rs->pages, rs->len);
+	else
+		free((void *)rs->pages);
+	free(rs->events);
+	memset(rs, 0, sizeof(*rs));
+}
+
+/* Drain the buffer of a cpu into memory, one page per read */
+static int read_cpu_pages(const char *dir, size_t page_size,
+			  struct raw_stream *rs)
+{
+	char path[PATH_MAX], *pages = NULL, *tmp;
+	size_t size = 0;
+	ssize_t n;
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe_raw", dir,
+		 rs->cpu);
+	fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
+			path);
+		return -1;
+	}
+
+	for (;;) {
+		if (size - rs->len < page_size) {
+			size = size ? size * 2 : 64 * page_size;
+			tmp = realloc(pages, size);
+			if (!tmp) {
+				ret = error(__func__);
+				break;
+			}
+			pages = tmp;
+		}
+
+		n = read(fd, pages + rs->len, page_size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			break;
+		if (n < 0) {
+			fprintf(stderr, "%s: failed to read '%s': %m\n",
+				__func__, path);
+			ret = -1;
+			break;
+		}
+		if (n == 0)
+			break;
+
+		/* Keep the pages aligned, the header tells the length */
+		memset(pages + rs->len + n, 0, page_size - n);
+		rs->len += page_size;
+	}
+
+	close(fd);
+	rs->pages = pages;
+
+	return ret;
+}
+
+/*
+ * Decode the pages of a stream until it has an event to analyze.
+ *
+ * @return: 1 if there is an event, 0 at the end of the stream, -1 on
+ * error
+ */
+static int raw_stream_fill(struct raw_trace *rt, struct raw_stream *rs)
+{
+	size_t page_size = raw_trace_page_size(rt), size;
+	int ret;
+
+	while (rs->next == rs->nr_events) {
+		if (rs->off >= rs->len)
+			return 0;
+
+		rs->nr_events = rs->next = 0;
+		size = MIN(page_size, rs->len - rs->off);
+		ret = raw_trace_decode_page(rt, rs->cpu, rs->pages + rs->off,
+					    size, raw_stream_add_event, rs);
+		if (ret < 0)
+			return -1;
+		if (ret > 0)
+			fprintf(stderr, "warning: corrupt ring buffer page "
+				"of cpu %d truncated\n", rs->cpu);
+		rs->off += page_size;
+	}
+
+	return 1;
+}
+
+/* Events of the same time are taken from the lowest cpu first */
+static int raw_stream_before(struct raw_stream *a, struct raw_stream *b)
+{
+	uint64_t ta = a->events[a->next].time, tb = b->events[b->next].time;
+
+	return ta < tb || (ta == tb && a->cpu < b->cpu);
+}
+
+static void raw_heap_sift_down(struct raw_stream **heap, int nr, int i)
+{
+	struct raw_stream *tmp;
+	int child;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= nr)
+			return;
+		if (child + 1 < nr && raw_stream_before(heap[child + 1],
+							heap[child]))
+			child++;
+		if (!raw_stream_before(heap[child], heap[i]))
+			return;
+
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+/**
+ * load_raw_streams - merge streams of events in time order and analyze them
+ * @rt: the ring buffer layout
+ * @datas: per-trace statistics, with topology and C-states set up
+ * @streams: the streams, whose pages are decoded as they are needed
+ * @nr: number of streams
+ *
+ * @return: 0 on success, -1 on error
+ */
+int load_raw_streams(struct raw_trace *rt, struct cpuidle_datas *datas,
+		     struct raw_stream *streams, int nr)
+{
+	struct raw_stream **heap, *rs;
+	uint64_t begin = 0, end = 0;
+	size_t count = 0, start = 1, failed;
+	int nrheap = 0, i, ret = 0;
+
+	heap = calloc(nr, sizeof(*heap));
+	if (!heap)
+		return error(__func__);
+
+	if (setup_topo_states(datas) || setup_event_streams(datas) ||
+	    setup_reorder_buffer(datas)) {
+		free(heap);
+		return -1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		ret = raw_stream_fill(rt, &streams[i]);
+		if (ret < 0)
+			goto out;
+		if (ret)
+			heap[nrheap++] = &streams[i];
+	}
+
+	for (i = nrheap / 2 - 1; i >= 0; i--)
+		raw_heap_sift_down(heap, nrheap, i);
+
+	while (nrheap) {
+		rs = heap[0];
+		if (load_trace_event(&rs->events[rs->next++], datas,
+				     &begin, &end, &start) != -1)
+			count++;
+
+		ret = raw_stream_fill(rt, rs);
+		if (ret < 0)
+			goto out;
+		if (!ret)
+			heap[0] = heap[--nrheap];
+		raw_heap_sift_down(heap, nrheap, 0);
+	}
+	ret = 0;
+
+out:
+	free(heap);
+
+	count -= flush_trace_events(datas, &begin, &end, &start);
+
+	if (analyze_event_streams(datas, &failed))
+		ret = -1;
+	count -= failed;
+
+	fprintf(stderr, "Log is %lf secs long with %zu events\n",
+		NSEC_TO_SEC(end - begin), count);
+	report_trace_coverage(datas);
+
+	return ret;
+}
+
+/**
+ * raw_capture_pstates - queue the P-states of the cpus during a capture
+ * @datas: per-trace statistics
+ * @initp: P-states of the cpus when the capture started
+ * @start_ts: time the capture started
+ * @end_ts: time the capture ended
+ * @rs: stream to queue to, its cpu is set to -1
+ *
+ * The P-states are opened at @start_ts and closed at @end_ts, as
+ * idlestat_store() does in the trace file.
+ *
+ * @return: 0 on success, -1 on error
+ */
+int raw_capture_pstates(struct cpuidle_datas *datas,
+			struct init_pstates *initp,
+			uint64_t start_ts, uint64_t end_ts,
+			struct raw_stream *rs)
+{
+	struct trace_event ev;
+	int cpu, last;
+
+	rs->cpu = -1;
+
+	for (last = 0; last < 2; last++) {
+		for (cpu = 0; cpu < initp->nrcpus && cpu < datas->nrcpus;
+		     cpu++) {
+			if (!cpu_is_online(datas->topo, cpu))
+				continue;
+
+			memset(&ev, 0, sizeof(ev));
+			ev.time = last ? end_ts : start_ts;
+			ev.type = TRACE_EVENT_CPU_FREQUENCY;
+			ev.cpu = 0;	/* the time was read on cpu 0 */
+			ev.cpu_id = cpu;
+			ev.value = last ? 0 : initp->freqs[cpu];
+
+			if (raw_stream_add_event(&ev, rs))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * raw_capture_datas - set up the statistics of a capture of this host
+ *
+ * The topology, C-states and P-states are read from sysfs.
+ *
+ * @return: per-trace statistics (success) or ptrerror() (error)
+ */
+struct cpuidle_datas *raw_capture_datas(void)
+{
+	struct cpuidle_datas *datas;
+	int nrcpus;
+
+	nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (nrcpus <= 0)
+		return ptrerror("Cannot capture trace (nrcpus == 0)");
+
+	datas = calloc(sizeof(*datas), 1);
+	if (!datas)
+		return ptrerror(__func__);
+
+	datas->nrcpus = nrcpus;
+	datas->pstates = build_pstate_info(nrcpus);
+	if (!datas->pstates)
+		goto propagate_error_free_datas;
+
+	datas->topo = read_sysfs_cpu_topo();
+	if (is_err(datas->topo))
+		goto propagate_error_free_datas;
+
+	datas->cstates = build_cstate_info(nrcpus);
+	if (is_err(datas->cstates))
+		goto propagate_error_free_datas;
+
+	if (seed_pstates_from_sysfs(datas))
+		goto propagate_error_free_datas;
+
+	return datas;
+
+ propagate_error_free_datas:
+	raw_release_datas(datas);
+	return ptrerror(NULL);
+}
+
+/**
+ * raw_release_datas - free statistics that were not handed to a report
+ */
+void raw_release_datas(struct cpuidle_datas *datas)
+{
+	if (datas->topo && !is_err(datas->topo))
+		release_cpu_topo_info(datas->topo);
+	if (datas->cstates && !is_err(datas->cstates))
+		release_cstate_info(datas->cstates, datas->nrcpus);
+	free(datas);
+}
+
+/**
+ * raw_trace_capture - analyze the events left in the ring buffers
+ * @tracing_dir: e.g. /sys/kernel/debug/tracing
+ * @start_ts: time the capture started
+ * @end_ts: time the capture ended
+ * @initp: P-states of the cpus when the capture started, or NULL
+ *
+ * The pages of each cpu are read from trace_pipe_raw and decoded
+ * without going through the text trace.
+ *
+ * @return: per-trace statistics (success) or ptrerror() (error)
+ */
+struct cpuidle_datas *raw_trace_capture(const char *tracing_dir,
+					uint64_t start_ts, uint64_t end_ts,
+					struct init_pstates *initp)
+{
+	struct cpuidle_datas *datas;
+	struct raw_stream *streams = NULL;
+	struct raw_trace *rt;
+	int nrcpus, cpu;
+
+	rt = raw_trace_open(tracing_dir);
+	if (is_err(rt))
+		return ptrerror(NULL);
+
+	datas = raw_capture_datas();
+	if (is_err(datas)) {
+		raw_trace_close(rt);
+		return datas;
+	}
+	nrcpus = datas->nrcpus;
+
+	/* One stream per cpu, plus the P-states of the capture */
+	streams = calloc(nrcpus + 1, sizeof(*streams));
+	if (!streams) {
+		error(__func__);
+		goto propagate_error_free_datas;
+	}
+
+	for (cpu = 0; cpu < nrcpus; cpu++) {
+		streams[cpu].cpu = cpu;
+		if (cpu_is_online(datas->topo, cpu) &&
+		    read_cpu_pages(tracing_dir, raw_trace_page_size(rt),
+				   &streams[cpu]))
+			goto propagate_error_free_datas;
+	}
+
+	if (initp && raw_capture_pstates(datas, initp, start_ts, end_ts,
+					 &streams[nrcpus]))
+		goto propagate_error_free_datas;
+
+	if (load_raw_streams(rt, datas, streams, nrcpus + 1))
+		goto propagate_error_free_datas;
+
+	for (cpu = 0; cpu <= nrcpus; cpu++)
+		raw_stream_release(&streams[cpu]);
+	free(streams);
+	raw_trace_close(rt);
+
+	return datas;
+
+ propagate_error_free_datas:
+	if (streams) {
+		for (cpu = 0; cpu <= nrcpus; cpu++)
+			raw_stream_release(&streams[cpu]);
+		free(streams);
+	}
+	raw_trace_close(rt);
+	raw_release_datas(datas);
+	return ptrerror(NULL);
+}
+
+#define RAW_SPLICE_PAGES	16
+
+/* Drains the ring buffer of one cpu into its segment file */
+struct raw_drain {
+	struct raw_capture *capture;
+	int cpu;
+	int trace_fd;		/* per_cpu/cpuN/trace_pipe_raw */
+	int out_fd;		/* segment file */
+	int pipe[2];
+	pthread_t thread;
+	int started;
+	int error;
+};
+
+struct raw_capture {
+	struct raw_drain *drains;
+	int nrcpus;
+	size_t page_size;
+	int interval;		/* ms between drains, -1 for none */
+	int stop[2];		/* closing stop[1] stops the drains */
+};
+
+static int mkdir_parents(const char *path)
+{
+	char dir[PATH_MAX], *p;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	for (p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(dir, 0755) && errno != EEXIST) {
+			fprintf(stderr, "%s: failed to create '%s': %m\n",
+				__func__, dir);
+			return -1;
+		}
+		*p = '/';
+	}
+
+	return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return error(__func__);
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Copy a file of the tracing directory to the same place in a capture */
+static int copy_tracing_file(const char *tracing_dir, const char *capture_dir,
+			     const char *name, int optional)
+{
+	char src[PATH_MAX], dst[PATH_MAX], buf[BUFSIZE * 16];
+	int in, out, ret = 0;
+	ssize_t n;
+
+	snprintf(src, sizeof(src), "%s/%s", tracing_dir, name);
+	snprintf(dst, sizeof(dst), "%s/%s", capture_dir, name);
+
+	in = open(src, O_RDONLY);
+	if (in < 0) {
+		if (optional)
+			return 0;
+		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
+			src);
+		return -1;
+	}
+
+	if (mkdir_parents(dst)) {
+		close(in);
+		return -1;
+	}
+
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
+			dst);
+		close(in);
+		return -1;
+	}
+
+	while ((n = read(in, buf, sizeof(buf))) != 0) {
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 || write_all(out, buf, n)) {
+			ret = error(src);
+			break;
+		}
+	}
+
+	close(out);
+	close(in);
+	return ret;
+}
+
+/*
+ * Move the full pages of the ring buffer to the segment file, through
+ * the pipe, without copying them to user space.
+ */
+static ssize_t splice_pages(struct raw_drain *d)
+{
+	size_t len = RAW_SPLICE_PAGES * d->capture->page_size;
+	ssize_t n, m, total = 0;
+
+	for (;;) {
+		n = splice(d->trace_fd, NULL, d->pipe[1], NULL, len,
+			   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return total;
+		if (n <= 0)
+			return n ? error("splice") : total;
+
+		total += n;
+		while (n > 0) {
+			m = splice(d->pipe[0], NULL, d->out_fd, NULL, n,
+				   SPLICE_F_MOVE);
+			if (m < 0 && errno == EINTR)
+				continue;
+			if (m <= 0)
+				return error("splice");
+			n -= m;
+		}
+	}
+}
+
+/* splice() only moves full pages, read what is left once tracing is off */
+static int read_last_pages(struct raw_drain *d)
+{
+	size_t page_size = d->capture->page_size;
+	char *page;
+	ssize_t n;
+	int ret = 0;
+
+	page = malloc(page_size);
+	if (!page)
+		return error(__func__);
+
+	for (;;) {
+		n = read(d->trace_fd, page, page_size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n < 0 && errno != EAGAIN)
+				ret = error(__func__);
+			break;
+		}
+
+		memset(page + n, 0, page_size - n);
+		if (write_all(d->out_fd, page, page_size)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	free(page);
+	return ret;
+}
+
+/*
+ * Sleep until the drain interval expires, the buffer fills up to its
+ * watermark (buffer_percent) or the capture stops, then drain.
+ */
+static void *raw_drain_thread(void *arg)
+{
+	struct raw_drain *d = arg;
+	struct pollfd fds[2] = {
+		{ .fd = d->capture->stop[0], .events = POLLIN },
+		{ .fd = d->trace_fd, .events = POLLIN },
+	};
+	int nfds = 2;
+	ssize_t n;
+
+	for (;;) {
+		if (poll(fds, nfds, d->capture->interval) < 0 &&
+		    errno != EINTR)
+			break;
+		if (fds[0].revents)
+			break;
+
+		n = splice_pages(d);
+		if (n < 0) {
+			d->error = -1;
+			return NULL;
+		}
+
+		/* Readable without a full page: wait for the interval */
+		nfds = n || !fds[1].revents ? 2 : 1;
+	}
+
+	if (splice_pages(d) < 0 || read_last_pages(d))
+		d->error = -1;
+
+	return NULL;
+}
+
+static int start_drain(struct raw_capture *rc, struct raw_drain *d,
+		       const char *tracing_dir, const char *capture_dir)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe_raw",
+		 tracing_dir, d->cpu);
+	d->trace_fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (d->trace_fd < 0)
+		return 0;	/* cpu not present */
+
+	snprintf(path, sizeof(path), RAW_SEGMENT_FORMAT, capture_dir, d->cpu);
+	d->out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (d->out_fd < 0) {
+		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
+			path);
+		return -1;
+	}
+
+	if (pipe(d->pipe)) {
+		d->pipe[0] = d->pipe[1] = -1;
+		return error(__func__);
+	}
+	fcntl(d->pipe[1], F_SETPIPE_SZ, RAW_SPLICE_PAGES * rc->page_size);
+
+	if (start_pinned_thread(&d->thread, raw_drain_thread, d))
+		return error(__func__);
+
+	d->started = 1;
+	return 0;
+}
+
+/**
+ * raw_capture_start - start saving the ring buffers to a capture directory
+ * @tracing_dir: e.g. /sys/kernel/debug/tracing
+ * @capture_dir: directory to create or reuse
+ * @interval: seconds between drains
+ *
+ * One thread per cpu moves the pages of the cpu's ring buffer to the
+ * segment file cpuN.raw with splice(). The threads run on the cpu
+ * idlestat runs on, to leave the traced cpus idle. The layout of the
+ * pages and events is saved along, so the capture can be decoded on
+ * any host.
+ *
+ * @return: the capture (success) or ptrerror() (error)
+ */
+struct raw_capture *raw_capture_start(const char *tracing_dir,
+				      const char *capture_dir,
+				      unsigned int interval)
+{
+	struct raw_capture *rc;
+	struct raw_trace *rt;
+	char name[PATH_MAX];
+	int i, ret = 0;
+
+	rt = raw_trace_open(tracing_dir);
+	if (is_err(rt))
+		return ptrerror(NULL);
+
+	rc = calloc(1, sizeof(*rc));
+	if (!rc) {
+		raw_trace_close(rt);
+		return ptrerror(__func__);
+	}
+
+	rc->page_size = raw_trace_page_size(rt);
+	rc->interval = interval ? (int)interval * 1000 : -1;
+	rc->stop[0] = rc->stop[1] = -1;
+	raw_trace_close(rt);
+
+	if (mkdir(capture_dir, 0755) && errno != EEXIST) {
+		fprintf(stderr, "%s: failed to create '%s': %m\n", __func__,
+			capture_dir);
+		free(rc);
+		return ptrerror(NULL);
+	}
+
+	ret = copy_tracing_file(tracing_dir, capture_dir,
+				"events/header_page", 0);
+	for (i = 0; !ret && i < RAW_NR_EVENTS; i++) {
+		snprintf(name, sizeof(name), "events/%s/format",
+			 raw_events[i].path);
+		ret = copy_tracing_file(tracing_dir, capture_dir, name, 1);
+	}
+	if (!ret)
+		ret = copy_tracing_file(tracing_dir, capture_dir,
+					"printk_formats", 1);
+	if (ret) {
+		free(rc);
+		return ptrerror(NULL);
+	}
+
+	rc->nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	rc->drains = calloc(rc->nrcpus > 0 ? rc->nrcpus : 1,
+			    sizeof(*rc->drains));
+	if (!rc->drains) {
+		error(__func__);
+		goto out_stop;
+	}
+
+	/* raw_capture_stop() closes what is open, whenever we fail */
+	for (i = 0; i < rc->nrcpus; i++) {
+		rc->drains[i].capture = rc;
+		rc->drains[i].cpu = i;
+		rc->drains[i].trace_fd = rc->drains[i].out_fd = -1;
+		rc->drains[i].pipe[0] = rc->drains[i].pipe[1] = -1;
+	}
+
+	if (pipe(rc->stop)) {
+		error(__func__);
+		goto out_stop;
+	}
+
+	for (i = 0; i < rc->nrcpus; i++) {
+		ret = start_drain(rc, &rc->drains[i], tracing_dir,
+				  capture_dir);
+		if (ret)
+			break;
+	}
+	if (!ret)
+		return rc;
+
+out_stop:
+	raw_capture_stop(rc);
+	return ptrerror(NULL);
+}
+
+/**
+ * raw_capture_stop - drain what is left in the ring buffers and finish
+ *
+ * To be called once tracing is off. Frees @rc.
+ *
+ * @return: 0 on success, -1 if pages could not be saved
+ */
+int raw_capture_stop(struct raw_capture *rc)
+{
+	struct raw_drain *d;
+	int i, ret = 0;
+
+	if (rc->stop[1] >= 0)
+		close(rc->stop[1]);
+
+	for (i = 0; rc->drains && i < rc->nrcpus; i++) {
+		d = &rc->drains[i];
+		if (d->started) {
+			pthread_join(d->thread, NULL);
+			if (d->error)
+				ret = -1;
+		}
+		if (d->trace_fd >= 0)
+			close(d->trace_fd);
+		if (d->out_fd >= 0)
+			close(d->out_fd);
+		if (d->pipe[0] >= 0) {
+			close(d->pipe[0]);
+			close(d->pipe[1]);
+		}
+	}
+
+	if (rc->stop[0] >= 0)
+		close(rc->stop[0]);
+	free(rc->drains);
+	free(rc);
+
+	if (ret)
+		fprintf(stderr, "%s: failed to save the ring buffers\n",
+			__func__);
+	return ret;
+}
@@ -0,0 +1,96 @@
+/*
+ *  trace_raw.h
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#ifndef __TRACE_RAW_H
+#define __TRACE_RAW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct cpuidle_datas;
+struct init_pstates;
+struct trace_event;
+struct raw_trace;
+
+/* Layout of a capture directory, besides a copy of the format files */
+#define RAW_CAPTURE_HEADER	"idlestat"
+#define RAW_SEGMENT_FORMAT	"%s/cpu%d.raw"
+
+/*
+ * Decoder for the binary pages of the ftrace ring buffer, as read from
+ * per_cpu/cpuN/trace_pipe_raw. The page header and the event layouts
+ * are read from the format files of the tracing directory, so events
+ * are decoded without the kernel ever formatting them as text.
+ */
+typedef int (*raw_event_fn)(struct trace_event *ev, void *arg);
+
+/*
+ * Events of one cpu, decoded a page at a time from ring buffer pages in
+ * memory or mapped from a capture file. Events which do not come from a
+ * ring buffer are queued in a stream with @cpu -1.
+ */
+struct raw_stream {
+	int cpu;
+	const char *pages;
+	size_t len;
+	size_t off;		/* next page to decode */
+	int mapped;
+	struct trace_event *events;
+	size_t nr_events;
+	size_t max_events;
+	size_t next;		/* next event to analyze */
+};
+
+struct raw_capture;
+
+extern struct raw_trace *raw_trace_open(const char *tracing_dir);
+extern void raw_trace_close(struct raw_trace *rt);
+extern size_t raw_trace_page_size(struct raw_trace *rt);
+extern int raw_trace_event_id(struct raw_trace *rt, int type);
+extern int raw_trace_event_fields(struct raw_trace *rt, int type, int *value,
+				  int *cpu_id);
+extern int raw_trace_decode_event(struct raw_trace *rt, int cpu, uint64_t ts,
+				  const char *data, size_t len,
+				  struct trace_event *ev);
+extern int raw_trace_decode_page(struct raw_trace *rt, int cpu,
+				 const char *page, size_t size,
+				 raw_event_fn fn, void *arg);
+extern int raw_stream_add_event(struct trace_event *ev, void *arg);
+extern int raw_stream_map(struct raw_stream *rs, int cpu, const char *path);
+extern void raw_stream_release(struct raw_stream *rs);
+extern int load_raw_streams(struct raw_trace *rt, struct cpuidle_datas *datas,
+			    struct raw_stream *streams, int nr);
+extern struct raw_capture *raw_capture_start(const char *tracing_dir,
+					     const char *capture_dir,
+					     unsigned int interval);
+extern int raw_capture_stop(struct raw_capture *rc);
+extern struct cpuidle_datas *raw_capture_datas(void);
+extern void raw_release_datas(struct cpuidle_datas *datas);
+extern int raw_capture_pstates(struct cpuidle_datas *datas,
+			       struct init_pstates *initp,
+			       uint64_t start_ts, uint64_t end_ts,
+			       struct raw_stream *rs);
+extern struct cpuidle_datas *raw_trace_capture(const char *tracing_dir,
+					       uint64_t start_ts,
+					       uint64_t end_ts,
+					       struct init_pstates *initp);
+
+#endif
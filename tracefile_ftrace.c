@@ -25,6 +25,8 @@
 #include "topology.h"
 #include "trace_ops.h"
 #include "utils.h"
+#include "compiler.h"
+#include "line_reader.h"
 #include "idlestat.h"
 #include <stddef.h>
 #include <stdio.h>
@@ -32,51 +34,29 @@
 #include <malloc.h>
 #include <assert.h>
 
-#define TRACE_FORMAT "%*[^]]] %*s %lf:%*[^=]=%u%*[^=]=%d"
-
-static int ftrace_magic(const char *filename)
+static int ftrace_magic(UNUSED const char *filename,
+			struct line_reader *reader)
 {
-	FILE *f;
-	char *line;
-	char buffer[BUFSIZE];
-
-	f = fopen(filename, "r");
-	if (!f) {
-		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
-					filename);
-		return -1;
-	}
-
-	line = fgets(buffer, BUFSIZE, f);
-	fclose(f);
-
-	return (line != NULL) && !strncmp(buffer, "# tracer", 8);
+	return check_trace_magic(reader, "# tracer");
 }
 
-static struct cpuidle_datas * ftrace_load(const char *filename)
+static struct cpuidle_datas * ftrace_load(const char *filename,
+					   struct line_reader *reader)
 {
-	FILE *f;
 	unsigned int nrcpus;
 	struct cpuidle_datas *datas;
 	int ret;
 	char *line;
 	char buffer[BUFSIZE];
 
-	f = fopen(filename, "r");
-	if (!f) {
-		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
-					filename);
-		return ptrerror(NULL);
-	}
-
 	/* Version line */
-	line = fgets(buffer, BUFSIZE, f);
+	line = line_reader_gets(reader, buffer, BUFSIZE);
 	if (!line)
-		goto error_close;
+		goto error_read;
 
 	/* Number of CPUs */
 	nrcpus = 0;
-	while(!feof(f)) {
+	while (line) {
 		if (buffer[0] != '#')
 			break;
 		if (strncmp(buffer, "#P:", 3)) {
@@ -84,22 +64,21 @@ static struct cpuidle_datas * ftrace_load(const char *filename)
 			if (ret != 1)
 				nrcpus = 0;
 		}
-		line = fgets(buffer, BUFSIZE, f);
+		line = line_reader_gets(reader, buffer, BUFSIZE);
 	}
 
 	if (!line)
-		goto error_close;
+		goto error_read;
 
-	if (!nrcpus) {
-		fclose(f);
+	/* The events start with the first line after the comments */
+	line_reader_unget(reader);
+
+	if (!nrcpus)
 		return ptrerror("Cannot load trace file (nrcpus == 0)");
-	}
 
 	datas = calloc(sizeof(*datas), 1);
-	if (!datas) {
-		fclose(f);
+	if (!datas)
 		return ptrerror(__func__);
-	}
 
 	datas->nrcpus = nrcpus;
 	datas->pstates = build_pstate_info(nrcpus);
@@ -115,14 +94,16 @@ static struct cpuidle_datas * ftrace_load(const char *filename)
 	if (is_err(datas->cstates))
 		goto propagate_error_free_datas;
 
-	load_text_data_lines(f, buffer, datas);
+	/* The trace was taken on this host, preload its P-states */
+	if (seed_pstates_from_sysfs(datas))
+		goto propagate_error_free_datas;
 
-	fclose(f);
+	if (load_text_data_lines(reader, datas))
+		goto propagate_error_free_datas;
 
 	return datas;
 
  propagate_error_free_datas:
-	fclose(f);
 	if (!is_err(datas->topo))
 		release_cpu_topo_info(datas->topo);
 	if (!is_err(datas->cstates))
@@ -130,8 +111,7 @@ static struct cpuidle_datas * ftrace_load(const char *filename)
 	free(datas);
 	return ptrerror(NULL);
 
- error_close:
-	fclose(f);
+ error_read:
 	fprintf(stderr, "%s: error or EOF while reading '%s': %m",
 		__func__, filename);
 	return ptrerror(NULL);
@@ -24,34 +24,47 @@
  * Contributors:
  *     Tuukka Tikkanen <tuukka.tikkanen@linaro.org>
  */
+#define _GNU_SOURCE
 #include "topology.h"
+#include "analysis.h"
 #include "trace_ops.h"
+#include "trace_event.h"
+#include "line_reader.h"
+#include "ring.h"
+#include "reorder.h"
 #include "utils.h"
+#include "compiler.h"
 #include "idlestat.h"
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
 #include <assert.h>
-#include <float.h>
+#include <pthread.h>
 
-#define TRACE_FORMAT "%*[^]]] %*s %lf:%*[^=]=%u%*[^=]=%d"
+#define PARSE_CHUNK_SIZE (4 << 20)
+#define PIPELINE_BLOCKS 8
+#define PIPELINE_BLOCK_SIZE (1 << 20)
+
+/* Longest the events are held waiting for the clock marks of the cpus */
+#define CLOCK_HOLD_NSEC NSEC_PER_SEC
 
 /**
  * load_and_build_cstate_info - load c-state info written to idlestat
  * trace file.
  *
- * @f: the file handle of the idlestat trace file
+ * @reader: the idlestat trace file
  * @nrcpus: number of CPUs
  *
  * @return: per-CPU array of structs (success) or ptrerror() (error)
  */
-static struct cpuidle_cstates *load_and_build_cstate_info(FILE* f, char *buffer, int nrcpus, struct cpu_topology * topo)
+struct cpuidle_cstates *load_and_build_cstate_info(struct line_reader *reader, char *buffer, int nrcpus, struct cpu_topology * topo)
 {
 	int cpu;
 	struct cpuidle_cstates *cstates;
+	char *line = NULL;
 
-	assert(f != NULL);
+	assert(reader != NULL);
 	assert(buffer != NULL);
 	assert(nrcpus > 0);
 
@@ -88,9 +101,9 @@ static struct cpuidle_cstates *load_and_build_cstate_info(FILE* f, char *buffer,
 				return ptrerror(__func__);
 			}
 
-			fgets(buffer, BUFSIZE, f);
+			line_reader_gets(reader, buffer, BUFSIZE);
 			sscanf(buffer, "\t%s\n", name);
-			fgets(buffer, BUFSIZE, f);
+			line_reader_gets(reader, buffer, BUFSIZE);
 			sscanf(buffer, "\t%d\n", &residency);
 
 			c = &(cstates[cpu].cstate[i]);
@@ -104,130 +117,786 @@ static struct cpuidle_cstates *load_and_build_cstate_info(FILE* f, char *buffer,
 			c->nrdata = 0;
 			c->early_wakings = 0;
 			c->late_wakings = 0;
-			c->avg_time = 0.;
-			c->max_time = 0.;
-			c->min_time = DBL_MAX;
-			c->duration = 0.;
+			c->max_time = 0;
+			c->min_time = TIME_MAX;
+			c->duration = 0;
 			c->target_residency = residency;
 		}
-		fgets(buffer, BUFSIZE, f);
+		line = line_reader_gets(reader, buffer, BUFSIZE);
 	}
 
+	/* The events start with the line after the C-states */
+	if (line)
+		line_reader_unget(reader);
+
 	return cstates;
 }
 
-int load_text_data_line(char *buffer, struct cpuidle_datas *datas, char *format, double *begin, double *end, size_t *start)
+/* Where the events of a trace being loaded are accounted */
+struct load_state {
+	struct cpuidle_datas *datas;
+	uint64_t *begin;
+	uint64_t *end;
+	size_t *start;
+};
+
+static int account_trace_event(struct trace_event *ev, void *arg)
 {
-	unsigned int state, freq, cpu;
-	double time;
-
-	if (strstr(buffer, "cpu_idle")) {
-		if (sscanf(buffer, format, &time, &state, &cpu)
-		    != 3) {
-			fprintf(stderr, "warning: Unrecognized cpuidle "
-				"record. The result of analysis might "
-				"be wrong.\n");
-			return -1;
+	struct load_state *ls = arg;
+
+	if (ev->type == TRACE_EVENT_CPU_IDLE) {
+		if (*ls->start) {
+			*ls->begin = ev->time;
+			*ls->start = 0;
 		}
+		*ls->end = ev->time;
+	}
+
+	return store_trace_event(ls->datas, ev);
+}
+
+/*
+ * Events of the start of a trace, held until the clock offsets of the
+ * cpus are known, see hold_trace_event().
+ */
+struct clock_hold {
+	struct saved_trace_event *events;
+	size_t nr_events;
+	size_t max_events;
+	size_t failed;		/* events released which could not be accounted */
+};
+
+/*
+ * Once corrected, the events of a cpu are out of order with those of the
+ * others by up to its skew: the reorder window must cover the largest.
+ */
+static void cover_clock_skew(struct cpuidle_datas *datas)
+{
+	struct cpuidle_cstates *cs0 = &datas->cstates[0];
+	int64_t skew;
+	int cpu;
+
+	if (!cs0->clock_marks)
+		return;
+
+	for (cpu = 1; cpu < datas->nrcpus; cpu++) {
+		if (!datas->cstates[cpu].clock_marks)
+			continue;
+		skew = datas->cstates[cpu].clock_offset - cs0->clock_offset;
+		if (skew < 0)
+			skew = -skew;
+		if ((uint64_t)skew > datas->clock_skew)
+			datas->clock_skew = skew;
+	}
+
+	if (datas->reorder)
+		widen_reorder_window(datas->reorder, datas->clock_skew);
+}
+
+/*
+ * Estimate the offset of the trace clock of a cpu from CLOCK_MONOTONIC
+ * from the marks idlestat_wake_all() wrote on it when the capture
+ * started. The least delayed mark gives the smallest offset.
+ */
+static void sync_trace_clock(struct cpuidle_datas *datas,
+			     struct trace_event *ev)
+{
+	struct cpuidle_cstates *cs;
+	int64_t offset;
+
+	/* The cpus share the clock, there is nothing to correct */
+	if (!ev->mono || ev->cpu < 0 || ev->cpu >= datas->nrcpus)
+		return;
+
+	cs = &datas->cstates[ev->cpu];
+	if (cs->clock_marks >= TRACE_CLOCK_SYNC_NRMARKS)
+		return;
+
+	offset = (int64_t)(ev->time - ev->mono);
+	if (!cs->clock_marks++ || offset < cs->clock_offset) {
+		cs->clock_offset = offset;
+		cover_clock_skew(datas);
+	}
+}
+
+/* Whether every online cpu has its marks, hence its clock offset */
+static int trace_clocks_synced(struct cpuidle_datas *datas)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < datas->nrcpus; cpu++)
+		if (cpu_is_online(datas->topo, cpu) &&
+		    datas->cstates[cpu].clock_marks < TRACE_CLOCK_SYNC_NRMARKS)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Move an event to the trace clock of cpu 0, once the offsets of both
+ * clocks are known. The events of a cpu are shifted by the same amount,
+ * so they stay in order, but the reorder buffer must merge the cpus.
+ */
+static void correct_clock_skew(struct cpuidle_datas *datas,
+			       struct trace_event *ev)
+{
+	struct cpuidle_cstates *cs;
+
+	if (!ev->time || ev->cpu <= 0 || ev->cpu >= datas->nrcpus ||
+	    !datas->cstates[0].clock_marks)
+		return;
+
+	cs = &datas->cstates[ev->cpu];
+	if (cs->clock_marks)
+		ev->time -= cs->clock_offset - datas->cstates[0].clock_offset;
+}
+
+static int account_synced_event(struct trace_event *ev,
+				struct cpuidle_datas *datas,
+				struct load_state *ls)
+{
+	correct_clock_skew(datas, ev);
+
+	if (datas->reorder)
+		return reorder_trace_event(datas->reorder, ev,
+					   account_trace_event, ls);
+
+	return account_trace_event(ev, ls);
+}
+
+/* Account the events held so far, now that the clock offsets are known */
+static void release_clock_hold(struct cpuidle_datas *datas,
+			       struct load_state *ls)
+{
+	struct clock_hold *hold = datas->clock_hold;
+	struct trace_event ev;
+	size_t i;
+
+	datas->clock_synced = 1;
+	if (!hold)
+		return;
+
+	for (i = 0; i < hold->nr_events; i++) {
+		restore_trace_event(&hold->events[i], &ev);
+		if (account_synced_event(&ev, datas, ls) == -1)
+			hold->failed++;
+	}
+
+	free(hold->events);
+	hold->events = NULL;
+	hold->nr_events = hold->max_events = 0;
+}
+
+/*
+ * The marks of a cpu come after its first events, the ones logged
+ * before idlestat_wake_all() visited it. Hold the events until every
+ * cpu has its marks, so the first ones are moved onto the clock of
+ * cpu 0 like the others. Cpus idlestat could not run on never get
+ * marks, and traces not captured by idlestat have none: the events are
+ * released anyway once they cover CLOCK_HOLD_NSEC.
+ *
+ * @return: 1 if the event is held, 0 if it is to be accounted now,
+ * -1 on error
+ */
+static int hold_trace_event(struct trace_event *ev,
+			    struct cpuidle_datas *datas,
+			    struct load_state *ls)
+{
+	struct clock_hold *hold = datas->clock_hold;
+	struct saved_trace_event *tmp;
+	size_t max;
+
+	if (datas->clock_synced)
+		return 0;
+
+	if (ev->type == TRACE_EVENT_CLOCK_SYNC) {
+		sync_trace_clock(datas, ev);
+		if (!ev->mono || trace_clocks_synced(datas))
+			release_clock_hold(datas, ls);
+		return 1;
+	}
+
+	if (!hold) {
+		hold = calloc(1, sizeof(*hold));
+		if (!hold)
+			return error(__func__);
+		datas->clock_hold = hold;
+	}
+
+	if (hold->nr_events && ev->time &&
+	    ev->time > hold->events[0].ev.time + CLOCK_HOLD_NSEC) {
+		release_clock_hold(datas, ls);
+		return 0;
+	}
+
+	if (hold->nr_events == hold->max_events) {
+		max = hold->max_events ? hold->max_events * 2 : 1024;
+		tmp = realloc(hold->events, max * sizeof(*tmp));
+		if (!tmp)
+			return error(__func__);
+		hold->events = tmp;
+		hold->max_events = max;
+	}
+
+	/* The name is copied, it may point into a buffer about to be reused */
+	if (save_trace_event(&hold->events[hold->nr_events], ev))
+		return -1;
+
+	hold->nr_events++;
+	return 1;
+}
+
+/**
+ * load_trace_event - account a decoded event of a trace being loaded
+ * @ev: the event
+ * @datas: per-trace statistics
+ * @begin: set to the time of the first cpu_idle event
+ * @end: set to the time of the last cpu_idle event
+ * @start: non zero until the first cpu_idle event
+ *
+ * The clock synchronization marks are consumed here, to correct the
+ * clock skew of the cpus the events were logged on. The events of the
+ * start of the trace are held until the skew is known, and with a
+ * reorder buffer set up, the event may be accounted later, once the
+ * events before it came. flush_trace_events() accounts the last ones.
+ *
+ * @return: 0 on success, -1 if the event could not be accounted
+ */
+int load_trace_event(struct trace_event *ev, struct cpuidle_datas *datas,
+		     uint64_t *begin, uint64_t *end, size_t *start)
+{
+	struct load_state ls = { datas, begin, end, start };
+	int ret;
+
+	ret = hold_trace_event(ev, datas, &ls);
+	if (ret)
+		return ret > 0 ? 0 : -1;
+
+	/* Marks of the cpus which had none when the events were released */
+	if (ev->type == TRACE_EVENT_CLOCK_SYNC) {
+		sync_trace_clock(datas, ev);
+		return 0;
+	}
+
+	return account_synced_event(ev, datas, &ls);
+}
 
-		if (*start) {
-			*begin = time;
-			*start = 0;
+/**
+ * flush_trace_events - account the events held or left in the reorder buffer
+ * @datas: per-trace statistics
+ * @begin: see load_trace_event()
+ * @end: see load_trace_event()
+ * @start: see load_trace_event()
+ *
+ * @return: the number of events load_trace_event() succeeded on which
+ * could not be accounted
+ */
+size_t flush_trace_events(struct cpuidle_datas *datas, uint64_t *begin,
+			  uint64_t *end, size_t *start)
+{
+	struct load_state ls = { datas, begin, end, start };
+	struct clock_hold *hold;
+	size_t failed = 0;
+	int cpu;
+
+	if (!datas->clock_synced)
+		release_clock_hold(datas, &ls);
+
+	hold = datas->clock_hold;
+	if (hold) {
+		failed = hold->failed;
+		free(hold);
+		datas->clock_hold = NULL;
+	}
+
+	for (cpu = 1; cpu < datas->nrcpus; cpu++)
+		if (datas->cstates[0].clock_marks &&
+		    datas->cstates[cpu].clock_marks)
+			verbose_printf(1, "cpu%d: trace clock skew %lld ns\n",
+				       cpu, (long long)
+				       (datas->cstates[cpu].clock_offset -
+					datas->cstates[0].clock_offset));
+
+	if (datas->clock_skew && !datas->reorder)
+		fprintf(stderr, "warning: the trace clocks of the cpus are "
+			"skewed by up to %llu us and the reorder window is "
+			"disabled, the results of the analysis might be "
+			"wrong.\n", (unsigned long long)
+			(datas->clock_skew / NSEC_PER_USEC));
+
+	return failed + flush_reorder_buffer(datas, account_trace_event, &ls);
+}
+
+int load_text_data_line(const char *line, size_t len, struct cpuidle_datas *datas, uint64_t *begin, uint64_t *end, size_t *start)
+{
+	struct trace_event ev;
+
+	if (parse_trace_event(line, len, &ev) <= 0)
+		return -1;
+
+	return load_trace_event(&ev, datas, begin, end, start);
+}
+
+/*
+ * Events decoded from a range of whole lines, off the analysis thread.
+ * Events which could not be decoded are kept with a negative type, so
+ * the warnings are printed in trace order.
+ */
+struct event_batch {
+	struct trace_event *events;
+	size_t nr_events;
+	size_t max_events;
+	int error;
+};
+
+static void decode_event_batch(const char *line, const char *end,
+			       struct event_batch *batch)
+{
+	struct trace_event ev, *tmp;
+	const char *next;
+	size_t max;
+	int ret;
+
+	batch->nr_events = 0;
+	batch->error = 0;
+
+	while (line < end) {
+		next = memchr(line, '\n', end - line);
+		next = next ? next + 1 : end;
+
+		ret = decode_trace_event(line, next - line, &ev);
+		line = next;
+		if (!ret)
+			continue;
+		if (ret < 0)
+			ev.type = -ev.type;
+
+		if (batch->nr_events == batch->max_events) {
+			max = batch->max_events ? batch->max_events * 2 : 4096;
+			tmp = realloc(batch->events, max * sizeof(*tmp));
+			if (!tmp) {
+				batch->error = error(__func__);
+				return;
+			}
+			batch->events = tmp;
+			batch->max_events = max;
 		}
-		*end = time;
 
-		return store_data(time, state, cpu, datas);
+		batch->events[batch->nr_events++] = ev;
 	}
+}
+
+static void load_event_batch(struct event_batch *batch,
+			     struct cpuidle_datas *datas,
+			     uint64_t *begin, uint64_t *end,
+			     size_t *start, size_t *count)
+{
+	struct trace_event *ev;
+	size_t i;
 
-	if (strstr(buffer, "cpu_frequency")) {
-		if (sscanf(buffer, format, &time, &freq, &cpu) != 3) {
-			fprintf(stderr, "warning: Unrecognized cpufreq "
-				"record. The result of analysis might "
-				"be wrong.\n");
-			return -1;
+	for (i = 0; i < batch->nr_events; i++) {
+		ev = &batch->events[i];
+		if (ev->type < 0) {
+			warn_trace_event(-ev->type);
+			continue;
 		}
-		return cpu_change_pstate(datas, cpu, freq, time);
+		if (load_trace_event(ev, datas, begin, end, start) != -1)
+			(*count)++;
 	}
+}
+
+struct parse_chunk {
+	const char *begin;
+	const char *end;
+	struct event_batch batch;
+};
 
-	return get_wakeup_irq(datas, buffer);
+static void parse_chunk(void *arg, int index)
+{
+	struct parse_chunk *chunk = (struct parse_chunk *)arg + index;
+
+	decode_event_batch(chunk->begin, chunk->end, &chunk->batch);
 }
 
-void load_text_data_lines(FILE *f, char *buffer, struct cpuidle_datas *datas)
+/*
+ * Decode the lines of a mapped trace on up to get_analysis_jobs()
+ * threads, PARSE_CHUNK_SIZE bytes per thread at a time. The decoded
+ * events are then accounted in trace order, so the statistics are the
+ * same as with load_text_data_line().
+ */
+static int load_text_data_chunks(const char *pos, const char *end,
+				 struct cpuidle_datas *datas,
+				 uint64_t *begin, uint64_t *last,
+				 size_t *start, size_t *count)
 {
-	double begin = 0, end = 0;
-	size_t count = 0, start = 1;
+	struct parse_chunk *chunks;
+	int maxchunks, nrchunks, i, ret = 0;
+	const char *p;
+
+	maxchunks = get_analysis_jobs();
+	chunks = calloc(maxchunks, sizeof(*chunks));
+	if (!chunks)
+		return error(__func__);
+
+	while (pos < end && !ret) {
+		/* Cut the next ranges on line boundaries */
+		for (nrchunks = 0; nrchunks < maxchunks && pos < end;
+		     nrchunks++) {
+			p = pos + MIN((size_t)(end - pos), PARSE_CHUNK_SIZE);
+			if (p < end) {
+				p = memchr(p, '\n', end - p);
+				p = p ? p + 1 : end;
+			}
+			chunks[nrchunks].begin = pos;
+			chunks[nrchunks].end = p;
+			pos = p;
+		}
 
-	setup_topo_states(datas);
+		run_analysis_jobs(nrchunks, parse_chunk, chunks);
 
-	do {
-		if (load_text_data_line(buffer, datas, TRACE_FORMAT,
-					&begin, &end, &start) != -1) {
-			count++;
+		for (i = 0; i < nrchunks; i++) {
+			if (chunks[i].batch.error) {
+				ret = -1;
+				break;
+			}
+			load_event_batch(&chunks[i].batch, datas,
+					 begin, last, start, count);
 		}
-	} while (fgets(buffer, BUFSIZE, f));
+	}
 
-	fprintf(stderr, "Log is %lf secs long with %zu events\n",
-		end - begin, count);
+	for (i = 0; i < maxchunks; i++)
+		free(chunks[i].batch.events);
+	free(chunks);
+
+	return ret;
 }
 
-static int idlestat_magic(const char *filename)
+/*
+ * Pipelined loading of traces which cannot be mapped, such as pipes.
+ * A reader thread fills blocks of whole lines, a parser thread decodes
+ * them and the calling thread accounts the events. The blocks go round
+ * from one stage to the next through single producer, single consumer
+ * rings, so reading, decoding and analysis overlap.
+ */
+struct pipeline_block {
+	char *data;
+	size_t len;
+	size_t size;
+	struct event_batch batch;
+	int error;		/* read error */
+	int last;		/* end of the trace or read error */
+};
+
+struct pipeline {
+	struct line_reader *reader;
+	struct pipeline_block blocks[PIPELINE_BLOCKS];
+	struct spsc_ring free;		/* analyzer -> reader */
+	struct spsc_ring read;		/* reader -> parser */
+	struct spsc_ring parsed;	/* parser -> analyzer */
+};
+
+static int grow_pipeline_block(struct pipeline_block *b, size_t size)
 {
-	FILE *f;
-	char *line;
-	char buffer[BUFSIZE];
+	char *tmp;
+
+	if (b->size >= size)
+		return 0;
+
+	tmp = realloc(b->data, size);
+	if (!tmp)
+		return error(__func__);
 
-	f = fopen(filename, "r");
-	if (!f) {
-		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
-					filename);
+	b->data = tmp;
+	b->size = size;
+	return 0;
+}
+
+/*
+ * Fill each block with whole lines. The partial line at the end of a
+ * block is moved to the start of the next one.
+ */
+static void *pipeline_reader(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct pipeline_block *b, *next;
+	const char *nl;
+	size_t keep;
+	ssize_t n;
+
+	b = spsc_ring_pop(&pl->free);
+	b->len = 0;
+
+	for (;;) {
+		if (b->len == b->size &&
+		    grow_pipeline_block(b, b->size * 2))
+			break;
+
+		n = line_reader_read(pl->reader, b->data + b->len,
+				     b->size - b->len);
+		if (n < 0)
+			break;
+		if (n == 0) {
+			b->last = 1;
+			spsc_ring_push(&pl->read, b);
+			return NULL;
+		}
+
+		b->len += n;
+		if (b->len < b->size)
+			continue;
+
+		nl = memrchr(b->data, '\n', b->len);
+		if (!nl)
+			continue;
+
+		/* On error, @next is left out, the blocks are freed anyway */
+		next = spsc_ring_pop(&pl->free);
+		keep = b->data + b->len - (nl + 1);
+		if (grow_pipeline_block(next, keep + 1))
+			break;
+		memcpy(next->data, nl + 1, keep);
+		next->len = keep;
+		b->len -= keep;
+
+		spsc_ring_push(&pl->read, b);
+		b = next;
+	}
+
+	b->error = -1;
+	b->last = 1;
+	spsc_ring_push(&pl->read, b);
+	return NULL;
+}
+
+static void decode_pipeline_block(struct pipeline_block *b)
+{
+	if (!b->error)
+		decode_event_batch(b->data, b->data + b->len, &b->batch);
+}
+
+static void *pipeline_parser(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct pipeline_block *b;
+
+	do {
+		b = spsc_ring_pop(&pl->read);
+		decode_pipeline_block(b);
+		spsc_ring_push(&pl->parsed, b);
+	} while (!b->last);
+
+	return NULL;
+}
+
+static void release_pipeline(struct pipeline *pl)
+{
+	int i;
+
+	for (i = 0; i < PIPELINE_BLOCKS; i++) {
+		free(pl->blocks[i].data);
+		free(pl->blocks[i].batch.events);
+	}
+
+	spsc_ring_release(&pl->free);
+	spsc_ring_release(&pl->read);
+	spsc_ring_release(&pl->parsed);
+	free(pl);
+}
+
+static struct pipeline *setup_pipeline(struct line_reader *reader)
+{
+	struct pipeline *pl;
+	int i;
+
+	pl = calloc(1, sizeof(*pl));
+	if (!pl)
+		return ptrerror(__func__);
+
+	pl->reader = reader;
+
+	if (spsc_ring_init(&pl->free, PIPELINE_BLOCKS) ||
+	    spsc_ring_init(&pl->read, PIPELINE_BLOCKS) ||
+	    spsc_ring_init(&pl->parsed, PIPELINE_BLOCKS))
+		goto out_release;
+
+	for (i = 0; i < PIPELINE_BLOCKS; i++) {
+		if (grow_pipeline_block(&pl->blocks[i], PIPELINE_BLOCK_SIZE))
+			goto out_release;
+		spsc_ring_push(&pl->free, &pl->blocks[i]);
+	}
+
+	return pl;
+
+out_release:
+	release_pipeline(pl);
+	return ptrerror(NULL);
+}
+
+/*
+ * Returns 1 if the pipeline could not be started, in which case nothing
+ * has been read and the caller should fall back to line_reader_next().
+ */
+static int load_text_data_pipeline(struct line_reader *reader,
+				   struct cpuidle_datas *datas,
+				   uint64_t *begin, uint64_t *end,
+				   size_t *start, size_t *count)
+{
+	struct pipeline *pl;
+	struct pipeline_block *b;
+	struct spsc_ring *input;
+	pthread_t reader_thread, parser_thread;
+	int parser, ret = 0;
+
+	pl = setup_pipeline(reader);
+	if (is_err(pl))
+		return 1;
+
+	if (pthread_create(&reader_thread, NULL, pipeline_reader, pl)) {
+		release_pipeline(pl);
+		return 1;
+	}
+
+	/* Without a parser thread, decode the blocks here */
+	parser = !pthread_create(&parser_thread, NULL, pipeline_parser, pl);
+	input = parser ? &pl->parsed : &pl->read;
+
+	do {
+		b = spsc_ring_pop(input);
+		if (!parser)
+			decode_pipeline_block(b);
+
+		/* Keep the blocks flowing until the reader is done */
+		if (b->error || b->batch.error)
+			ret = -1;
+		else if (!ret)
+			load_event_batch(&b->batch, datas,
+					 begin, end, start, count);
+
+		if (!b->last)
+			spsc_ring_push(&pl->free, b);
+	} while (!b->last);
+
+	pthread_join(reader_thread, NULL);
+	if (parser)
+		pthread_join(parser_thread, NULL);
+
+	release_pipeline(pl);
+	return ret;
+}
+
+/**
+ * load_text_data_lines - analyze the events of a text trace
+ * @reader: the trace, whose header has been read
+ * @datas: per-trace statistics, with topology and C-states already set up
+ *
+ * With --jobs, the lines of a mapped file are decoded in parallel, and
+ * other traces, such as pipes, are read, decoded and analyzed by a
+ * pipeline of threads.
+ *
+ * @return: 0 on success, -1 if the trace could not be read
+ */
+int load_text_data_lines(struct line_reader *reader,
+			 struct cpuidle_datas *datas)
+{
+	const char *line;
+	size_t len;
+	uint64_t begin = 0, end = 0;
+	size_t count = 0, start = 1, failed;
+	int ret;
+
+	if (setup_topo_states(datas) || setup_event_streams(datas) ||
+	    setup_reorder_buffer(datas))
 		return -1;
+
+	ret = 1;
+	if (reader->map && get_analysis_jobs() > 1)
+		ret = load_text_data_chunks(reader->pos, reader->end, datas,
+					    &begin, &end, &start, &count);
+	else if (!reader->map && get_analysis_jobs() > 1)
+		ret = load_text_data_pipeline(reader, datas, &begin, &end,
+					      &start, &count);
+
+	if (ret > 0) {
+		while ((ret = line_reader_next(reader, &line, &len)) > 0) {
+			if (load_text_data_line(line, len, datas,
+						&begin, &end, &start) != -1) {
+				count++;
+			}
+		}
 	}
 
-	line = fgets(buffer, BUFSIZE, f);
-	fclose(f);
+	count -= flush_trace_events(datas, &begin, &end, &start);
+
+	if (analyze_event_streams(datas, &failed))
+		ret = -1;
+	count -= failed;
+
+	fprintf(stderr, "Log is %lf secs long with %zu events\n",
+		NSEC_TO_SEC(end - begin), count);
+	report_trace_coverage(datas);
 
-	return (line != NULL) && !strncmp(buffer, "idlestat version", 16);
+	return ret;
 }
 
-static struct cpuidle_datas * idlestat_native_load(const char *filename)
+/**
+ * check_trace_magic - check the first line of a text trace
+ * @reader: the trace, or NULL if it is a directory
+ * @magic: what the first line starts with in the format checked
+ *
+ * The line is left to the loader.
+ *
+ * @return: 1 if the trace is in the format, 0 if not, -1 on error
+ */
+int check_trace_magic(struct line_reader *reader, const char *magic)
+{
+	const char *line;
+	size_t len;
+	int ret;
+
+	if (!reader)
+		return 0;
+
+	ret = line_reader_peek(reader, &line, &len);
+	if (ret <= 0)
+		return ret;
+
+	return len >= strlen(magic) && !memcmp(line, magic, strlen(magic));
+}
+
+static int idlestat_magic(UNUSED const char *filename,
+			  struct line_reader *reader)
+{
+	return check_trace_magic(reader, "idlestat version");
+}
+
+static struct cpuidle_datas * idlestat_native_load(const char *filename,
+						    struct line_reader *reader)
 {
-	FILE *f;
 	unsigned int nrcpus;
 	struct cpuidle_datas *datas;
 	char *line;
 	char buffer[BUFSIZE];
 
-	f = fopen(filename, "r");
-	if (!f) {
-		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
-					filename);
-		return ptrerror(NULL);
-	}
-
 	/* Version line */
-	line = fgets(buffer, BUFSIZE, f);
+	line = line_reader_gets(reader, buffer, BUFSIZE);
 	if (!line)
-		goto error_close;
+		goto error_read;
 
 	/* Number of CPUs */
-	line = fgets(buffer, BUFSIZE, f);
+	line = line_reader_gets(reader, buffer, BUFSIZE);
 	if (!line)
-		goto error_close;
+		goto error_read;
 
-	if (sscanf(buffer, "cpus=%u", &nrcpus) != 1 || nrcpus == 0) {
-		fclose(f);
+	if (sscanf(buffer, "cpus=%u", &nrcpus) != 1 || nrcpus == 0)
 		return ptrerror("Cannot load trace file (nrcpus == 0)");
-	}
 
-	line = fgets(buffer, BUFSIZE, f);
+	line = line_reader_gets(reader, buffer, BUFSIZE);
 	if (!line)
-		goto error_close;
+		goto error_read;
 
 	datas = calloc(sizeof(*datas), 1);
-	if (!datas) {
-		fclose(f);
+	if (!datas)
 		return ptrerror(__func__);
-	}
 
 	datas->nrcpus = nrcpus;
 	datas->pstates = build_pstate_info(nrcpus);
@@ -235,24 +904,22 @@ static struct cpuidle_datas * idlestat_native_load(const char *filename)
 		goto propagate_error_free_datas;
 
 	/* Read topology information */
-	datas->topo = read_cpu_topo_info(f, buffer);
+	datas->topo = read_cpu_topo_info(reader, buffer);
 	if (is_err(datas->topo))
 		goto propagate_error_free_datas;
 
 	/* Read C-state information */
-	datas->cstates = load_and_build_cstate_info(f, buffer,
-						nrcpus, datas->topo);
+	datas->cstates = load_and_build_cstate_info(reader, buffer, nrcpus,
+						    datas->topo);
 	if (is_err(datas->cstates))
 		goto propagate_error_free_datas;
 
-	load_text_data_lines(f, buffer, datas);
-
-	fclose(f);
+	if (load_text_data_lines(reader, datas))
+		goto propagate_error_free_datas;
 
 	return datas;
 
  propagate_error_free_datas:
-	fclose(f);
 	if (!is_err(datas->topo))
 		release_cpu_topo_info(datas->topo);
 	if (!is_err(datas->cstates))
@@ -260,8 +927,7 @@ static struct cpuidle_datas * idlestat_native_load(const char *filename)
 	free(datas);
 	return ptrerror(NULL);
 
- error_close:
-	fclose(f);
+ error_read:
 	fprintf(stderr, "%s: error or EOF while reading '%s': %m",
 		__func__, filename);
 	return ptrerror(NULL);
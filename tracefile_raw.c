@@ -0,0 +1,208 @@
+/*
+ *  tracefile_raw.c
+ *
+ *  Copyright (C) 2026, Linaro Limited.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+#include "topology.h"
+#include "trace_ops.h"
+#include "trace_event.h"
+#include "trace_raw.h"
+#include "utils.h"
+#include "compiler.h"
+#include "line_reader.h"
+#include "idlestat.h"
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * A raw capture is a directory holding the header of an idlestat trace
+ * file (followed by the P-state events idlestat adds at the start and
+ * end of a capture), the ring buffer pages of each cpu and a copy of the
+ * tracing format files needed to decode them.
+ */
+static int raw_magic(const char *filename, struct line_reader *reader)
+{
+	char path[PATH_MAX];
+	struct line_reader *header;
+	int ret;
+
+	if (reader)
+		return 0;
+
+	snprintf(path, sizeof(path), "%s/" RAW_CAPTURE_HEADER, filename);
+	if (access(path, R_OK))
+		return 0;
+
+	header = line_reader_open(path);
+	if (is_err(header))
+		return -1;
+
+	ret = check_trace_magic(header, "idlestat version");
+	line_reader_close(header);
+	return ret;
+}
+
+/* The event lines after the header go to the stream of cpu -1 */
+static int load_header_events(struct line_reader *reader,
+			      struct raw_stream *rs)
+{
+	struct trace_event ev;
+	const char *line;
+	size_t len;
+	int ret;
+
+	rs->cpu = -1;
+
+	while ((ret = line_reader_next(reader, &line, &len)) > 0) {
+		if (parse_trace_event(line, len, &ev) <= 0)
+			continue;
+		if (ev.type != TRACE_EVENT_CPU_FREQUENCY)
+			continue;
+		if (raw_stream_add_event(&ev, rs))
+			return -1;
+	}
+
+	return ret;
+}
+
+static struct cpuidle_datas *raw_load(const char *filename,
+				       UNUSED struct line_reader *reader)
+{
+	char path[PATH_MAX], buffer[BUFSIZE];
+	struct raw_stream *streams = NULL;
+	struct cpuidle_datas *datas;
+	struct raw_trace *rt;
+	unsigned int nrcpus, cpu;
+	struct line_reader *header;
+	char *line;
+
+	snprintf(path, sizeof(path), "%s/" RAW_CAPTURE_HEADER, filename);
+	header = line_reader_open(path);
+	if (is_err(header))
+		return ptrerror(NULL);
+
+	/* Version line */
+	line = line_reader_gets(header, buffer, BUFSIZE);
+	if (!line)
+		goto error_close;
+
+	/* Number of CPUs */
+	line = line_reader_gets(header, buffer, BUFSIZE);
+	if (!line)
+		goto error_close;
+
+	if (sscanf(buffer, "cpus=%u", &nrcpus) != 1 || nrcpus == 0) {
+		line_reader_close(header);
+		return ptrerror("Cannot load trace file (nrcpus == 0)");
+	}
+
+	line = line_reader_gets(header, buffer, BUFSIZE);
+	if (!line)
+		goto error_close;
+
+	rt = raw_trace_open(filename);
+	if (is_err(rt)) {
+		line_reader_close(header);
+		return ptrerror(NULL);
+	}
+
+	datas = calloc(sizeof(*datas), 1);
+	if (!datas) {
+		raw_trace_close(rt);
+		line_reader_close(header);
+		return ptrerror(__func__);
+	}
+
+	datas->nrcpus = nrcpus;
+	datas->pstates = build_pstate_info(nrcpus);
+	if (!datas->pstates)
+		goto propagate_error_free_datas;
+
+	/* Read topology information */
+	datas->topo = read_cpu_topo_info(header, buffer);
+	if (is_err(datas->topo))
+		goto propagate_error_free_datas;
+
+	/* Read C-state information */
+	datas->cstates = load_and_build_cstate_info(header, buffer, nrcpus,
+						    datas->topo);
+	if (is_err(datas->cstates))
+		goto propagate_error_free_datas;
+
+	/* One stream per cpu, plus the P-states of the capture */
+	streams = calloc(nrcpus + 1, sizeof(*streams));
+	if (!streams) {
+		error(__func__);
+		goto propagate_error_free_datas;
+	}
+
+	if (load_header_events(header, &streams[nrcpus]))
+		goto propagate_error_free_datas;
+
+	for (cpu = 0; cpu < nrcpus; cpu++) {
+		snprintf(path, sizeof(path), RAW_SEGMENT_FORMAT, filename,
+			 cpu);
+		if (raw_stream_map(&streams[cpu], cpu, path))
+			goto propagate_error_free_datas;
+	}
+
+	if (load_raw_streams(rt, datas, streams, nrcpus + 1))
+		goto propagate_error_free_datas;
+
+	for (cpu = 0; cpu <= nrcpus; cpu++)
+		raw_stream_release(&streams[cpu]);
+	free(streams);
+	raw_trace_close(rt);
+	line_reader_close(header);
+
+	return datas;
+
+ propagate_error_free_datas:
+	if (streams) {
+		for (cpu = 0; cpu <= nrcpus; cpu++)
+			raw_stream_release(&streams[cpu]);
+		free(streams);
+	}
+	raw_trace_close(rt);
+	line_reader_close(header);
+	if (!is_err(datas->topo))
+		release_cpu_topo_info(datas->topo);
+	if (!is_err(datas->cstates))
+		release_cstate_info(datas->cstates, nrcpus);
+	free(datas);
+	return ptrerror(NULL);
+
+ error_close:
+	line_reader_close(header);
+	fprintf(stderr, "%s: error or EOF while reading '%s': %m",
+		__func__, path);
+	return ptrerror(NULL);
+}
+
+static const struct trace_ops raw_trace_ops = {
+	.name = "Idlestat raw capture",
+	.check_magic = raw_magic,
+	.load = raw_load
+};
+
+EXPORT_TRACE_OPS(raw);
@@ -27,6 +27,8 @@
 #include "topology.h"
 #include "trace_ops.h"
 #include "utils.h"
+#include "compiler.h"
+#include "line_reader.h"
 #include "idlestat.h"
 #include <stddef.h>
 #include <stdio.h>
@@ -34,87 +36,46 @@
 #include <malloc.h>
 #include <assert.h>
 
-#define TRACE_CMD_REPORT_FORMAT "%*[^]]] %lf:%*[^=]=%u%*[^=]=%d"
-
-void tracecmd_load_text_data_lines(FILE *f, char *buffer, struct cpuidle_datas *datas)
-{
-	double begin = 0, end = 0;
-	size_t count = 0, start = 1;
-
-	setup_topo_states(datas);
-
-	do {
-		if (load_text_data_line(buffer, datas, TRACE_CMD_REPORT_FORMAT,
-					&begin, &end, &start) != -1) {
-			count++;
-		}
-	} while (fgets(buffer, BUFSIZE, f));
-
-	fprintf(stderr, "Log is %lf secs long with %zu events\n",
-		end - begin, count);
-}
-
-static int tracecmd_report_magic(const char *filename)
+static int tracecmd_report_magic(UNUSED const char *filename,
+				 struct line_reader *reader)
 {
-	FILE *f;
-	char *line;
-	char buffer[BUFSIZE];
-
-	f = fopen(filename, "r");
-	if (!f) {
-		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
-					filename);
-		return -1;
-	}
-
-	line = fgets(buffer, BUFSIZE, f);
-	fclose(f);
-
-	return (line != NULL) && !strncmp(buffer, "version = ", 10);
+	return check_trace_magic(reader, "version = ");
 }
 
-static struct cpuidle_datas * tracecmd_report_load(const char *filename)
+static struct cpuidle_datas * tracecmd_report_load(const char *filename,
+					struct line_reader *reader)
 {
-	FILE *f;
 	unsigned int nrcpus;
 	struct cpuidle_datas *datas;
 	int ret;
 	char *line;
 	char buffer[BUFSIZE];
 
-	f = fopen(filename, "r");
-	if (!f) {
-		fprintf(stderr, "%s: failed to open '%s': %m\n", __func__,
-					filename);
-		return ptrerror(NULL);
-	}
-
 	/* Version line */
-	line = fgets(buffer, BUFSIZE, f);
+	line = line_reader_gets(reader, buffer, BUFSIZE);
 	if (!line)
-		goto error_close;
+		goto error_read;
 
 	/* Number of CPUs */
 	nrcpus = 0;
-	line = fgets(buffer, BUFSIZE, f);
+	line = line_reader_gets(reader, buffer, BUFSIZE);
 	ret = sscanf(buffer, "cpus=%u", &nrcpus);
 	if (ret != 1)
 		nrcpus = 0;
-	line = fgets(buffer, BUFSIZE, f);
+	line = line_reader_gets(reader, buffer, BUFSIZE);
 
 	if (!line)
-		goto error_close;
+		goto error_read;
+
+	/* That was the first event */
+	line_reader_unget(reader);
 
-	if (!nrcpus) {
-		fclose(f);
+	if (!nrcpus)
 		return ptrerror("Cannot load trace file (nrcpus == 0)");
-	}
 
 	datas = calloc(sizeof(*datas), 1);
-	if (!datas) {
-		fclose(f);
+	if (!datas)
 		return ptrerror(__func__);
-	}
 
 	datas->nrcpus = nrcpus;
 	datas->pstates = build_pstate_info(nrcpus);
@@ -130,14 +91,16 @@ static struct cpuidle_datas * tracecmd_report_load(const char *filename)
 	if (is_err(datas->cstates))
 		goto propagate_error_free_datas;
 
-	tracecmd_load_text_data_lines(f, buffer, datas);
+	/* The trace was taken on this host, preload its P-states */
+	if (seed_pstates_from_sysfs(datas))
+		goto propagate_error_free_datas;
 
-	fclose(f);
+	if (load_text_data_lines(reader, datas))
+		goto propagate_error_free_datas;
 
 	return datas;
 
  propagate_error_free_datas:
-	fclose(f);
 	if (!is_err(datas->topo))
 		release_cpu_topo_info(datas->topo);
 	if (!is_err(datas->cstates))
@@ -145,8 +108,7 @@ static struct cpuidle_datas * tracecmd_report_load(const char *filename)
 	free(datas);
 	return ptrerror(NULL);
 
- error_close:
-	fclose(f);
+ error_read:
 	fprintf(stderr, "%s: error or EOF while reading '%s': %m",
 		__func__, filename);
 	return ptrerror(NULL);
@@ -27,7 +27,11 @@
  */
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #undef _GNU_SOURCE
+#include <errno.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -161,19 +165,6 @@ int read_char(const char *path, char *val)
 	return 0;
 }
 
-int store_line(const char *line, void *data)
-{
-	FILE *f = data;
-
-	/* ignore comment line */
-	if (line[0] == '#')
-		return 0;
-
-	fprintf(f, "%s", line);
-
-	return 0;
-}
-
 /*
  * This functions is a helper to read a specific file content and store
  * the content inside a variable pointer passed as parameter, the format
@@ -288,3 +279,44 @@ int check_window_size(void)
 
 	return -1;
 }
+
+/**
+ * start_pinned_thread - start a helper thread on the cpu idlestat runs on
+ * @thread: where to store the thread id
+ * @fn: thread function
+ * @arg: argument of @fn
+ *
+ * The thread runs on the cpu of the caller, to leave the traced cpus
+ * idle, and with all the signals blocked, to leave SIGALRM of
+ * execute() and the others to the main thread.
+ *
+ * @return: 0 on success, -1 with errno set otherwise
+ */
+int start_pinned_thread(pthread_t *thread, void *(*fn)(void *), void *arg)
+{
+	pthread_attr_t attr;
+	sigset_t mask, oldmask;
+	cpu_set_t cpus;
+	int cpu, ret;
+
+	pthread_attr_init(&attr);
+	cpu = sched_getcpu();
+	if (cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+	ret = pthread_create(thread, &attr, fn, arg);
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+	pthread_attr_destroy(&attr);
+
+	if (ret) {
+		errno = ret;
+		return -1;
+	}
+
+	return 0;
+}
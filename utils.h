@@ -30,6 +30,7 @@
 #define __UTILS_H
 
 #include <stdio.h>
+#include <pthread.h>
 
 extern void set_verbose_level(int level);
 extern int verbose_printf(int min_level, const char *fmt, ...);
@@ -38,13 +39,14 @@ extern int verbose_fprintf(FILE *f, int min_level, const char *fmt, ...);
 extern int write_int(const char *path, int val);
 extern int read_int(const char *path, int *val);
 extern int read_char(const char *path, char *val);
-extern int store_line(const char *line, void *data);
 extern int file_read_value(const char *path, const char *name,
 				const char *format, void *value);
 extern int redirect_stdout_to_file(const char *path);
 extern void display_factored_time(double time, int align);
 extern void display_factored_freq(int freq, int align);
 extern int check_window_size(void);
+extern int start_pinned_thread(pthread_t *thread, void *(*fn)(void *),
+			       void *arg);
 
 extern int error(const char *str);
 extern void *ptrerror(const char *str);